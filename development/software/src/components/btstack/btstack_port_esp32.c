@@ -51,7 +51,6 @@
 #include "btstack_memory.h"
 #include "btstack_run_loop.h"
 #include "btstack_run_loop_freertos.h"
-#include "btstack_ring_buffer.h"
 #include "btstack_tlv.h"
 #include "btstack_tlv_esp32.h"
 #include "ble/le_device_db_tlv.h"
@@ -66,7 +65,6 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/semphr.h"
 
 uint32_t esp_log_timestamp();
 
@@ -84,19 +82,72 @@ uint32_t hal_time_ms(void) {
 
 static void (*transport_packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size);
 
-// ring buffer for incoming HCI packets. Each packet has 2 byte len tag + H4 packet type + packet itself
+// incoming HCI packets are written once into fixed slots by the controller task
+// and handed to the run loop through a single-producer single-consumer queue
+// of slot indices. The run loop processes each packet in place and returns its
+// slot afterwards. Packets take the smallest free slot they fit in. Slots of a
+// class are returned in the order they are taken, so each class only needs a
+// counter of taken and a counter of returned slots
 #define MAX_NR_HOST_EVENT_PACKETS 4
-static uint8_t hci_ringbuffer_storage[HCI_HOST_ACL_PACKET_NUM   * (2 + 1 + HCI_ACL_HEADER_SIZE + HCI_HOST_ACL_PACKET_LEN) +
-                                      HCI_HOST_SCO_PACKET_NUM   * (2 + 1 + HCI_SCO_HEADER_SIZE + HCI_HOST_SCO_PACKET_LEN) +
-                                      MAX_NR_HOST_EVENT_PACKETS * (2 + 1 + HCI_EVENT_BUFFER_SIZE)];
 
-static btstack_ring_buffer_t hci_ringbuffer;
+#if (HCI_SCO_HEADER_SIZE + HCI_HOST_SCO_PACKET_LEN) > HCI_EVENT_BUFFER_SIZE
+#error SCO packets do not fit the event slots
+#endif
+
+// H4 packet type + packet, rounded up to keep the slots aligned
+#define HCI_SLOT_ALIGN(len)     (((len) + 3) & ~3)
+#define HCI_SLOT_SMALL_PACKET   (1 + HCI_EVENT_BUFFER_SIZE)
+#define HCI_SLOT_LARGE_PACKET   (1 + HCI_ACL_HEADER_SIZE + HCI_HOST_ACL_PACKET_LEN)
+#define HCI_SLOT_SMALL_SIZE     HCI_SLOT_ALIGN(HCI_INCOMING_PRE_BUFFER_SIZE + HCI_SLOT_SMALL_PACKET)
+#define HCI_SLOT_LARGE_SIZE     HCI_SLOT_ALIGN(HCI_INCOMING_PRE_BUFFER_SIZE + HCI_SLOT_LARGE_PACKET)
+#define HCI_SLOT_SMALL_NUM      (HCI_HOST_SCO_PACKET_NUM + MAX_NR_HOST_EVENT_PACKETS)
+#define HCI_SLOT_LARGE_NUM      HCI_HOST_ACL_PACKET_NUM
+#define HCI_SLOT_NUM            (HCI_SLOT_SMALL_NUM + HCI_SLOT_LARGE_NUM)
+
+#if HCI_SLOT_LARGE_PACKET < HCI_SLOT_SMALL_PACKET
+#error ACL slots must be able to hold events
+#endif
+
+typedef struct {
+    uint8_t * storage;
+    uint16_t  slot_size;
+    uint16_t  packet_len;       // largest packet, including the packet type
+    uint8_t   num;
+    uint8_t   first;            // index of the first slot of the class
+    uint32_t  taken;            // written by the controller task only
+    uint32_t  returned;         // written by the run loop only
+} hci_slot_class_t;
+
+static uint8_t hci_slot_small_storage[HCI_SLOT_SMALL_NUM * HCI_SLOT_SMALL_SIZE] __attribute__((aligned(4)));
+static uint8_t hci_slot_large_storage[HCI_SLOT_LARGE_NUM * HCI_SLOT_LARGE_SIZE] __attribute__((aligned(4)));
+
+static hci_slot_class_t hci_slot_classes[] = {
+    { hci_slot_small_storage, HCI_SLOT_SMALL_SIZE, HCI_SLOT_SMALL_PACKET, HCI_SLOT_SMALL_NUM, 0,                  0, 0 },
+    { hci_slot_large_storage, HCI_SLOT_LARGE_SIZE, HCI_SLOT_LARGE_PACKET, HCI_SLOT_LARGE_NUM, HCI_SLOT_SMALL_NUM, 0, 0 },
+};
+#define HCI_SLOT_CLASSES (sizeof(hci_slot_classes) / sizeof(hci_slot_classes[0]))
+
+// slots in the order the packets arrived, one entry per slot so it never overflows
+static uint8_t  hci_slot_queue[HCI_SLOT_NUM];
+static uint16_t hci_slot_len[HCI_SLOT_NUM];
+static uint32_t hci_slot_queue_head;    // written by the controller task only
+static uint32_t hci_slot_queue_tail;    // written by the run loop only
 
-// incoming packet buffer
-static uint8_t hci_packet_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + HCI_INCOMING_PACKET_BUFFER_SIZE]; // packet type + max(acl header + acl payload, event header + event data)
-static uint8_t * hci_receive_buffer = &hci_packet_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE];
+static btstack_port_esp32_rx_stats_t hci_rx_stats;
+
+static hci_slot_class_t * hci_slot_class(uint8_t index){
+    unsigned int c = 0;
+    while ((c + 1 < HCI_SLOT_CLASSES) && (index >= hci_slot_classes[c + 1].first)){
+        c++;
+    }
+    return &hci_slot_classes[c];
+}
 
-static SemaphoreHandle_t ring_buffer_mutex;
+// the pre-buffer in front of the packet is free for BTstack to use
+static uint8_t * hci_slot_packet(uint8_t index){
+    hci_slot_class_t * slot_class = hci_slot_class(index);
+    return &slot_class->storage[(index - slot_class->first) * slot_class->slot_size + HCI_INCOMING_PRE_BUFFER_SIZE];
+}
 
 static void transport_notify_packet_send(void *context);
 static btstack_context_callback_registration_t packet_send_callback_context = {
@@ -140,25 +191,46 @@ static int host_recv_pkt_cb(uint8_t *data, uint16_t len){
         return 0;
     }
 
-    xSemaphoreTake(ring_buffer_mutex, portMAX_DELAY);
+    hci_rx_stats.packets++;
+
+    // smallest class with a free slot
+    hci_slot_class_t * slot_class = NULL;
+    bool fits = false;
+    unsigned int c;
+    for (c = 0; (c < HCI_SLOT_CLASSES) && (slot_class == NULL); c++){
+        hci_slot_class_t * candidate = &hci_slot_classes[c];
+        if ((len == 0) || (len > candidate->packet_len)) continue;
+        fits = true;
+        uint32_t returned = __atomic_load_n(&candidate->returned, __ATOMIC_ACQUIRE);
+        if ((candidate->taken - returned) < candidate->num){
+            slot_class = candidate;
+        }
+    }
 
-    // check space
-    uint16_t space = btstack_ring_buffer_bytes_free(&hci_ringbuffer);
-    if (space < len){
-        xSemaphoreGive(ring_buffer_mutex);
-        log_error("transport_recv_pkt_cb packet %u, space %u -> dropping packet", len, space);
+    if (slot_class == NULL){
+        if (fits){
+            hci_rx_stats.dropped++;
+        } else {
+            hci_rx_stats.oversized++;
+        }
+        log_error("transport_recv_pkt_cb packet %u, %s -> dropping packet", len, fits ? "no free slot" : "too large");
         return 0;
     }
 
-    // store size in ringbuffer
-    uint8_t len_tag[2];
-    little_endian_store_16(len_tag, 0, len);
-    btstack_ring_buffer_write(&hci_ringbuffer, len_tag, sizeof(len_tag));
+    uint8_t index = slot_class->first + (slot_class->taken % slot_class->num);
+    memcpy(hci_slot_packet(index), data, len);
+    hci_slot_len[index] = len;
+    slot_class->taken++;
 
-    // store in ringbuffer
-    btstack_ring_buffer_write(&hci_ringbuffer, data, len);
+    // publish the slot, the run loop owns it from here on
+    uint32_t head = hci_slot_queue_head;
+    hci_slot_queue[head % HCI_SLOT_NUM] = index;
+    __atomic_store_n(&hci_slot_queue_head, head + 1, __ATOMIC_RELEASE);
 
-    xSemaphoreGive(ring_buffer_mutex);
+    uint32_t queued = head + 1 - __atomic_load_n(&hci_slot_queue_tail, __ATOMIC_ACQUIRE);
+    if (queued > hci_rx_stats.high_watermark){
+        hci_rx_stats.high_watermark = queued;
+    }
 
     btstack_run_loop_execute_on_main_thread(&packet_receive_callback_context);
     return 0;
@@ -180,20 +252,23 @@ static void transport_notify_packet_send(void *context){
 
 static void transport_deliver_packets(void *context){
     UNUSED(context);
-    xSemaphoreTake(ring_buffer_mutex, portMAX_DELAY);
-    while (btstack_ring_buffer_bytes_available(&hci_ringbuffer)){
-        uint32_t number_read;
-        uint8_t len_tag[2];
-        btstack_ring_buffer_read(&hci_ringbuffer, len_tag, 2, &number_read);
-        uint32_t len = little_endian_read_16(len_tag, 0);
-        btstack_ring_buffer_read(&hci_ringbuffer, hci_receive_buffer, len, &number_read);
-        xSemaphoreGive(ring_buffer_mutex);
-        transport_packet_handler(hci_receive_buffer[0], &hci_receive_buffer[1], len-1);
-        xSemaphoreTake(ring_buffer_mutex, portMAX_DELAY);
+    uint32_t tail = hci_slot_queue_tail;
+    while (tail != __atomic_load_n(&hci_slot_queue_head, __ATOMIC_ACQUIRE)){
+        uint8_t index = hci_slot_queue[tail % HCI_SLOT_NUM];
+        uint8_t * packet = hci_slot_packet(index);
+        transport_packet_handler(packet[0], &packet[1], hci_slot_len[index] - 1);
+
+        // hand the slot back to the controller task
+        hci_slot_class_t * slot_class = hci_slot_class(index);
+        __atomic_store_n(&slot_class->returned, slot_class->returned + 1, __ATOMIC_RELEASE);
+        tail++;
+        __atomic_store_n(&hci_slot_queue_tail, tail, __ATOMIC_RELEASE);
     }
-    xSemaphoreGive(ring_buffer_mutex);
 }
 
+void btstack_port_esp32_get_rx_stats(btstack_port_esp32_rx_stats_t * stats){
+    *stats = hci_rx_stats;
+}
 
 /**
  * init transport
@@ -201,7 +276,6 @@ static void transport_deliver_packets(void *context){
  */
 static void transport_init(const void *transport_config){
     log_info("transport_init");
-    ring_buffer_mutex = xSemaphoreCreateMutex();
 }
 
 /**
@@ -213,7 +287,15 @@ static int transport_open(void){
 
     log_info("transport_open");
 
-    btstack_ring_buffer_init(&hci_ringbuffer, hci_ringbuffer_storage, sizeof(hci_ringbuffer_storage));
+    // the controller does not deliver packets before its callbacks are registered
+    unsigned int c;
+    for (c = 0; c < HCI_SLOT_CLASSES; c++){
+        hci_slot_classes[c].taken    = 0;
+        hci_slot_classes[c].returned = 0;
+    }
+    hci_slot_queue_head = 0;
+    hci_slot_queue_tail = 0;
+    memset(&hci_rx_stats, 0, sizeof(hci_rx_stats));
 
     // http://esp-idf.readthedocs.io/en/latest/api-reference/bluetooth/controller_vhci.html (2017104)
     // - "esp_bt_controller_init: ... This function should be called only once, before any other BT functions are called."
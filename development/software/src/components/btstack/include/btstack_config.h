@@ -25,6 +25,10 @@
 #define ENABLE_LOG_ERROR
 #define ENABLE_LOG_INFO
 
+// Hierarchical timer wheel instead of the sorted timer list, for many timers
+// (mesh, many connections). Timers must be zero-initialized before first use
+// #define ENABLE_RUN_LOOP_TIMER_WHEEL
+
 // Enable Classic/LE based on esp-idf sdkconfig
 #include "sdkconfig.h"
 #ifdef CONFIG_IDF_TARGET_ESP32
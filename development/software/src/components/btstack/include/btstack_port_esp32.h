@@ -53,6 +53,21 @@ extern "C" {
 
 uint8_t btstack_init(void);
 
+typedef struct {
+    uint32_t packets;           // packets delivered by the controller
+    uint32_t dropped;           // no free slot
+    uint32_t oversized;         // larger than any slot
+    uint32_t high_watermark;    // most packets waiting for the run loop at once
+} btstack_port_esp32_rx_stats_t;
+
+/**
+ * Get the counters of the HCI receive path, the controller task updates them
+ * without locking so they are only a snapshot
+ *
+ * @param stats
+ */
+void btstack_port_esp32_get_rx_stats(btstack_port_esp32_rx_stats_t * stats);
+
 #if defined __cplusplus
 }
 #endif
@@ -46,8 +46,12 @@
 #define BTSTACK_FILE__ "btstack_run_loop_freertos.c"
 
 #include <stddef.h> // NULL
+#include <stdint.h> // uintptr_t
 
 #include "btstack_run_loop_freertos.h"
+#ifdef ENABLE_RUN_LOOP_TIMER_WHEEL
+#include "btstack_run_loop_timer_wheel.h"
+#endif
 
 #include "btstack_linked_list.h"
 #include "btstack_debug.h"
@@ -62,13 +66,11 @@
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "freertos/event_groups.h"
-#include "freertos/semphr.h"
 #else
 #include "FreeRTOS.h"
 #include "task.h"
 #include "queue.h"
 #include "event_groups.h"
-#include "semphr.h"
 #endif
 
 typedef struct function_call {
@@ -85,6 +87,21 @@ typedef struct function_call {
 #error "Either configSUPPORT_STATIC_ALLOCATION or configSUPPORT_DYNAMIC_ALLOCATION in FreeRTOSConfig.h must be 1"
 #endif
 
+// timer backend: sorted list or timer wheel
+#ifdef ENABLE_RUN_LOOP_TIMER_WHEEL
+#define btstack_run_loop_freertos_add_timer                 btstack_run_loop_timer_wheel_add_timer
+#define btstack_run_loop_freertos_remove_timer              btstack_run_loop_timer_wheel_remove_timer
+#define btstack_run_loop_freertos_process_timers            btstack_run_loop_timer_wheel_process_timers
+#define btstack_run_loop_freertos_dump_timer                btstack_run_loop_timer_wheel_dump_timer
+#define btstack_run_loop_freertos_get_time_until_timeout    btstack_run_loop_timer_wheel_get_time_until_timeout
+#else
+#define btstack_run_loop_freertos_add_timer                 btstack_run_loop_base_add_timer
+#define btstack_run_loop_freertos_remove_timer              btstack_run_loop_base_remove_timer
+#define btstack_run_loop_freertos_process_timers            btstack_run_loop_base_process_timers
+#define btstack_run_loop_freertos_dump_timer                btstack_run_loop_base_dump_timer
+#define btstack_run_loop_freertos_get_time_until_timeout    btstack_run_loop_base_get_time_until_timeout
+#endif
+
 // queue to receive events: up to 2 calls from transport, rest for app
 #define RUN_LOOP_QUEUE_LENGTH 20
 #define RUN_LOOP_QUEUE_ITEM_SIZE sizeof(function_call_t)
@@ -92,12 +109,27 @@ typedef struct function_call {
 #ifdef USE_STATIC_ALLOC
 static StaticQueue_t btstack_run_loop_queue_object;
 static uint8_t btstack_run_loop_queue_storage[ RUN_LOOP_QUEUE_LENGTH * RUN_LOOP_QUEUE_ITEM_SIZE ];
-static StaticSemaphore_t btstack_run_loop_callback_mutex_object;
 #endif
 
 static QueueHandle_t        btstack_run_loop_queue;
 static TaskHandle_t         btstack_run_loop_task;
-static SemaphoreHandle_t    btstack_run_loop_callbacks_mutex;
+
+// callbacks to execute on the run loop, pushed by any task and taken all at once
+// by the run loop, without locks. The next pointers of pending registrations are
+// tagged with bit 0, the last one holds the tag alone. Items are aligned, so a
+// next pointer left over by another list never looks pending. Posting a pending
+// registration again has no effect
+static btstack_linked_item_t *  btstack_run_loop_callbacks;
+
+#define CALLBACK_PENDING ((uintptr_t) 1u)
+
+static btstack_linked_item_t * btstack_run_loop_freertos_callback_tag(btstack_linked_item_t * item){
+    return (btstack_linked_item_t *) ((uintptr_t) item | CALLBACK_PENDING);
+}
+
+static btstack_linked_item_t * btstack_run_loop_freertos_callback_untag(btstack_linked_item_t * item){
+    return (btstack_linked_item_t *) ((uintptr_t) item & ~CALLBACK_PENDING);
+}
 
 #ifndef HAVE_FREERTOS_TASK_NOTIFICATIONS
 static EventGroupHandle_t   btstack_run_loop_event_group;
@@ -148,6 +180,31 @@ static void btstack_run_loop_freertos_trigger_exit_internal(void){
     run_loop_exit_requested = true;
 }
 
+// take all pending callbacks and execute them in the order they were posted
+static void btstack_run_loop_freertos_execute_callbacks(void){
+    btstack_linked_item_t * batch = __atomic_exchange_n(&btstack_run_loop_callbacks, NULL, __ATOMIC_ACQUIRE);
+    if (batch == NULL) return;
+
+    // the list is newest first, reverse it. The next pointers stay tagged so the
+    // registrations are still pending for other tasks
+    btstack_linked_item_t * fifo = NULL;
+    while (batch != NULL){
+        btstack_linked_item_t * next = btstack_run_loop_freertos_callback_untag(batch->next);
+        batch->next = btstack_run_loop_freertos_callback_tag(fifo);
+        fifo = batch;
+        batch = next;
+    }
+
+    while (fifo != NULL){
+        btstack_linked_item_t * item = fifo;
+        fifo = btstack_run_loop_freertos_callback_untag(item->next);
+        // no longer pending, it can be posted again from within its callback
+        __atomic_store_n(&item->next, NULL, __ATOMIC_RELEASE);
+        btstack_context_callback_registration_t * callback_registration = (btstack_context_callback_registration_t *) item;
+        (*callback_registration->callback)(callback_registration->context);
+    }
+}
+
 /**
  * Execute run_loop
  */
@@ -161,16 +218,8 @@ static void btstack_run_loop_freertos_execute(void) {
         // process data sources
         btstack_run_loop_base_poll_data_sources();
 
-        // execute callbacks - protect list with mutex
-        while (1){
-            xSemaphoreTake(btstack_run_loop_callbacks_mutex, portMAX_DELAY);
-            btstack_context_callback_registration_t * callback_registration = (btstack_context_callback_registration_t *) btstack_linked_list_pop(&btstack_run_loop_base_callbacks);
-            xSemaphoreGive(btstack_run_loop_callbacks_mutex);
-            if (callback_registration == NULL){
-                break;
-            }
-            (*callback_registration->callback)(callback_registration->context);
-        }
+        // execute callbacks
+        btstack_run_loop_freertos_execute_callbacks();
 
         // process registered function calls on run loop thread (deprecated)
         while (true){
@@ -184,13 +233,13 @@ static void btstack_run_loop_freertos_execute(void) {
 
         // process timers
         uint32_t now = btstack_run_loop_freertos_get_time_ms();
-        btstack_run_loop_base_process_timers(now);
+        btstack_run_loop_freertos_process_timers(now);
 
         // exit triggered by btstack_run_loop_trigger_exit (main thread or other thread)
         if (run_loop_exit_requested) break;
 
         // wait for timeout or event group/task notification
-        int32_t timeout_next_timer_ms = btstack_run_loop_base_get_time_until_timeout(now);
+        int32_t timeout_next_timer_ms = btstack_run_loop_freertos_get_time_until_timeout(now);
 
         uint32_t timeout_ms = portMAX_DELAY;
         if (timeout_next_timer_ms >= 0){
@@ -207,22 +256,36 @@ static void btstack_run_loop_freertos_execute(void) {
 }
 
 static void btstack_run_loop_freertos_execute_on_main_thread(btstack_context_callback_registration_t * callback_registration){
-    // protect list with mutex
-    xSemaphoreTake(btstack_run_loop_callbacks_mutex, portMAX_DELAY);
-    btstack_run_loop_base_add_callback(callback_registration);
-    xSemaphoreGive(btstack_run_loop_callbacks_mutex);
+    btstack_linked_item_t * item = (btstack_linked_item_t *) callback_registration;
+
+    // claim the registration, it may be pending already
+    btstack_linked_item_t * next = __atomic_load_n(&item->next, __ATOMIC_RELAXED);
+    do {
+        if (((uintptr_t) next & CALLBACK_PENDING) != 0u){
+            btstack_run_loop_freertos_trigger_from_thread();
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&item->next, &next, btstack_run_loop_freertos_callback_tag(NULL), true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    btstack_linked_item_t * head = __atomic_load_n(&btstack_run_loop_callbacks, __ATOMIC_RELAXED);
+    do {
+        item->next = btstack_run_loop_freertos_callback_tag(head);
+    } while (!__atomic_compare_exchange_n(&btstack_run_loop_callbacks, &head, item, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
     btstack_run_loop_freertos_trigger_from_thread();
 }
 
 static void btstack_run_loop_freertos_init(void){
     btstack_run_loop_base_init();
+    btstack_run_loop_callbacks = NULL;
+#ifdef ENABLE_RUN_LOOP_TIMER_WHEEL
+    btstack_run_loop_timer_wheel_init(btstack_run_loop_freertos_get_time_ms());
+#endif
 
 #ifdef USE_STATIC_ALLOC
     btstack_run_loop_queue = xQueueCreateStatic(RUN_LOOP_QUEUE_LENGTH, RUN_LOOP_QUEUE_ITEM_SIZE, btstack_run_loop_queue_storage, &btstack_run_loop_queue_object);
-    btstack_run_loop_callbacks_mutex = xSemaphoreCreateMutexStatic(&btstack_run_loop_callback_mutex_object);
 #else
     btstack_run_loop_queue = xQueueCreate(RUN_LOOP_QUEUE_LENGTH, RUN_LOOP_QUEUE_ITEM_SIZE);
-    btstack_run_loop_callbacks_mutex = xSemaphoreCreateMutex();
 #endif
 
 #ifndef HAVE_FREERTOS_TASK_NOTIFICATIONS
@@ -247,10 +310,10 @@ static const btstack_run_loop_t btstack_run_loop_freertos = {
     &btstack_run_loop_base_enable_data_source_callbacks,
     &btstack_run_loop_base_disable_data_source_callbacks,
     &btstack_run_loop_freertos_set_timer,
-    &btstack_run_loop_base_add_timer,
-    &btstack_run_loop_base_remove_timer,
+    &btstack_run_loop_freertos_add_timer,
+    &btstack_run_loop_freertos_remove_timer,
     &btstack_run_loop_freertos_execute,
-    &btstack_run_loop_base_dump_timer,
+    &btstack_run_loop_freertos_dump_timer,
     &btstack_run_loop_freertos_get_time_ms,
 #if defined(HAVE_FREERTOS_TASK_NOTIFICATIONS) || (INCLUDE_xEventGroupSetBitFromISR == 1)
     &btstack_run_loop_freertos_poll_data_sources_from_irq,
@@ -99,6 +99,10 @@ typedef struct btstack_data_source {
 
 typedef struct btstack_timer_source {
     btstack_linked_item_t item;
+#ifdef ENABLE_RUN_LOOP_TIMER_WHEEL
+    // previous item in the timer wheel slot, NULL if not registered
+    btstack_linked_item_t * prev;
+#endif
     // timeout in system ticks (HAVE_EMBEDDED_TICK) or milliseconds (HAVE_EMBEDDED_TIME_MS)
     btstack_time_t timeout;
     // will be called when timer fired
@@ -223,6 +227,8 @@ void btstack_run_loop_init(const btstack_run_loop_t * run_loop);
 
 /**
  * @brief Set timer based on current time in milliseconds.
+ * @note With ENABLE_RUN_LOOP_TIMER_WHEEL, the timer must be zero-initialized (e.g. static or
+ *       memset) before it is first used, its prev field tells if it is registered.
  */
 void btstack_run_loop_set_timer(btstack_timer_source_t * timer, uint32_t timeout_in_ms);
 
@@ -343,6 +349,8 @@ void btstack_run_loop_execute(void);
  *       The external thread puts an item into a queue and call this function to trigger
  *       processing by the BTstack main thread. If this happens multiple times, it is
  *       guaranteed that the callback will run at least once after the last item was added.
+ * @note The registration must not be in any other list while it is registered here, its
+ *       item is used to queue it.
  * @param callback_registration
  */
 void btstack_run_loop_execute_on_main_thread(btstack_context_callback_registration_t * callback_registration);
@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2023 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BLUEKITCHEN
+ * GMBH OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+#define BTSTACK_FILE__ "btstack_run_loop_timer_wheel.c"
+
+/*
+ *  btstack_run_loop_timer_wheel.c
+ *
+ *  Hierarchical timer wheel with 6 levels of 64 slots each. Level 0 holds the timers of the
+ *  current block of 64 ticks, one slot per tick. Level n holds the timers that differ from
+ *  the current time in bits 6n..6n+5 but not above, one slot per value of these bits. When
+ *  the time enters the range of a slot, its timers are moved down to the lower levels
+ *  (cascade). Slots are circular lists in insertion order.
+ */
+
+#include "btstack_config.h"
+
+#ifdef ENABLE_RUN_LOOP_TIMER_WHEEL
+
+#include "btstack_run_loop_timer_wheel.h"
+
+#include "btstack_debug.h"
+#include "btstack_util.h"
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#define WHEEL_LEVEL_BITS  6
+#define WHEEL_LEVEL_SLOTS (1u << WHEEL_LEVEL_BITS)
+#define WHEEL_LEVEL_MASK  (WHEEL_LEVEL_SLOTS - 1u)
+#define WHEEL_LEVELS      6     // 6 * 6 bits cover the 32 bit time
+#define WHEEL_SLOTS       (WHEEL_LEVELS * WHEEL_LEVEL_SLOTS)
+
+// slot heads and timers share the list links
+typedef struct {
+    btstack_linked_item_t   item;
+    btstack_linked_item_t * prev;
+} btstack_timer_wheel_node_t;
+
+static btstack_timer_wheel_node_t btstack_timer_wheel_slots[WHEEL_SLOTS];
+
+// bit set if the slot may hold timers, cleared when found empty
+static uint64_t btstack_timer_wheel_used[WHEEL_LEVELS];
+
+// current tick, the ticks before have been processed. Timers due now are processed
+// again when they are added after processing
+static uint32_t btstack_timer_wheel_time;
+static uint32_t btstack_timer_wheel_num_timers;
+
+static btstack_timer_wheel_node_t * btstack_timer_wheel_node(btstack_timer_source_t * timer){
+    return (btstack_timer_wheel_node_t *) &timer->item;
+}
+
+static void btstack_timer_wheel_link(uint16_t slot, btstack_timer_source_t * timer){
+    btstack_timer_wheel_node_t * head = &btstack_timer_wheel_slots[slot];
+    btstack_timer_wheel_node_t * node = btstack_timer_wheel_node(timer);
+    btstack_timer_wheel_node_t * last = (btstack_timer_wheel_node_t *) head->prev;
+    node->item.next = &head->item;
+    node->prev      = &last->item;
+    last->item.next = &node->item;
+    head->prev      = &node->item;
+    btstack_timer_wheel_used[slot / WHEEL_LEVEL_SLOTS] |= ((uint64_t) 1u) << (slot % WHEEL_LEVEL_SLOTS);
+}
+
+static void btstack_timer_wheel_unlink(btstack_timer_source_t * timer){
+    btstack_timer_wheel_node_t * node = btstack_timer_wheel_node(timer);
+    ((btstack_timer_wheel_node_t *) node->item.next)->prev = node->prev;
+    node->prev->next = node->item.next;
+    node->item.next  = NULL;
+    node->prev       = NULL;
+}
+
+static bool btstack_timer_wheel_slot_empty(uint16_t slot){
+    btstack_timer_wheel_node_t * head = &btstack_timer_wheel_slots[slot];
+    return head->item.next == &head->item;
+}
+
+static uint32_t btstack_timer_wheel_index(uint32_t time, uint8_t level){
+    return (time >> (level * WHEEL_LEVEL_BITS)) & WHEEL_LEVEL_MASK;
+}
+
+// timers that are due go into the slot of the current tick
+static uint16_t btstack_timer_wheel_slot(uint32_t timeout){
+    uint32_t now = btstack_timer_wheel_time;
+    if (btstack_time_delta(timeout, now) <= 0){
+        return (uint16_t) btstack_timer_wheel_index(now, 0);
+    }
+    uint32_t diff = timeout ^ now;
+    uint8_t level;
+    for (level = 0; level < (WHEEL_LEVELS - 1u); level++){
+        if ((diff >> ((level + 1u) * WHEEL_LEVEL_BITS)) == 0u) break;
+    }
+    return (uint16_t) (level * WHEEL_LEVEL_SLOTS + btstack_timer_wheel_index(timeout, level));
+}
+
+// first used slot of the level at index from or above, -1 if none
+static int btstack_timer_wheel_first(uint8_t level, uint32_t from){
+    while (from < WHEEL_LEVEL_SLOTS){
+        uint64_t used = btstack_timer_wheel_used[level] & (~((uint64_t) 0u) << from);
+        if (used == 0u) return -1;
+        uint32_t index = (uint32_t) __builtin_ctzll(used);
+        uint16_t slot  = (uint16_t) (level * WHEEL_LEVEL_SLOTS + index);
+        if (!btstack_timer_wheel_slot_empty(slot)) return (int) index;
+        btstack_timer_wheel_used[level] &= ~(((uint64_t) 1u) << index);
+        from = index + 1u;
+    }
+    return -1;
+}
+
+// ticks from now to the next timeout or cascade, the latter is never later than the
+// timeouts it moves down
+static uint32_t btstack_timer_wheel_next_event(void){
+    uint32_t now  = btstack_timer_wheel_time;
+    uint32_t next = UINT32_MAX;
+    uint8_t level;
+    for (level = 0; level < WHEEL_LEVELS; level++){
+        uint32_t shift = level * WHEEL_LEVEL_BITS;
+        uint32_t cur   = btstack_timer_wheel_index(now, level);
+        uint32_t from  = (level == 0u) ? cur : (cur + 1u);
+        int index = btstack_timer_wheel_first(level, from);
+        // the top level wraps around with the time
+        if ((index < 0) && (level == (WHEEL_LEVELS - 1u))){
+            index = btstack_timer_wheel_first(level, 0);
+        }
+        if (index < 0) continue;
+
+        uint32_t start;
+        if (level == (WHEEL_LEVELS - 1u)){
+            start = ((uint32_t) index) << shift;
+        } else {
+            uint32_t block_mask = ~((1u << (shift + WHEEL_LEVEL_BITS)) - 1u);
+            start = (now & block_mask) | (((uint32_t) index) << shift);
+        }
+        uint32_t delta = (level == 0u) ? ((uint32_t) index - cur) : (start - now);
+        next = btstack_min(next, delta);
+    }
+    return next;
+}
+
+// move the timers of the slots whose range starts at the current time down the wheel,
+// starting with the highest level as its timers may end up in the lower slots
+static void btstack_timer_wheel_cascade(void){
+    uint32_t now = btstack_timer_wheel_time;
+    int level;
+    for (level = WHEEL_LEVELS - 1; level > 0; level--){
+        uint32_t low_mask = (1u << (level * WHEEL_LEVEL_BITS)) - 1u;
+        if ((now & low_mask) != 0u) continue;
+        uint16_t slot = (uint16_t) (level * WHEEL_LEVEL_SLOTS + btstack_timer_wheel_index(now, (uint8_t) level));
+        btstack_timer_wheel_node_t * head = &btstack_timer_wheel_slots[slot];
+        while (head->item.next != &head->item){
+            btstack_timer_source_t * timer = (btstack_timer_source_t *) head->item.next;
+            btstack_timer_wheel_unlink(timer);
+            btstack_timer_wheel_link(btstack_timer_wheel_slot((uint32_t) timer->timeout), timer);
+        }
+    }
+}
+
+static void btstack_timer_wheel_move_to(uint32_t time){
+    if (time == btstack_timer_wheel_time) return;
+    btstack_timer_wheel_time = time;
+    btstack_timer_wheel_cascade();
+}
+
+void btstack_run_loop_timer_wheel_init(uint32_t now){
+    uint16_t slot;
+    for (slot = 0; slot < WHEEL_SLOTS; slot++){
+        btstack_timer_wheel_slots[slot].item.next = &btstack_timer_wheel_slots[slot].item;
+        btstack_timer_wheel_slots[slot].prev      = &btstack_timer_wheel_slots[slot].item;
+    }
+    uint8_t level;
+    for (level = 0; level < WHEEL_LEVELS; level++){
+        btstack_timer_wheel_used[level] = 0;
+    }
+    btstack_timer_wheel_time = now;
+    btstack_timer_wheel_num_timers = 0;
+}
+
+void btstack_run_loop_timer_wheel_add_timer(btstack_timer_source_t * timer){
+    if (btstack_timer_wheel_node(timer)->prev != NULL){
+        log_error("Timer %p already registered! Please see btstack_run_loop_base_add_timer.", timer);
+        btstack_assert(false);
+        return;
+    }
+    btstack_timer_wheel_link(btstack_timer_wheel_slot((uint32_t) timer->timeout), timer);
+    btstack_timer_wheel_num_timers++;
+}
+
+bool btstack_run_loop_timer_wheel_remove_timer(btstack_timer_source_t * timer){
+    if (btstack_timer_wheel_node(timer)->prev == NULL) return false;
+    btstack_timer_wheel_unlink(timer);
+    btstack_timer_wheel_num_timers--;
+    return true;
+}
+
+void btstack_run_loop_timer_wheel_process_timers(uint32_t now){
+    while (btstack_time_delta(now, btstack_timer_wheel_time) >= 0){
+        if (btstack_timer_wheel_num_timers == 0u){
+            btstack_timer_wheel_time = now;
+            return;
+        }
+
+        // skip the ticks without timeouts or cascades
+        uint32_t next = btstack_timer_wheel_time + btstack_timer_wheel_next_event();
+        if (btstack_time_delta(next, now) > 0){
+            btstack_timer_wheel_move_to(now);
+            return;
+        }
+        btstack_timer_wheel_move_to(next);
+
+        // expire the slot of the current tick, timers added again for the current tick
+        // are processed in this loop as well
+        uint16_t slot = (uint16_t) btstack_timer_wheel_index(btstack_timer_wheel_time, 0);
+        btstack_timer_wheel_node_t * head = &btstack_timer_wheel_slots[slot];
+        while (head->item.next != &head->item){
+            btstack_timer_source_t * timer = (btstack_timer_source_t *) head->item.next;
+            btstack_timer_wheel_unlink(timer);
+            btstack_timer_wheel_num_timers--;
+            timer->process(timer);
+        }
+
+        if (btstack_timer_wheel_time == now) return;
+        btstack_timer_wheel_move_to(btstack_timer_wheel_time + 1u);
+    }
+}
+
+void btstack_run_loop_timer_wheel_dump_timer(void){
+#ifdef ENABLE_LOG_INFO
+    uint16_t slot;
+    uint16_t i = 0;
+    for (slot = 0; slot < WHEEL_SLOTS; slot++){
+        btstack_timer_wheel_node_t * head = &btstack_timer_wheel_slots[slot];
+        btstack_linked_item_t * it;
+        for (it = head->item.next; it != &head->item; it = it->next){
+            btstack_timer_source_t * timer = (btstack_timer_source_t*) it;
+            log_info("timer %u (%p): slot %u, timeout %" PRIbtstack_time_t "\n", i, (void *) timer, slot, timer->timeout);
+            i++;
+        }
+    }
+#endif
+}
+
+int32_t btstack_run_loop_timer_wheel_get_time_until_timeout(uint32_t now){
+    if (btstack_timer_wheel_num_timers == 0u) return -1;
+    uint32_t next = btstack_timer_wheel_time + btstack_timer_wheel_next_event();
+    int32_t delta = btstack_time_delta(next, now);
+    if (delta < 0){
+        delta = 0;
+    }
+    return delta;
+}
+
+#endif /* ENABLE_RUN_LOOP_TIMER_WHEEL */
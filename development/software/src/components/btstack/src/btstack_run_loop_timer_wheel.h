@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2023 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BLUEKITCHEN
+ * GMBH OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/**
+ * @title Run Loop Timer Wheel
+ *
+ * Hierarchical timer wheel as alternative to the sorted timer list of the run loop base,
+ * enabled with ENABLE_RUN_LOOP_TIMER_WHEEL. Adding and removing a timer takes constant time,
+ * all timers of a tick expire as one batch.
+ *
+ * The wheel uses the prev field of the timer, timers must be zero-initialized or removed
+ * before they are added the first time, as is the case for static timers and timers in
+ * structs from btstack_memory.
+ */
+
+#ifndef BTSTACK_RUN_LOOP_TIMER_WHEEL_H
+#define BTSTACK_RUN_LOOP_TIMER_WHEEL_H
+
+#include "btstack_run_loop.h"
+
+#include <stdint.h>
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+/* API_START */
+
+/**
+ * @brief Init timer wheel
+ * @param now current time
+ */
+void btstack_run_loop_timer_wheel_init(uint32_t now);
+
+/**
+ * @brief Add timer source.
+ * @param timer to add
+ */
+void btstack_run_loop_timer_wheel_add_timer(btstack_timer_source_t * timer);
+
+/**
+ * @brief Remove timer source.
+ * @param timer to remove
+ * @return true if timer was removed
+ */
+bool btstack_run_loop_timer_wheel_remove_timer(btstack_timer_source_t * timer);
+
+/**
+ * @brief Process timers: remove expired timers from wheel and call their process function
+ * @param now
+ */
+void btstack_run_loop_timer_wheel_process_timers(uint32_t now);
+
+/**
+ * @brief Dump timers via log_info
+ */
+void btstack_run_loop_timer_wheel_dump_timer(void);
+
+/**
+ * @brief Get time until first timer fires. The wheel may return an earlier time
+ *        to move long timers closer to their timeout
+ * @return -1 if no timers, time until next timeout otherwise
+ */
+int32_t btstack_run_loop_timer_wheel_get_time_until_timeout(uint32_t now);
+
+/* API_END */
+
+#if defined __cplusplus
+}
+#endif
+
+#endif // BTSTACK_RUN_LOOP_TIMER_WHEEL_H
@@ -0,0 +1,288 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+#include <string.h>
+#include <uni.h>
+
+#include "c64b_delta.h"
+
+//----------------------------------------------------------------------------//
+
+static uint32_t delta_u32(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool delta_fail(t_c64b_delta* d, const char* why)
+{
+	loge("delta: %s at %u\n", why, (unsigned int)d->dst_pos);
+	d->state = DELTA_ERROR;
+	return false;
+}
+
+// operation code plus its arguments
+static size_t delta_op_len(uint8_t code)
+{
+	switch(code)
+	{
+		case 'C': return 9;
+		case 'D': return 5;
+		case 'X': return 9;
+		case 'E': return 1;
+		default:  return 0;
+	}
+}
+
+//----------------------------------------------------------------------------//
+// writes the next len bytes of the source, each one increased by the matching
+// byte of add when given
+
+static bool delta_src(t_c64b_delta* d, const uint8_t* add, size_t len)
+{
+	while(len > 0)
+	{
+		size_t n = (len < DELTA_SRC_LEN) ? len : DELTA_SRC_LEN;
+
+		if(!d->read(d->ctx, d->off, d->src, n))
+			return delta_fail(d, "source not readable");
+
+		if(add != NULL)
+		{
+			for(size_t i = 0; i < n; ++i)
+				d->src[i] += add[i];
+			add += n;
+		}
+
+		if(!d->write(d->ctx, d->src, n))
+			return delta_fail(d, "target not writable");
+
+		d->off     += n;
+		d->len     -= n;
+		d->dst_pos += n;
+		len        -= n;
+	}
+
+	return true;
+}
+
+//----------------------------------------------------------------------------//
+// the operation collected in hdr is checked against both images before it
+// starts, a delta for another source fails here or in the image verification
+
+static bool delta_op(t_c64b_delta* d)
+{
+	uint8_t code = d->hdr[0];
+
+	if(code == 'E')
+	{
+		if(d->dst_pos != d->dst_len)
+			return delta_fail(d, "target too short");
+
+		d->state = DELTA_END;
+		return true;
+	}
+
+	if(code == 'D')
+	{
+		d->off = 0;
+		d->len = delta_u32(&d->hdr[1]);
+	}
+	else
+	{
+		d->off = delta_u32(&d->hdr[1]);
+		d->len = delta_u32(&d->hdr[5]);
+
+		if((d->off > d->src_len) || (d->len > d->src_len - d->off))
+			return delta_fail(d, "operation outside of the source");
+	}
+
+	if(d->len > d->dst_len - d->dst_pos)
+		return delta_fail(d, "target too long");
+
+	switch(code)
+	{
+		case 'C': d->state = DELTA_COPY; break;
+		case 'D': d->state = DELTA_DATA; break;
+		case 'X': d->state = DELTA_DIFF; break;
+	}
+
+	// copies need no further input
+	if(d->state == DELTA_COPY)
+	{
+		if(!delta_src(d, NULL, d->len))
+			return false;
+	}
+
+	if(d->len == 0)
+		d->state = DELTA_OP;
+
+	return true;
+}
+
+//----------------------------------------------------------------------------//
+// functions
+
+void c64b_delta_init(t_c64b_delta* d, t_c64b_delta_read read, t_c64b_delta_write write, void* ctx)
+{
+	d->read    = read;
+	d->write   = write;
+	d->ctx     = ctx;
+	d->state   = DELTA_HDR;
+	d->hdr_len = 0;
+	d->src_len = 0;
+	d->dst_len = 0;
+	d->dst_pos = 0;
+	d->off     = 0;
+	d->len     = 0;
+}
+
+//----------------------------------------------------------------------------//
+
+bool c64b_delta_feed(t_c64b_delta* d, const uint8_t* buf, size_t len)
+{
+	while(len > 0)
+	{
+		size_t n;
+
+		switch(d->state)
+		{
+			case DELTA_HDR:
+				n = DELTA_HDR_LEN - d->hdr_len;
+				n = (len < n) ? len : n;
+				memcpy(&d->hdr[d->hdr_len], buf, n);
+				d->hdr_len += n;
+				buf        += n;
+				len        -= n;
+
+				if(memcmp(d->hdr, DELTA_MAGIC, (d->hdr_len < DELTA_MAGIC_LEN) ? d->hdr_len : DELTA_MAGIC_LEN) != 0)
+				{
+					// not a delta, what was held back goes first
+					d->state = DELTA_RAW;
+					if(!d->write(d->ctx, d->hdr, d->hdr_len))
+						return delta_fail(d, "target not writable");
+					d->dst_pos = d->hdr_len;
+				}
+				else if(d->hdr_len == DELTA_HDR_LEN)
+				{
+					d->src_len = delta_u32(&d->hdr[DELTA_MAGIC_LEN]);
+					d->dst_len = delta_u32(&d->hdr[DELTA_MAGIC_LEN + 4]);
+					d->hdr_len = 0;
+					d->state   = DELTA_OP;
+					logi("delta: %u bytes from %u bytes\n", (unsigned int)d->dst_len, (unsigned int)d->src_len);
+				}
+				break;
+
+			case DELTA_RAW:
+				if(!d->write(d->ctx, buf, len))
+					return delta_fail(d, "target not writable");
+				d->dst_pos += len;
+				len         = 0;
+				break;
+
+			case DELTA_OP:
+			{
+				uint8_t code = (d->hdr_len == 0) ? buf[0] : d->hdr[0];
+				size_t  need = delta_op_len(code);
+
+				if(need == 0)
+					return delta_fail(d, "unknown operation");
+
+				n = need - d->hdr_len;
+				n = (len < n) ? len : n;
+				memcpy(&d->hdr[d->hdr_len], buf, n);
+				d->hdr_len += n;
+				buf        += n;
+				len        -= n;
+
+				if(d->hdr_len == need)
+				{
+					d->hdr_len = 0;
+					if(!delta_op(d))
+						return false;
+				}
+				break;
+			}
+
+			case DELTA_DATA:
+				n = (len < d->len) ? len : d->len;
+				if(!d->write(d->ctx, buf, n))
+					return delta_fail(d, "target not writable");
+				d->dst_pos += n;
+				d->len     -= n;
+				buf        += n;
+				len        -= n;
+				if(d->len == 0)
+					d->state = DELTA_OP;
+				break;
+
+			case DELTA_DIFF:
+				n = (len < d->len) ? len : d->len;
+				if(!delta_src(d, buf, n))
+					return false;
+				buf += n;
+				len -= n;
+				if(d->len == 0)
+					d->state = DELTA_OP;
+				break;
+
+			case DELTA_END:
+				return delta_fail(d, "data after the end");
+
+			default:
+				return false;
+		}
+	}
+
+	return true;
+}
+
+//----------------------------------------------------------------------------//
+// a stream shorter than the magic is not a delta either
+
+bool c64b_delta_finish(t_c64b_delta* d)
+{
+	if((d->state == DELTA_HDR) && (d->hdr_len < DELTA_MAGIC_LEN))
+	{
+		d->state = DELTA_RAW;
+		if(!d->write(d->ctx, d->hdr, d->hdr_len))
+			return delta_fail(d, "target not writable");
+		d->dst_pos = d->hdr_len;
+	}
+
+	if((d->state == DELTA_RAW) || (d->state == DELTA_END))
+		return true;
+
+	if(d->state != DELTA_ERROR)
+		delta_fail(d, "delta truncated");
+
+	return false;
+}
+
+//----------------------------------------------------------------------------//
+
+bool c64b_delta_is_raw(const t_c64b_delta* d)
+{
+	return d->state == DELTA_RAW;
+}
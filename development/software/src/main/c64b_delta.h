@@ -0,0 +1,91 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+#ifndef C64B_DELTA_H
+#define C64B_DELTA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+//----------------------------------------------------------------------------//
+// Firmware deltas rebuild a new image from the one that is running, so that
+// only the changed parts have to travel on the sd-card. A delta is a header
+// followed by a list of operations, all values little endian:
+//
+//   header: "C64BDLT1", u32 source length, u32 target length
+//   'C' u32 off, u32 len           copy len bytes of the source from off
+//   'D' u32 len, len bytes         write the bytes as they are
+//   'X' u32 off, u32 len, len bytes write source[off + i] + byte[i]
+//   'E'                            end, the target length must be reached
+//
+// The decoder is fed the delta in pieces of any size and uses a fixed amount
+// of memory. A stream that does not start with the magic is not a delta and is
+// passed through unchanged
+
+#define DELTA_MAGIC     "C64BDLT1"
+#define DELTA_MAGIC_LEN 8
+#define DELTA_HDR_LEN   (DELTA_MAGIC_LEN + 8)
+#define DELTA_SRC_LEN   512 // source bytes read at a time
+
+typedef bool (*t_c64b_delta_read) (void* ctx, uint32_t off, void* buf, size_t len);
+typedef bool (*t_c64b_delta_write)(void* ctx, const void* buf, size_t len);
+
+typedef enum
+{
+	DELTA_HDR = 0, // collecting the header, or the magic
+	DELTA_RAW,     // not a delta, everything is written as it is
+	DELTA_OP,      // collecting an operation
+	DELTA_COPY,
+	DELTA_DATA,
+	DELTA_DIFF,
+	DELTA_END,
+	DELTA_ERROR
+} t_c64b_delta_state;
+
+typedef struct
+{
+	t_c64b_delta_read  read;
+	t_c64b_delta_write write;
+	void*              ctx;
+	t_c64b_delta_state state;
+	uint8_t            hdr[DELTA_HDR_LEN]; // header or operation being collected
+	size_t             hdr_len;
+	uint32_t           src_len;
+	uint32_t           dst_len;
+	uint32_t           dst_pos;            // bytes written so far
+	uint32_t           off;                // source offset of the current operation
+	uint32_t           len;                // bytes left in the current operation
+	uint8_t            src[DELTA_SRC_LEN];
+} t_c64b_delta;
+
+//----------------------------------------------------------------------------//
+
+void c64b_delta_init  (t_c64b_delta* d, t_c64b_delta_read read, t_c64b_delta_write write, void* ctx);
+bool c64b_delta_feed  (t_c64b_delta* d, const uint8_t* buf, size_t len);
+bool c64b_delta_finish(t_c64b_delta* d);
+bool c64b_delta_is_raw(const t_c64b_delta* d);
+
+#endif
@@ -0,0 +1,135 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+#include <string.h>
+
+#include "c64b_input.h"
+
+//----------------------------------------------------------------------------//
+// the indices run freely and are masked on access, the producer publishes an
+// entry by storing tail with release semantics after having written it
+
+bool c64b_input_push(t_c64b_input_ring* r, const t_c64b_input* in, size_t len)
+{
+	// a report that does not change the state is not worth a slot, unless
+	// the previous one was dropped
+	if(!r->resync && (memcmp(&(r->last.kb), &(in->kb), len) == 0))
+		return true;
+
+	uint32_t tail = r->tail;
+	uint32_t head = __atomic_load_n(&(r->head), __ATOMIC_ACQUIRE);
+
+	if((tail - head) >= INPUT_RING_LEN)
+	{
+		r->drops  += 1;
+		r->resync  = true;
+		return false;
+	}
+
+	r->buf[tail & (INPUT_RING_LEN - 1)] = *in;
+	__atomic_store_n(&(r->tail), tail + 1, __ATOMIC_RELEASE);
+
+	r->last   = *in;
+	r->resync = false;
+	return true;
+}
+
+//----------------------------------------------------------------------------//
+// a full ring drops the gamepad report, but the buttons, dpad directions and
+// triggers it holds are collected with the ones of the reports dropped after
+// it. Once there is room they are pushed on top of the latest state, timed
+// from the first dropped report, and the latest state follows: a press that
+// started and ended while the ring was full is still seen. The stick sector
+// is not a bit mask, only its latest value is kept
+
+bool c64b_input_push_gp(t_c64b_input_ring* r, const t_c64b_input* in)
+{
+	if(r->resync)
+	{
+		t_c64b_input m = *in;
+
+		m.t_us             = r->held.t_us;
+		m.gp.buttons      |= r->held.gp.buttons;
+		m.gp.dpad         |= r->held.gp.dpad;
+		m.gp.misc_buttons |= r->held.gp.misc_buttons;
+		m.gp.triggers     |= r->held.gp.triggers;
+
+		if(c64b_input_push(r, &m, sizeof(t_c64b_gp_state)))
+		{
+			memset(&(r->held), 0, sizeof(r->held));
+			return c64b_input_push_gp(r, in);
+		}
+
+		r->held.gp.buttons      |= in->gp.buttons;
+		r->held.gp.dpad         |= in->gp.dpad;
+		r->held.gp.misc_buttons |= in->gp.misc_buttons;
+		r->held.gp.triggers     |= in->gp.triggers;
+		return false;
+	}
+
+	if(c64b_input_push(r, in, sizeof(t_c64b_gp_state)))
+		return true;
+
+	r->held = *in;
+	return false;
+}
+
+//----------------------------------------------------------------------------//
+
+bool c64b_input_peek(t_c64b_input_ring* r, t_c64b_input* in)
+{
+	uint32_t head = r->head;
+	uint32_t tail = __atomic_load_n(&(r->tail), __ATOMIC_ACQUIRE);
+
+	if(head == tail)
+		return false;
+
+	*in = r->buf[head & (INPUT_RING_LEN - 1)];
+	return true;
+}
+
+//----------------------------------------------------------------------------//
+
+bool c64b_input_pop(t_c64b_input_ring* r, t_c64b_input* in)
+{
+	if(!c64b_input_peek(r, in))
+		return false;
+
+	__atomic_store_n(&(r->head), r->head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+//----------------------------------------------------------------------------//
+// all the gamepad state packed in one word, so that edges can be found with
+// plain bit operations
+
+uint64_t c64b_input_gp_bits(const t_c64b_gp_state* gp)
+{
+	return ((uint64_t)gp->buttons          ) |
+	       ((uint64_t)gp->dpad         << 16) |
+	       ((uint64_t)gp->misc_buttons << 24) |
+	       ((uint64_t)gp->analog       << 32) |
+	       ((uint64_t)gp->triggers     << 40);
+}
@@ -0,0 +1,86 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+#ifndef C64B_INPUT_H
+#define C64B_INPUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <uni.h>
+
+//----------------------------------------------------------------------------//
+// Controller reports travel from the bluepad32 callback to the parser task
+// through one single-producer single-consumer ring per device. Only the
+// information used by the parsers is kept, and consecutive states are merged
+// by the consumer only when no press or release would get lost. Gamepad
+// reports that find the ring full are merged by the producer instead, see
+// c64b_input_push_gp()
+
+#define INPUT_RING_LEN 32 // must be a power of two
+
+#define TRG_LTMASK     (1 << 0)
+#define TRG_RTMASK     (1 << 1)
+
+typedef struct
+{
+	uint16_t buttons;
+	uint8_t  dpad;
+	uint8_t  misc_buttons;
+	uint8_t  analog;   // ANL_* sector of the left stick
+	uint8_t  triggers; // TRG_* of the analog triggers
+} t_c64b_gp_state;
+
+typedef struct
+{
+	uint32_t t_us; // esp_timer time of the report
+	union
+	{
+		uni_keyboard_t  kb;
+		t_c64b_gp_state gp;
+	};
+} t_c64b_input;
+
+typedef struct
+{
+	t_c64b_input buf[INPUT_RING_LEN];
+	uint32_t     head;   // written by the consumer only
+	uint32_t     tail;   // written by the producer only
+	// producer state
+	t_c64b_input last;
+	bool         resync;
+	uint32_t     drops;
+	t_c64b_input held;   // gamepad presses seen while the ring was full
+} t_c64b_input_ring;
+
+//----------------------------------------------------------------------------//
+
+bool c64b_input_push(t_c64b_input_ring* r, const t_c64b_input* in, size_t len);
+bool c64b_input_push_gp(t_c64b_input_ring* r, const t_c64b_input* in);
+bool c64b_input_peek(t_c64b_input_ring* r, t_c64b_input* in);
+bool c64b_input_pop (t_c64b_input_ring* r, t_c64b_input* in);
+
+uint64_t c64b_input_gp_bits(const t_c64b_gp_state* gp);
+
+#endif
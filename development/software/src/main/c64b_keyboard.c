@@ -23,13 +23,23 @@
 // limitations under the License.                                             //
 //----------------------------------------------------------------------------//
 
+#include <stdlib.h>
 #include <uni.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
 
 #include "c64b_keyboard.h"
+#include "c64b_latency.h"
 #include "driver/gpio.h"
+#include "driver/gptimer.h"
+#include "driver/ledc.h"
+#include "soc/gpio_reg.h"
+#include "soc/gpio_sig_map.h"
+#include "soc/soc.h"
 
 #define ESC_LEN_MAX 6
 #define SHIFT_COL   1
@@ -196,6 +206,42 @@ const char *c64b_keyboard_idx_to_key(unsigned int i)
 	return NULL;
 }
 
+//----------------------------------------------------------------------------//
+// Text typed from outside of the macros: ASCII letters are typed unshifted, as
+// they appear in the default character set, PETSCII adds the shifted letters
+// and the control codes. '~' is passed on, so that the escapes of the macros
+// can be used. Returns NULL for the characters that have no key
+
+const char* c64b_keyboard_text_key(uint8_t c, char* buf)
+{
+	static const struct
+	{
+		uint8_t     c;
+		const char* key;
+	} CTRL_KEYS[] =
+	{
+		{0x0a, "~ret~"},  {0x0d, "~ret~"},  {0x09, " "},
+		{0x93, "~clr~"},  {0x13, "~home~"}, {0x14, "~del~"},  {0x94, "~inst~"},
+		{0x11, "~dn~"},   {0x91, "~up~"},   {0x1d, "~rr~"},   {0x9d, "~ll~"},
+		{0x85, "~f1~"},   {0x89, "~f2~"},   {0x86, "~f3~"},   {0x8a, "~f4~"},
+		{0x87, "~f5~"},   {0x8b, "~f6~"},   {0x88, "~f7~"},   {0x8c, "~f8~"},
+		{'_',  "~arll~"}, {'~',  "~"}
+	};
+
+	for(unsigned int i = 0; i < sizeof(CTRL_KEYS) / sizeof(CTRL_KEYS[0]); ++i)
+		if(CTRL_KEYS[i].c == c)
+			return CTRL_KEYS[i].key;
+
+	if((c >= 'A') && (c <= 'Z'))
+		c += 'a' - 'A';
+	else if((c >= 0xc1) && (c <= 0xda))
+		c -= 0xc1 - 'A';
+
+	buf[0] = c;
+	buf[1] = 0;
+	return (c64b_keyboard_key_to_idx(buf) != C64B_KB_IDX_NONE) ? buf : NULL;
+}
+
 //----------------------------------------------------------------------------//
 
 static const t_c64b_key_id * c64b_keyboard_char_to_key(const char* s)
@@ -234,24 +280,88 @@ static t_c64b_mod_evt c64b_keyboard_char_to_mod(const char* s)
 
 //----------------------------------------------------------------------------//
 
-bool c64b_keyboard_set_mux(t_c64b_keyboard *h, unsigned int col, unsigned int row)
+// the mux and joystick lines are driven through the W1TS / W1TC registers, so
+// that all the lines of a bank change with a single write. Pins 32 and above
+// live in the second bank, pin 255 marks a line that is not connected
+
+static uint64_t c64b_keyboard_pin_mask(unsigned int pin)
 {
-	if(h == NULL)
-		return false;
+	if(pin >= 64)
+		return 0;
+	return 1ULL << pin;
+}
+
+static void c64b_keyboard_out_set(uint64_t mask)
+{
+	if((uint32_t)mask)
+		REG_WRITE(GPIO_OUT_W1TS_REG, (uint32_t)mask);
+	if(mask >> 32)
+		REG_WRITE(GPIO_OUT1_W1TS_REG, (uint32_t)(mask >> 32));
+}
+
+static void c64b_keyboard_out_clr(uint64_t mask)
+{
+	if((uint32_t)mask)
+		REG_WRITE(GPIO_OUT_W1TC_REG, (uint32_t)mask);
+	if(mask >> 32)
+		REG_WRITE(GPIO_OUT1_W1TC_REG, (uint32_t)(mask >> 32));
+}
+
+//----------------------------------------------------------------------------//
+
+static void c64b_keyboard_masks_init(t_c64b_keyboard *h)
+{
+	for(unsigned int i = 0; i < NUM_KEYS; ++i)
+	{
+		unsigned int col = h->col_perm[KEY_IDS[i].col];
+		unsigned int row = h->row_perm[KEY_IDS[i].row];
+		uint64_t     set = 0;
+		uint64_t     clr = 0;
+
+		for(unsigned int b = 0; b < C64B_KKA_BITS; ++b)
+		{
+			if((col >> b) & 1)
+				set |= c64b_keyboard_pin_mask(h->pin_kca[b]);
+			else
+				clr |= c64b_keyboard_pin_mask(h->pin_kca[b]);
+
+			if((row >> b) & 1)
+				set |= c64b_keyboard_pin_mask(h->pin_kra[b]);
+			else
+				clr |= c64b_keyboard_pin_mask(h->pin_kra[b]);
+		}
 
-	col = h->col_perm[col];
-	row = h->row_perm[row];
+		h->mask_key_set[i] = set;
+		h->mask_key_clr[i] = clr;
+	}
+
+	h->mask_kben = c64b_keyboard_pin_mask(h->pin_kben);
+
+	for(unsigned int p = 0; p < 2; ++p)
+	{
+		unsigned int *pins = (p == 0) ? h->pin_row : h->pin_col;
 
-	gpio_set_level(h->pin_kca[0], (col >> 0) & 1);
-	gpio_set_level(h->pin_kca[1], (col >> 1) & 1);
-	gpio_set_level(h->pin_kca[2], (col >> 2) & 1);
+		h->mask_cport[p][CPORT_UP] = c64b_keyboard_pin_mask(pins[0]);
+		h->mask_cport[p][CPORT_DN] = c64b_keyboard_pin_mask(pins[1]);
+		h->mask_cport[p][CPORT_LL] = c64b_keyboard_pin_mask(pins[2]);
+		h->mask_cport[p][CPORT_RR] = c64b_keyboard_pin_mask(pins[3]);
+		h->mask_cport[p][CPORT_FF] = c64b_keyboard_pin_mask(pins[4]);
+	}
+}
 
-	gpio_set_level(h->pin_kra[0], (row >> 0) & 1);
-	gpio_set_level(h->pin_kra[1], (row >> 1) & 1);
-	gpio_set_level(h->pin_kra[2], (row >> 2) & 1);
+//----------------------------------------------------------------------------//
+// the first write disables the mux (KBEN is active low) while raising the
+// address bits, the second one lowers the remaining address bits and enables
+// it, so no intermediate crosspoint is ever closed, even when switching
+// directly from one key to another
 
-	gpio_set_level(h->pin_kben, 0);
+bool c64b_keyboard_set_mux(t_c64b_keyboard *h, unsigned int idx)
+{
+	if((h == NULL) || (idx >= NUM_KEYS))
+		return false;
 
+	c64b_keyboard_out_set(h->mask_key_set[idx] | h->mask_kben);
+	c64b_keyboard_out_clr(h->mask_key_clr[idx] | h->mask_kben);
 	return true;
 }
 
@@ -262,23 +372,733 @@ bool c64b_keyboard_clr_mux(t_c64b_keyboard *h)
 	if(h == NULL)
 		return false;
 
-	gpio_set_level(h->pin_kben, 1);
+	c64b_keyboard_out_set(h->mask_kben);
 	return true;
 }
 
 //----------------------------------------------------------------------------//
+// Rollover: the mux can only close one crosspoint at a time, so when several
+// keys are held they are cycled through it from a GPTimer interrupt, each one
+// for slot_us. The feed engine starts and stops the cycle, so that it stays
+// ordered with the other keyboard events.
 
-void c64b_keyboard_keys_rel(t_c64b_keyboard *h, bool rel_shft)
+typedef struct
+{
+	gptimer_handle_t timer;
+	portMUX_TYPE     lock;
+	bool             run;
+	unsigned int     cur;
+	unsigned int     num;
+	unsigned int     slot_us;
+	uint8_t          keys[C64B_SCAN_MAX];
+	// chord posted by the producer, picked up by the engine
+	unsigned int     next_num;
+	unsigned int     next_slot_us;
+	uint8_t          next_keys[C64B_SCAN_MAX];
+} t_c64b_scan;
+
+static t_c64b_scan scan =
+{
+	.timer        = NULL,
+	.lock         = portMUX_INITIALIZER_UNLOCKED,
+	.run          = false,
+	.cur          = 0,
+	.num          = 0,
+	.slot_us      = 0,
+	.next_num     = 0,
+	.next_slot_us = 0
+};
+
+static bool c64b_keyboard_scan_isr(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *arg)
+{
+	t_c64b_keyboard *h = (t_c64b_keyboard*)arg;
+
+	portENTER_CRITICAL_ISR(&scan.lock);
+	if(scan.num > 1)
+	{
+		scan.cur = (scan.cur + 1) % scan.num;
+		c64b_keyboard_set_mux(h, scan.keys[scan.cur]);
+	}
+	portEXIT_CRITICAL_ISR(&scan.lock);
+
+	return false;
+}
+
+//----------------------------------------------------------------------------//
+
+static void c64b_keyboard_scan_start(t_c64b_keyboard *h)
+{
+	portENTER_CRITICAL(&scan.lock);
+	scan.num     = scan.next_num;
+	scan.slot_us = scan.next_slot_us;
+	memcpy(scan.keys, scan.next_keys, scan.num);
+	// the latest key goes first
+	scan.cur     = scan.num - 1;
+	c64b_keyboard_set_mux(h, scan.keys[scan.cur]);
+	portEXIT_CRITICAL(&scan.lock);
+
+	if(scan.timer == NULL)
+		return;
+
+	const gptimer_alarm_config_t alarm =
+	{
+		.alarm_count                = scan.slot_us,
+		.reload_count               = 0,
+		.flags.auto_reload_on_alarm = true
+	};
+	gptimer_set_alarm_action(scan.timer, &alarm);
+
+	if(!scan.run)
+	{
+		gptimer_set_raw_count(scan.timer, 0);
+		gptimer_start(scan.timer);
+		scan.run = true;
+	}
+}
+
+//----------------------------------------------------------------------------//
+
+static void c64b_keyboard_scan_stop(void)
+{
+	// once the lock is released the interrupt can no longer touch the mux
+	portENTER_CRITICAL(&scan.lock);
+	scan.num = 0;
+	portEXIT_CRITICAL(&scan.lock);
+
+	if(scan.run)
+	{
+		gptimer_stop(scan.timer);
+		scan.run = false;
+	}
+}
+
+//----------------------------------------------------------------------------//
+
+static bool c64b_keyboard_scan_init(t_c64b_keyboard *h)
+{
+	const gptimer_config_t cfg =
+	{
+		.clk_src       = GPTIMER_CLK_SRC_DEFAULT,
+		.direction     = GPTIMER_COUNT_UP,
+		.resolution_hz = 1000000
+	};
+
+	const gptimer_event_callbacks_t cbs =
+	{
+		.on_alarm = c64b_keyboard_scan_isr
+	};
+
+	if(gptimer_new_timer(&cfg, &(scan.timer)) != ESP_OK)
+		return false;
+
+	if(gptimer_register_event_callbacks(scan.timer, &cbs, h) != ESP_OK)
+		return false;
+
+	return gptimer_enable(scan.timer) == ESP_OK;
+}
+
+//----------------------------------------------------------------------------//
+// Autofire: each port owns a LEDC timer and channel producing the fire
+// waveform. The fire pin is switched between the GPIO output register and the
+// LEDC signal through the GPIO matrix, so starting and stopping needs no task.
+// A period of 0 selects a single shot, timed by an esp_timer.
+
+#define AFIRE_SHOT_US  40000
+#define AFIRE_RES_BITS 18 // allows periods from about 3.3ms to 3.3s
+
+typedef struct
+{
+	t_c64b_keyboard*   h;
+	esp_timer_handle_t shot[2];
+	uint32_t           period_us;
+	unsigned int       duty_pct;
+	bool               ready;
+	bool               on[2];
+	bool               shot_on[2];
+} t_c64b_afire;
+
+static t_c64b_afire afire =
+{
+	.h         = NULL,
+	.shot      = {NULL, NULL},
+	.period_us = 0,
+	.duty_pct  = 50,
+	.ready     = false,
+	.on        = {false, false},
+	.shot_on   = {false, false}
+};
+
+//----------------------------------------------------------------------------//
+
+static unsigned int c64b_keyboard_afire_pin(t_c64b_keyboard *h, unsigned int p)
+{
+	return (p == 0) ? h->pin_row[CPORT_FF] : h->pin_col[CPORT_FF];
+}
+
+//----------------------------------------------------------------------------//
+// connects the fire pin either to the LEDC channel of the port or back to the
+// GPIO output register, a single write to the GPIO matrix
+
+static void c64b_keyboard_afire_route(t_c64b_keyboard *h, unsigned int p, bool on)
+{
+	uint32_t sig = on ? (LEDC_LS_SIG_OUT0_IDX + p) : SIG_GPIO_OUT_IDX;
+	REG_WRITE(GPIO_FUNC0_OUT_SEL_CFG_REG + (c64b_keyboard_afire_pin(h, p) * 4), sig);
+}
+
+//----------------------------------------------------------------------------//
+
+static void c64b_keyboard_afire_shot_cb(void* arg)
+{
+	t_c64b_keyboard *h = afire.h;
+	unsigned int     p = (unsigned int)(uintptr_t)arg;
+
+	afire.shot_on[p] = false;
+	c64b_keyboard_out_clr(h->mask_cport[p][CPORT_FF]);
+}
+
+//----------------------------------------------------------------------------//
+
+static bool c64b_keyboard_afire_init(t_c64b_keyboard *h)
+{
+	// on a new initialisation the fire lines only need to be handed back
+	if(afire.ready)
+	{
+		for(unsigned int p = 0; p < 2; ++p)
+		{
+			c64b_keyboard_afire_route(h, p, false);
+			afire.on[p] = false;
+		}
+		return afire.h == h;
+	}
+
+	for(unsigned int p = 0; p < 2; ++p)
+	{
+		const ledc_timer_config_t tcfg =
+		{
+			.speed_mode      = LEDC_LOW_SPEED_MODE,
+			.duty_resolution = AFIRE_RES_BITS,
+			.timer_num       = LEDC_TIMER_0 + p,
+			.freq_hz         = 10,
+			.clk_cfg         = LEDC_USE_APB_CLK
+		};
+
+		const ledc_channel_config_t ccfg =
+		{
+			.gpio_num   = c64b_keyboard_afire_pin(h, p),
+			.speed_mode = LEDC_LOW_SPEED_MODE,
+			.channel    = LEDC_CHANNEL_0 + p,
+			.intr_type  = LEDC_INTR_DISABLE,
+			.timer_sel  = LEDC_TIMER_0 + p,
+			.duty       = (1 << AFIRE_RES_BITS) / 2,
+			.hpoint     = 0
+		};
+
+		const esp_timer_create_args_t args =
+		{
+			.callback        = c64b_keyboard_afire_shot_cb,
+			.arg             = (void*)(uintptr_t)p,
+			.dispatch_method = ESP_TIMER_TASK,
+			.name            = "c64b_shot"
+		};
+
+		if(ledc_timer_config(&tcfg) != ESP_OK)
+			return false;
+
+		if(ledc_channel_config(&ccfg) != ESP_OK)
+			return false;
+
+		// the channel keeps running, the pin is handed back to the port
+		c64b_keyboard_afire_route(h, p, false);
+
+		if(esp_timer_create(&args, &(afire.shot[p])) != ESP_OK)
+			return false;
+	}
+
+	afire.h     = h;
+	afire.ready = true;
+
+	// a rate may have been selected before the peripherals were ready
+	c64b_keyboard_afire_cfg(h, afire.period_us, afire.duty_pct);
+	return true;
+}
+
+//----------------------------------------------------------------------------//
+// the line is held for duty_pct of every period, running waveforms are updated
+// on the fly
+
+void c64b_keyboard_afire_cfg(t_c64b_keyboard *h, uint32_t period_us, unsigned int duty_pct)
 {
 	if(h == NULL)
 		return;
 
-	c64b_keyboard_clr_mux(h);
+	if(duty_pct > 100)
+		duty_pct = 100;
+
+	// switching from and to the single shot mode restarts autofire
+	if(afire.ready && ((period_us == 0) != (afire.period_us == 0)))
+	{
+		for(unsigned int p = 0; p < 2; ++p)
+		{
+			c64b_keyboard_afire_route(h, p, false);
+			afire.on[p] = false;
+		}
+	}
+
+	afire.period_us = period_us;
+	afire.duty_pct  = duty_pct;
+
+	if(!afire.ready || (period_us == 0))
+		return;
+
+	// the divider is a fixed point value with 8 fractional bits
+	uint64_t div  = ((uint64_t)APB_CLK_FREQ * period_us * 256) / (1000000ULL << AFIRE_RES_BITS);
+	uint32_t duty = (uint32_t)(((uint64_t)(1 << AFIRE_RES_BITS) * duty_pct) / 100);
+
+	if(div < 256)
+		div = 256;
+	if(div > 0x3ffff)
+		div = 0x3ffff;
+
+	for(unsigned int p = 0; p < 2; ++p)
+	{
+		ledc_timer_set(LEDC_LOW_SPEED_MODE, LEDC_TIMER_0 + p, (uint32_t)div, AFIRE_RES_BITS, LEDC_APB_CLK);
+		ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0 + p, duty);
+		ledc_update_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0 + p);
+	}
+}
+
+//----------------------------------------------------------------------------//
+// the waveform is restarted so that the first shot is immediate
+
+void c64b_keyboard_afire_psh(t_c64b_keyboard *h, t_c64b_cport_idx idx)
+{
+	if((h == NULL) || (idx == CPORT_NONE) || !afire.ready)
+		return;
+
+	unsigned int p = idx - CPORT_1;
+
+	if(afire.on[p])
+		return;
+
+	afire.on[p] = true;
+
+	if(afire.period_us == 0)
+	{
+		afire.shot_on[p] = true;
+		c64b_keyboard_out_set(h->mask_cport[p][CPORT_FF]);
+		esp_timer_stop(afire.shot[p]);
+		esp_timer_start_once(afire.shot[p], AFIRE_SHOT_US);
+		return;
+	}
+
+	ledc_timer_rst(LEDC_LOW_SPEED_MODE, LEDC_TIMER_0 + p);
+	c64b_keyboard_afire_route(h, p, true);
+}
+
+//----------------------------------------------------------------------------//
+
+void c64b_keyboard_afire_rel(t_c64b_keyboard *h, t_c64b_cport_idx idx)
+{
+	if((h == NULL) || (idx == CPORT_NONE) || !afire.ready)
+		return;
+
+	unsigned int p = idx - CPORT_1;
+
+	if(!afire.on[p])
+		return;
+
+	afire.on[p] = false;
+
+	// a single shot is left to complete
+	if(afire.period_us != 0)
+		c64b_keyboard_afire_route(h, p, false);
+}
+
+//----------------------------------------------------------------------------//
+// Feed engine: keyboard line events are queued and played back from an
+// esp_timer callback, which also enforces the hold and release times with
+// microsecond resolution. Callers never sleep, they only block if the queue
+// is full. Producers must own the keyboard, see c64b_kb_acquire().
+
+#define FEED_QUEUE_LEN 64
+
+// a queued event, marks carry the time of the report that caused the key
+typedef struct
+{
+	uint8_t  code;
+	uint8_t  arg;
+	uint32_t t_us;
+} t_c64b_feed_ev;
+
+typedef struct
+{
+	t_c64b_keyboard*   h;
+	QueueHandle_t      queue;
+	esp_timer_handle_t timer;
+	SemaphoreHandle_t  sync;
+	portMUX_TYPE       lock;
+	bool               run;
+	bool               wait;
+	// cancellation, see c64b_keyboard_feed_cancel()
+	volatile bool      cancel;
+	bool               dropping;
+	bool               cancelled;
+	// state of the lines as of the last queued event
+	unsigned int       key;
+	bool               shft;
+	bool               ctrl;
+	bool               cmdr;
+	// latency probe, armed when a mark is played back with the device and
+	// the report time it carries
+	uint32_t           mark_us;
+	unsigned int       mark_dev;
+	bool               mark;
+} t_c64b_feed;
+
+static t_c64b_feed feed =
+{
+	.h     = NULL,
+	.queue = NULL,
+	.timer = NULL,
+	.sync  = NULL,
+	.lock  = portMUX_INITIALIZER_UNLOCKED,
+	.run   = false,
+	.wait  = false,
+	.cancel    = false,
+	.dropping  = false,
+	.cancelled = false,
+	.key   = C64B_KB_IDX_NONE,
+	.shft  = false,
+	.ctrl  = false,
+	.cmdr  = false,
+	.mark  = false
+};
+
+//----------------------------------------------------------------------------//
+
+static void c64b_keyboard_feed_probe(void)
+{
+	if(!feed.mark)
+		return;
+
+	c64b_latency_add(feed.mark_dev, LAT_PATH_KEYS, feed.mark_us);
+	feed.mark = false;
+}
+
+//----------------------------------------------------------------------------//
+// executes a single event and returns the time to wait before the next one
+
+static uint64_t c64b_keyboard_feed_exec(t_c64b_keyboard *h, const t_c64b_feed_ev* op)
+{
+	switch(op->code)
+	{
+		case C64B_OP_KEY_PSH:
+			c64b_keyboard_scan_stop();
+			h->trace_key = &(KEY_IDS[op->arg]);
+			c64b_keyboard_set_mux(h, op->arg);
+			c64b_keyboard_feed_probe();
+			return h->feed_psh_us;
+		case C64B_OP_KEY_SCN:
+			c64b_keyboard_scan_start(h);
+			c64b_keyboard_feed_probe();
+			return h->feed_psh_us;
+		case C64B_OP_KEY_REL:
+			// the next key press switches the mux directly
+			if((op->arg & C64B_REL_OVLP) && h->feed_ovlp)
+				break;
+			c64b_keyboard_scan_stop();
+			c64b_keyboard_clr_mux(h);
+			if(op->arg & C64B_REL_SHFT)
+				gpio_set_level(h->pin_shft, 0);
+			return h->feed_rel_us;
+		case C64B_OP_SHFT_PSH:
+			gpio_set_level(h->pin_shft, 1);
+			break;
+		case C64B_OP_SHFT_REL:
+			gpio_set_level(h->pin_shft, 0);
+			break;
+		case C64B_OP_CTRL_PSH:
+			gpio_set_level(h->pin_ctrl, 1);
+			break;
+		case C64B_OP_CTRL_REL:
+			gpio_set_level(h->pin_ctrl, 0);
+			break;
+		case C64B_OP_CMDR_PSH:
+			gpio_set_level(h->pin_cmdr, 1);
+			break;
+		case C64B_OP_CMDR_REL:
+			gpio_set_level(h->pin_cmdr, 0);
+			break;
+		case C64B_OP_SYNC:
+			xSemaphoreGive(feed.sync);
+			break;
+		case C64B_OP_MARK:
+			feed.mark_dev = op->arg;
+			feed.mark_us  = op->t_us;
+			feed.mark     = true;
+			break;
+		default:
+			break;
+	}
+	return 0;
+}
+
+//----------------------------------------------------------------------------//
+// drops the events of a cancelled stream up to its sync event. The callback
+// only runs once the previous hold time has expired, so the lines are never
+// released in the middle of a keystroke
+
+static uint64_t c64b_keyboard_feed_drop(t_c64b_keyboard *h, const t_c64b_feed_ev* op)
+{
+	uint64_t dly = 0;
 
-	if(rel_shft)
+	if(!feed.dropping)
+	{
+		c64b_keyboard_scan_stop();
+		c64b_keyboard_clr_mux(h);
 		gpio_set_level(h->pin_shft, 0);
+		gpio_set_level(h->pin_ctrl, 0);
+		gpio_set_level(h->pin_cmdr, 0);
+		feed.mark     = false;
+		feed.dropping = true;
+		dly           = h->feed_rel_us;
+	}
+
+	if(op->code == C64B_OP_SYNC)
+	{
+		feed.dropping  = false;
+		feed.cancel    = false;
+		feed.cancelled = true;
+		xSemaphoreGive(feed.sync);
+	}
+	return dly;
+}
+
+//----------------------------------------------------------------------------//
+
+static void c64b_keyboard_feed_cb(void* arg)
+{
+	t_c64b_keyboard *h   = (t_c64b_keyboard*)arg;
+	t_c64b_feed_ev   op;
+	uint64_t         dly = 0;
+
+	// events without a hold time are executed back to back
+	while(dly == 0)
+	{
+		if(xQueueReceive(feed.queue, &op, 0) == pdTRUE)
+		{
+			if(feed.cancel)
+				dly = c64b_keyboard_feed_drop(h, &op);
+			else
+				dly = c64b_keyboard_feed_exec(h, &op);
+			continue;
+		}
+
+		// the queue is checked again under the lock, so that an event
+		// posted in the meantime either sees the engine running or restarts it
+		bool idle;
+		portENTER_CRITICAL(&feed.lock);
+		idle = (uxQueueMessagesWaiting(feed.queue) == 0);
+		if(idle)
+			feed.run = false;
+		portEXIT_CRITICAL(&feed.lock);
+
+		if(idle)
+			return;
+	}
+
+	esp_timer_start_once(feed.timer, dly);
+}
+
+//----------------------------------------------------------------------------//
+
+static void c64b_keyboard_feed_kick(void)
+{
+	bool start = false;
+
+	portENTER_CRITICAL(&feed.lock);
+	if(!feed.run)
+	{
+		feed.run = true;
+		start    = true;
+	}
+	portEXIT_CRITICAL(&feed.lock);
+
+	if(start)
+		esp_timer_start_once(feed.timer, 0);
+}
+
+//----------------------------------------------------------------------------//
+
+static void c64b_keyboard_feed_send(const t_c64b_feed_ev* ev)
+{
+	xQueueSend(feed.queue, ev, portMAX_DELAY);
+
+	// the engine is kicked on every event, a full queue would otherwise
+	// block the producer before playback has even started
+	c64b_keyboard_feed_kick();
+}
 
-	vTaskDelay(h->feed_rel_ms / portTICK_PERIOD_MS);
+//----------------------------------------------------------------------------//
+// queues an event, dropping the ones that would not change any line
+
+static bool c64b_keyboard_feed_post(t_c64b_keyboard *h, uint8_t code, uint8_t arg)
+{
+	if((h == NULL) || (feed.queue == NULL))
+		return false;
+
+	switch(code)
+	{
+		case C64B_OP_KEY_PSH:
+			if(arg >= NUM_KEYS)
+				return false;
+			if(feed.key == arg)
+				return true;
+			feed.key = arg;
+			break;
+		case C64B_OP_KEY_SCN:
+			feed.key = C64B_KB_IDX_SCAN;
+			break;
+		case C64B_OP_KEY_REL:
+			if((feed.key == C64B_KB_IDX_NONE) && !((arg & C64B_REL_SHFT) && feed.shft))
+				return true;
+			feed.key = C64B_KB_IDX_NONE;
+			if(arg & C64B_REL_SHFT)
+				feed.shft = false;
+			break;
+		case C64B_OP_SHFT_PSH:
+		case C64B_OP_SHFT_REL:
+			if(feed.shft == (code == C64B_OP_SHFT_PSH))
+				return true;
+			feed.shft = (code == C64B_OP_SHFT_PSH);
+			break;
+		case C64B_OP_CTRL_PSH:
+		case C64B_OP_CTRL_REL:
+			if(feed.ctrl == (code == C64B_OP_CTRL_PSH))
+				return true;
+			feed.ctrl = (code == C64B_OP_CTRL_PSH);
+			break;
+		case C64B_OP_CMDR_PSH:
+		case C64B_OP_CMDR_REL:
+			if(feed.cmdr == (code == C64B_OP_CMDR_PSH))
+				return true;
+			feed.cmdr = (code == C64B_OP_CMDR_PSH);
+			break;
+		default:
+			break;
+	}
+
+	t_c64b_feed_ev ev = {.code = code, .arg = arg, .t_us = 0};
+	c64b_keyboard_feed_send(&ev);
+	return true;
+}
+
+//----------------------------------------------------------------------------//
+// key presses caused by a controller report carry a mark in front of them,
+// see c64b_latency_begin()
+
+static void c64b_keyboard_feed_mark(t_c64b_keyboard *h)
+{
+	unsigned int dev;
+	uint32_t     t_us;
+
+	if((h == NULL) || (feed.queue == NULL) || !c64b_latency_current(&dev, &t_us))
+		return;
+
+	t_c64b_feed_ev ev = {.code = C64B_OP_MARK, .arg = dev, .t_us = t_us};
+	c64b_keyboard_feed_send(&ev);
+}
+
+//----------------------------------------------------------------------------//
+
+void c64b_keyboard_feed_sync(t_c64b_keyboard *h)
+{
+	if((h == NULL) || (feed.queue == NULL))
+		return;
+
+	feed.wait = true;
+	c64b_keyboard_feed_post(h, C64B_OP_SYNC, 0);
+	xSemaphoreTake(feed.sync, portMAX_DELAY);
+	feed.wait = false;
+
+	// the engine has released all the lines of a cancelled stream
+	if(feed.cancelled)
+	{
+		feed.key  = C64B_KB_IDX_NONE;
+		feed.shft = false;
+		feed.ctrl = false;
+		feed.cmdr = false;
+	}
+}
+
+//----------------------------------------------------------------------------//
+// asks the engine to drop the stream being played at the next keystroke
+// boundary. The request is cleared by the sync event closing the stream, or
+// by the producer when the stream has already completed
+
+void c64b_keyboard_feed_cancel(t_c64b_keyboard *h, bool cancel)
+{
+	if(h == NULL)
+		return;
+
+	feed.cancel = cancel;
+}
+
+//----------------------------------------------------------------------------//
+// drops the pending events through the cancellation path and waits for the
+// engine: an event the callback has already taken is completed before the
+// lines are released, so no stale key is left closed once this returns. The
+// caller owns the keyboard, no other stream is waiting on the sync event
+
+static void c64b_keyboard_feed_flush(t_c64b_keyboard *h)
+{
+	if(feed.queue == NULL)
+		return;
+
+	feed.cancel = true;
+	c64b_keyboard_feed_sync(h);
+
+	feed.mark = false;
+}
+
+//----------------------------------------------------------------------------//
+
+static bool c64b_keyboard_feed_init(t_c64b_keyboard *h)
+{
+	if(feed.queue != NULL)
+		return feed.h == h;
+
+	const esp_timer_create_args_t args =
+	{
+		.callback        = c64b_keyboard_feed_cb,
+		.arg             = h,
+		.dispatch_method = ESP_TIMER_TASK,
+		.name            = "c64b_feed"
+	};
+
+	feed.sync = xSemaphoreCreateBinary();
+	if(feed.sync == NULL)
+		return false;
+
+	if(esp_timer_create(&args, &(feed.timer)) != ESP_OK)
+		return false;
+
+	feed.queue = xQueueCreate(FEED_QUEUE_LEN, sizeof(t_c64b_feed_ev));
+	if(feed.queue == NULL)
+		return false;
+
+	if(!c64b_keyboard_scan_init(h))
+		loge("Error: unable to initialise the rollover timer\n");
+
+	feed.h = h;
+	return true;
+}
+
+//----------------------------------------------------------------------------//
+
+void c64b_keyboard_keys_rel(t_c64b_keyboard *h, bool rel_shft)
+{
+	c64b_keyboard_feed_post(h, C64B_OP_KEY_REL, rel_shft ? C64B_REL_SHFT : 0);
 }
 
 //----------------------------------------------------------------------------//
@@ -300,98 +1120,118 @@ bool c64b_keyboard_key_psh(t_c64b_keyboard *h, const t_c64b_key_id *k)
 	if((h == NULL) || (k == NULL))
 		return false;
 
-	h->trace_key = k;
-
 	if(k->shft)
 		c64b_keyboard_shft_psh(h);
 
-	c64b_keyboard_set_mux(h, k->col, k->row);
+	if(feed.key != (unsigned int)(k - KEY_IDS))
+	{
+		c64b_keyboard_feed_mark(h);
+		h->live_keys++;
+	}
 
-	vTaskDelay(h->feed_psh_ms / portTICK_PERIOD_MS);
-	return true;
+	return c64b_keyboard_feed_post(h, C64B_OP_KEY_PSH, k - KEY_IDS);
 }
 
 //----------------------------------------------------------------------------//
+// holds all the given keys at once, idx is ordered from the oldest to the
+// latest key. The latest key decides the state of the shift line. Without a
+// slot or with a single key only the latest one is pressed.
 
-bool c64b_keyboard_key_rel(t_c64b_keyboard *h, const t_c64b_key_id *k)
+bool c64b_keyboard_keys_scan(t_c64b_keyboard *h, const uint8_t* idx, unsigned int num, unsigned int slot_us)
 {
-	if((h == NULL) || (k == NULL))
+	if((h == NULL) || (idx == NULL) || (num == 0))
 		return false;
 
-	c64b_keyboard_clr_mux(h);
+	if(num > C64B_SCAN_MAX)
+	{
+		idx += num - C64B_SCAN_MAX;
+		num  = C64B_SCAN_MAX;
+	}
+
+	for(unsigned int i = 0; i < num; ++i)
+		if(idx[i] >= NUM_KEYS)
+			return false;
+
+	const t_c64b_key_id *k = &(KEY_IDS[idx[num - 1]]);
+
+	if((num == 1) || (slot_us == 0) || (scan.timer == NULL))
+		return c64b_keyboard_key_psh(h, k);
 
 	if(k->shft)
+		c64b_keyboard_shft_psh(h);
+	else
 		c64b_keyboard_shft_rel(h);
 
-	vTaskDelay(h->feed_rel_ms / portTICK_PERIOD_MS);
+	if((feed.key == C64B_KB_IDX_SCAN) && (scan.next_num == num) &&
+	   (scan.next_slot_us == slot_us) && (memcmp(scan.next_keys, idx, num) == 0))
+		return true;
 
-	return true;
+	portENTER_CRITICAL(&scan.lock);
+	scan.next_num     = num;
+	scan.next_slot_us = slot_us;
+	memcpy(scan.next_keys, idx, num);
+	portEXIT_CRITICAL(&scan.lock);
+
+	c64b_keyboard_feed_mark(h);
+	h->live_keys++;
+	return c64b_keyboard_feed_post(h, C64B_OP_KEY_SCN, num);
+}
+
+//----------------------------------------------------------------------------//
+
+bool c64b_keyboard_key_rel(t_c64b_keyboard *h, const t_c64b_key_id *k)
+{
+	if((h == NULL) || (k == NULL))
+		return false;
+
+	return c64b_keyboard_feed_post(h, C64B_OP_KEY_REL, k->shft ? C64B_REL_SHFT : 0);
 }
 
 //----------------------------------------------------------------------------//
 
 void c64b_keyboard_cport_psh(t_c64b_keyboard *h, t_c64b_cport_key key, t_c64b_cport_idx idx)
 {
-	if(h == NULL)
+	if((h == NULL) || (key > CPORT_FF) || (idx == CPORT_NONE))
 		return;
 
-	unsigned int *pins;
-	if(idx == CPORT_1)
-		pins = h->pin_row;
-	else
-		pins = h->pin_col;
-
-	switch(key)
-	{
-		case CPORT_UP:
-			gpio_set_level(pins[0], 1);
-			break;
-		case CPORT_LL:
-			gpio_set_level(pins[2], 1);
-			break;
-		case CPORT_RR:
-			gpio_set_level(pins[3], 1);
-			break;
-		case CPORT_DN:
-			gpio_set_level(pins[1], 1);
-			break;
-		case CPORT_FF:
-			gpio_set_level(pins[4], 1);
-			break;
-	}
+	c64b_keyboard_out_set(h->mask_cport[idx - CPORT_1][key]);
 }
 
 //----------------------------------------------------------------------------//
 
 void c64b_keyboard_cport_rel(t_c64b_keyboard *h, t_c64b_cport_key key, t_c64b_cport_idx idx)
 {
-	if(h == NULL)
+	if((h == NULL) || (key > CPORT_FF) || (idx == CPORT_NONE))
 		return;
 
-	unsigned int *pins;
-	if(idx == CPORT_1)
-		pins = h->pin_row;
-	else
-		pins = h->pin_col;
+	c64b_keyboard_out_clr(h->mask_cport[idx - CPORT_1][key]);
+}
+
+//----------------------------------------------------------------------------//
+// updates all the lines of a port at once, mask is built with CPORT_MASK()
+
+void c64b_keyboard_cport_set(t_c64b_keyboard *h, uint8_t mask, t_c64b_cport_idx idx)
+{
+	if((h == NULL) || (idx == CPORT_NONE))
+		return;
+
+	uint64_t set = 0;
+	uint64_t clr = 0;
 
-	switch(key)
+	// a single shot in progress keeps the fire line pressed
+	if(afire.shot_on[idx - CPORT_1])
+		mask |= CPORT_MASK(CPORT_FF);
+
+	for(unsigned int k = CPORT_UP; k <= CPORT_FF; ++k)
 	{
-		case CPORT_UP:
-			gpio_set_level(pins[0], 0);
-			break;
-		case CPORT_LL:
-			gpio_set_level(pins[2], 0);
-			break;
-		case CPORT_RR:
-			gpio_set_level(pins[3], 0);
-			break;
-		case CPORT_DN:
-			gpio_set_level(pins[1], 0);
-			break;
-		case CPORT_FF:
-			gpio_set_level(pins[4], 0);
-			break;
+		if(mask & CPORT_MASK(k))
+			set |= h->mask_cport[idx - CPORT_1][k];
+		else
+			clr |= h->mask_cport[idx - CPORT_1][k];
 	}
+
+	c64b_keyboard_out_set(set);
+	c64b_keyboard_out_clr(clr);
 }
 
 //----------------------------------------------------------------------------//
@@ -420,54 +1260,42 @@ void c64b_keyboard_rest_rel(t_c64b_keyboard *h)
 
 void c64b_keyboard_ctrl_psh(t_c64b_keyboard *h)
 {
-	if(h == NULL)
-		return;
-	gpio_set_level(h->pin_ctrl, 1);
+	c64b_keyboard_feed_post(h, C64B_OP_CTRL_PSH, 0);
 }
 
 //----------------------------------------------------------------------------//
 
 void c64b_keyboard_ctrl_rel(t_c64b_keyboard *h)
 {
-	if(h == NULL)
-		return;
-	gpio_set_level(h->pin_ctrl, 0);
+	c64b_keyboard_feed_post(h, C64B_OP_CTRL_REL, 0);
 }
 
 //----------------------------------------------------------------------------//
 
 void c64b_keyboard_shft_psh(t_c64b_keyboard *h)
 {
-	if(h == NULL)
-		return;
-	gpio_set_level(h->pin_shft, 1);
+	c64b_keyboard_feed_post(h, C64B_OP_SHFT_PSH, 0);
 }
 
 //----------------------------------------------------------------------------//
 
 void c64b_keyboard_shft_rel(t_c64b_keyboard *h)
 {
-	if(h == NULL)
-		return;
-	gpio_set_level(h->pin_shft, 0);
+	c64b_keyboard_feed_post(h, C64B_OP_SHFT_REL, 0);
 }
 
 //----------------------------------------------------------------------------//
 
 void c64b_keyboard_cmdr_psh(t_c64b_keyboard *h)
 {
-	if(h == NULL)
-		return;
-	gpio_set_level(h->pin_cmdr, 1);
+	c64b_keyboard_feed_post(h, C64B_OP_CMDR_PSH, 0);
 }
 
 //----------------------------------------------------------------------------//
 
 void c64b_keyboard_cmdr_rel(t_c64b_keyboard *h)
 {
-	if(h == NULL)
-		return;
-	gpio_set_level(h->pin_cmdr, 0);
+	c64b_keyboard_feed_post(h, C64B_OP_CMDR_REL, 0);
 }
 
 //----------------------------------------------------------------------------//
@@ -507,54 +1335,164 @@ bool c64b_keyboard_char_rel(t_c64b_keyboard *h, const char *s)
 }
 
 //----------------------------------------------------------------------------//
+// single ascii characters are resolved through a lookup table, only the
+// "~"-escaped sequences still go through the KEY_IDS string search
+
+static uint8_t ascii_to_idx[128];
+static bool    ascii_to_idx_ready = false;
 
-bool c64b_keyboard_feed_str(t_c64b_keyboard *h, char* s)
+static void c64b_keyboard_ascii_init(void)
 {
-	static char stripped[] = " ";
+	if(ascii_to_idx_ready)
+		return;
 
-	if((h == NULL) || (s == NULL))
-		return false;
+	for(unsigned int c = 0; c < 128; ++c)
+		ascii_to_idx[c] = C64B_KB_IDX_NONE;
 
-	const char          *head = s;
-	const t_c64b_key_id *key  = NULL;
-	t_c64b_mod_evt       mod  = NONE;
+	for(unsigned int i = 0; i < NUM_KEYS; ++i)
+		if((KEY_IDS[i].str[0] != '~') && (KEY_IDS[i].str[1] == 0))
+			ascii_to_idx[(uint8_t)KEY_IDS[i].str[0]] = i;
 
-	bool shft                 = false;
-	bool strip                = false;
-	bool strip_first          = false;
-	bool error                = false;
+	ascii_to_idx_ready = true;
+}
+
+static unsigned int c64b_keyboard_head_to_idx(const char* s)
+{
+	if(((uint8_t)s[0] < 128) && (s[0] != '~'))
+		return ascii_to_idx[(uint8_t)s[0]];
+	return c64b_keyboard_key_to_idx(s);
+}
+
+//----------------------------------------------------------------------------//
+
+typedef struct
+{
+	t_c64b_kb_op* ops;
+	size_t        max;
+	size_t        len;
+	size_t        rel;        // last key release that could also drop shift
+	unsigned int  key;        // last key pressed
+	bool          shft;       // state of the shift line
+	bool          shft_latch; // shift held by "~shft-psh~"
+} t_c64b_compiler;
+
+#define C64B_OP_NONE ((size_t)-1)
+
+static void c64b_keyboard_emit(t_c64b_compiler *c, uint8_t code, uint8_t arg)
+{
+	if((c->ops != NULL) && (c->len < c->max))
+	{
+		c->ops[c->len].code = code;
+		c->ops[c->len].arg  = arg;
+	}
+	c->len += 1;
+}
+
+static void c64b_keyboard_emit_shft_rel(t_c64b_compiler *c)
+{
+	// shift is dropped together with the previous key release whenever
+	// possible, so that it never toggles in between shifted characters
+	if(c->rel != C64B_OP_NONE)
+	{
+		if((c->ops != NULL) && (c->rel < c->max))
+			c->ops[c->rel].arg |= C64B_REL_SHFT;
+	}
+	else
+	{
+		c64b_keyboard_emit(c, C64B_OP_SHFT_REL, 0);
+	}
+	c->shft = false;
+}
+
+static void c64b_keyboard_emit_key(t_c64b_compiler *c, unsigned int idx)
+{
+	bool shft = KEY_IDS[idx].shft || c->shft_latch;
+
+	if(c->shft && !shft)
+		c64b_keyboard_emit_shft_rel(c);
+
+	if(!c->shft && shft)
+	{
+		c64b_keyboard_emit(c, C64B_OP_SHFT_PSH, 0);
+		c->shft = true;
+	}
+
+	// a release gap is only needed to repeat a key or to change shift, as
+	// the KERNAL registers a new key as soon as the scanned one differs
+	if((c->rel != C64B_OP_NONE) && (c->rel == c->len - 1) && (c->key != idx) &&
+	   (c->ops != NULL) && (c->rel < c->max) && !(c->ops[c->rel].arg & C64B_REL_SHFT))
+		c->ops[c->rel].arg |= C64B_REL_OVLP;
+
+	c64b_keyboard_emit(c, C64B_OP_KEY_PSH, idx);
+	c->rel = c->len;
+	c->key = idx;
+	c64b_keyboard_emit(c, C64B_OP_KEY_REL, 0);
+}
+
+//----------------------------------------------------------------------------//
+// translates a macro string into its op stream. Returns the number of ops
+// including the terminating C64B_OP_END, or 0 if the string is malformed or
+// does not fit in max_ops. With ops == NULL the required length is computed
+
+size_t c64b_keyboard_compile(const char* s, t_c64b_kb_op* ops, size_t max_ops)
+{
+	if(s == NULL)
+		return 0;
+
+	c64b_keyboard_ascii_init();
+
+	t_c64b_compiler c =
+	{
+		.ops        = ops,
+		.max        = max_ops,
+		.len        = 0,
+		.rel        = C64B_OP_NONE,
+		.key        = C64B_KB_IDX_NONE,
+		.shft       = false,
+		.shft_latch = false
+	};
+
+	const char     *head        = s;
+	unsigned int    idx         = C64B_KB_IDX_NONE;
+	t_c64b_mod_evt  mod         = NONE;
+	bool            strip       = false;
+	bool            strip_first = false;
 
 	while(*head != 0)
 	{
-		mod = c64b_keyboard_char_to_mod(head);
-		key = c64b_keyboard_char_to_key(head);
+		mod = (*head == '~') ? c64b_keyboard_char_to_mod(head) : NONE;
 
 		if(mod != NONE)
 		{
-			logi("activating modifier %s\n", MOD_EVT_IDS[mod]);
 			switch(mod)
 			{
-				case NONE:
-					break;
 				case CTRL_PSH:
-					c64b_keyboard_ctrl_psh(h);
+					c64b_keyboard_emit(&c, C64B_OP_CTRL_PSH, 0);
 					break;
 				case CTRL_REL:
-					c64b_keyboard_ctrl_rel(h);
+					c64b_keyboard_emit(&c, C64B_OP_CTRL_REL, 0);
 					break;
 				case CMDR_PSH:
-					c64b_keyboard_cmdr_psh(h);
+					c64b_keyboard_emit(&c, C64B_OP_CMDR_PSH, 0);
 					break;
 				case CMDR_REL:
-					c64b_keyboard_cmdr_rel(h);
+					c64b_keyboard_emit(&c, C64B_OP_CMDR_REL, 0);
 					break;
 				case SHFT_PSH:
-					c64b_keyboard_shft_psh(h);
-					shft = true;
+					c.shft_latch = true;
+					if(!c.shft)
+					{
+						c64b_keyboard_emit(&c, C64B_OP_SHFT_PSH, 0);
+						c.shft = true;
+					}
 					break;
 				case SHFT_REL:
-					c64b_keyboard_shft_rel(h);
-					shft = false;
+					c.shft_latch = false;
+					if(c.shft)
+					{
+						c.rel = C64B_OP_NONE;
+						c64b_keyboard_emit_shft_rel(&c);
+					}
 					break;
 				case STRIP:
 					strip       = true;
@@ -564,54 +1502,166 @@ bool c64b_keyboard_feed_str(t_c64b_keyboard *h, char* s)
 					break;
 			}
 			head += strlen(MOD_EVT_IDS[mod]);
+			continue;
 		}
-		else if(key != NULL)
+
+		idx = c64b_keyboard_head_to_idx(head);
+		if(idx == C64B_KB_IDX_NONE)
+			return 0;
+
+		// strip is ignored on printable characters
+		if(KEY_IDS[idx].prnt && strip_first)
 		{
-			// strip is ignored on printable characters
-			if(key->prnt && strip_first)
-			{
-				strip       = false;
-				strip_first = false;
-			}
+			strip       = false;
+			strip_first = false;
+		}
 
-			if(strip)
+		if(strip)
+		{
+			// the name of an escaped key is typed character by character
+			if(*head != '~')
 			{
-				if(*head != '~')
-				{
-					stripped[0] = *head;
-					c64b_keyboard_char_psh(h, stripped);
-					c64b_keyboard_keys_rel(h, !shft);
-
-					if(strip_first)
-						strip = false;
-				}
-
-				head        += 1;
-				strip_first = false;
-
-				if(*head == '~')
-				{
-					head  += 1;
+				c64b_keyboard_emit_key(&c, idx);
+
+				if(strip_first)
 					strip = false;
-				}
 			}
-			else
+
+			head        += 1;
+			strip_first = false;
+
+			if(*head == '~')
 			{
-				c64b_keyboard_key_psh(h, key);
-				c64b_keyboard_keys_rel(h, !shft);
-				head += strlen(key->str);
+				head  += 1;
+				strip = false;
 			}
 		}
 		else
 		{
-			error = true;
+			c64b_keyboard_emit_key(&c, idx);
+			head += strlen(KEY_IDS[idx].str);
+		}
+	}
+
+	if(c.shft)
+		c64b_keyboard_emit_shft_rel(&c);
+
+	c64b_keyboard_emit(&c, C64B_OP_END, 0);
+
+	if((ops != NULL) && (c.len > max_ops))
+		return 0;
+
+	return c.len;
+}
+
+//----------------------------------------------------------------------------//
+// the characters a string leaves on screen, as key indexes: escaped keys are
+// only kept when printable, "~strip~" spells the name of the next one
+
+size_t c64b_keyboard_screen_keys(const char* s, uint8_t* keys, size_t max_keys)
+{
+	if((s == NULL) || (keys == NULL))
+		return 0;
+
+	c64b_keyboard_ascii_init();
+
+	size_t n     = 0;
+	bool   strip = false;
+
+	while((*s != 0) && (n < max_keys))
+	{
+		t_c64b_mod_evt mod = (*s == '~') ? c64b_keyboard_char_to_mod(s) : NONE;
+
+		if(mod != NONE)
+		{
+			if(mod == STRIP)
+				strip = true;
+			s += strlen(MOD_EVT_IDS[mod]);
+			continue;
+		}
+
+		unsigned int idx = c64b_keyboard_head_to_idx(s);
+		if(idx == C64B_KB_IDX_NONE)
 			break;
+
+		s += strlen(KEY_IDS[idx].str);
+
+		if(KEY_IDS[idx].prnt)
+		{
+			keys[n++] = idx;
+		}
+		else if(strip)
+		{
+			for(const char* c = KEY_IDS[idx].str + 1; (*c != '~') && (n < max_keys); ++c)
+				if(ascii_to_idx[(uint8_t)*c] != C64B_KB_IDX_NONE)
+					keys[n++] = ascii_to_idx[(uint8_t)*c];
 		}
+		strip = false;
 	}
+	return n;
+}
+
+//----------------------------------------------------------------------------//
+
+bool c64b_keyboard_feed_ops(t_c64b_keyboard *h, const t_c64b_kb_op* ops)
+{
+	if((h == NULL) || (ops == NULL))
+		return false;
+
+	feed.cancelled = false;
+
+	// a cancelled stream stops posting, the events already queued are
+	// dropped by the engine
+	for(; (ops->code != C64B_OP_END) && !feed.cancel; ++ops)
+		c64b_keyboard_feed_post(h, ops->code, ops->arg);
 
 	c64b_keyboard_keys_rel(h, true);
 	c64b_keyboard_mods_rel(h);
-	return !error;
+
+	// the caller owns the keyboard until the whole stream has been played
+	c64b_keyboard_feed_sync(h);
+	return !feed.cancelled;
+}
+
+//----------------------------------------------------------------------------//
+
+bool c64b_keyboard_feed_macro(t_c64b_keyboard *h, t_c64b_macro* m)
+{
+	if((h == NULL) || (m == NULL))
+		return false;
+
+	if(m->ops == NULL)
+	{
+		size_t len = c64b_keyboard_compile(m->str, NULL, 0);
+		if(len == 0)
+		{
+			loge("keyboard: malformed macro \"%s\"\n", m->str);
+			return false;
+		}
+
+		m->ops = malloc(len * sizeof(t_c64b_kb_op));
+		if(m->ops == NULL)
+			return false;
+
+		c64b_keyboard_compile(m->str, m->ops, len);
+	}
+
+	return c64b_keyboard_feed_ops(h, m->ops);
+}
+
+//----------------------------------------------------------------------------//
+
+bool c64b_keyboard_feed_str(t_c64b_keyboard *h, const char* s)
+{
+	if((h == NULL) || (s == NULL))
+		return false;
+
+	// dynamic strings are compiled once per feed
+	t_c64b_macro m  = C64B_MACRO(s);
+	bool         ok = c64b_keyboard_feed_macro(h, &m);
+
+	free(m.ops);
+	return ok;
 }
 
 //----------------------------------------------------------------------------//
@@ -644,19 +1694,52 @@ void c64b_keyboard_reset(t_c64b_keyboard *h)
 		gpio_set_level(h->pin_row[i], 0);
 	}
 
-	gpio_set_level(h->pin_kben, 0);
+	// pending events are dropped, the lines are then cleared directly
+	c64b_keyboard_feed_flush(h);
+
+	gpio_set_level(h->pin_kben, 1);
 	gpio_set_level(h->pin_ctrl, 0);
 	gpio_set_level(h->pin_shft, 0);
 	gpio_set_level(h->pin_cmdr, 0);
 
-	if (h->pin_nrst != 255)
-		gpio_set_level(h->pin_nrst, 0);
-
-	c64b_keyboard_keys_rel(h, true);
-	c64b_keyboard_mods_rel(h);
 	c64b_keyboard_rest_rel(h);
 }
 
+//----------------------------------------------------------------------------//
+// The KERNAL scans the keyboard from the 60Hz CIA interrupt on both PAL and
+// NTSC machines, while games usually read the matrix once per frame. A key
+// is held for one period plus a margin for the scan itself and for delayed
+// interrupts. The release gap is only kept where it is needed, see
+// C64B_REL_OVLP. The PAL timing also suits NTSC machines, only slower. The
+// safe profile keeps the original timing with a gap after every key.
+
+typedef struct
+{
+	unsigned int psh_us;
+	unsigned int rel_us;
+	bool         ovlp;
+} t_c64b_pace_profile;
+
+static const t_c64b_pace_profile PACE_PROFILES[C64B_PACE_NUM] =
+{
+	[C64B_PACE_PAL]  = {.psh_us = 24000, .rel_us = 24000, .ovlp = true },
+	[C64B_PACE_NTSC] = {.psh_us = 20000, .rel_us = 20000, .ovlp = true },
+	[C64B_PACE_SAFE] = {.psh_us = 30000, .rel_us = 30000, .ovlp = false}
+};
+
+void c64b_keyboard_pace_set(t_c64b_keyboard *h, t_c64b_pace pace)
+{
+	if(h == NULL)
+		return;
+
+	if(pace >= C64B_PACE_NUM)
+		pace = C64B_PACE_PAL;
+
+	h->feed_psh_us = PACE_PROFILES[pace].psh_us;
+	h->feed_rel_us = PACE_PROFILES[pace].rel_us;
+	h->feed_ovlp   = PACE_PROFILES[pace].ovlp;
+}
+
 //----------------------------------------------------------------------------//
 
 void c64b_keyboard_trace_reset(t_c64b_keyboard *h)
@@ -680,6 +1763,12 @@ void c64b_keyboard_init(t_c64b_keyboard *h)
 	if(h == NULL)
 		return;
 
+	c64b_keyboard_masks_init(h);
+
+	logi("Initialising Feed Engine\n");
+	if(!c64b_keyboard_feed_init(h))
+		loge("Error: unable to initialise the feed engine\n");
+
 	logi("Clearing Keyboard\n");
 	c64b_keyboard_reset(h);
 
@@ -719,5 +1808,10 @@ void c64b_keyboard_init(t_c64b_keyboard *h)
 	gpio_set_direction(h->pin_shft, GPIO_MODE_OUTPUT);
 	gpio_set_direction(h->pin_cmdr, GPIO_MODE_OUTPUT);
 
+	logi("Initialising Autofire\n");
+	if(!c64b_keyboard_afire_init(h))
+		loge("Error: unable to initialise autofire\n");
+
 	c64b_keyboard_trace_reset(h);
+	c64b_keyboard_ascii_init();
 }
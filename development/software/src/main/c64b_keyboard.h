@@ -27,6 +27,7 @@
 #define C64B_KEYBOARD_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
 
@@ -35,6 +36,9 @@
 
 #define NUM_KEYS         114
 #define C64B_KB_IDX_NONE NUM_KEYS
+#define C64B_KB_IDX_SCAN (NUM_KEYS + 1)
+
+#define C64B_SCAN_MAX    8
 
 typedef struct
 {
@@ -58,11 +62,18 @@ typedef struct
 	unsigned int         pin_shft;
 	unsigned int         pin_cmdr;
 	unsigned int         pin_kben;
-	unsigned int         feed_psh_ms;
-	unsigned int         feed_rel_ms;
+	unsigned int         feed_psh_us;
+	unsigned int         feed_rel_us;
+	bool                 feed_ovlp;
 	const uint8_t*       col_perm;
 	const uint8_t*       row_perm;
 	const t_c64b_key_id* trace_key;
+	uint32_t             live_keys;   // keys pressed outside of macros
+	// output register masks, built by c64b_keyboard_init()
+	uint64_t             mask_key_set[NUM_KEYS];
+	uint64_t             mask_key_clr[NUM_KEYS];
+	uint64_t             mask_kben;
+	uint64_t             mask_cport[2][C64B_CTL_BITS];
 } t_c64b_keyboard;
 
 
@@ -76,11 +87,61 @@ typedef enum
 }t_c64b_cport_key;
 
 
+// feed pacing profiles, see c64b_keyboard_pace_set()
+typedef enum
+{
+	C64B_PACE_PAL = 0,
+	C64B_PACE_NTSC,
+	C64B_PACE_SAFE,
+	C64B_PACE_NUM
+} t_c64b_pace;
+
+
 typedef unsigned int t_c64b_cport_idx;
 #define CPORT_NONE 0
 #define CPORT_1    1
 #define CPORT_2    2
 
+#define CPORT_MASK(k) (1 << (k))
+
+//----------------------------------------------------------------------------//
+// Compiled macros: strings are translated once into a stream of keyboard line
+// events, so that feeding them no longer involves any string lookup
+
+typedef enum
+{
+	C64B_OP_END = 0,
+	C64B_OP_KEY_PSH,  // arg: key index, sets the mux and holds it for feed_psh_us
+	C64B_OP_KEY_REL,  // arg: C64B_REL_* flags, clears the mux and waits feed_rel_us
+	C64B_OP_SHFT_PSH,
+	C64B_OP_SHFT_REL,
+	C64B_OP_CTRL_PSH,
+	C64B_OP_CTRL_REL,
+	C64B_OP_CMDR_PSH,
+	C64B_OP_CMDR_REL,
+	C64B_OP_KEY_SCN,  // internal to the feed engine, starts cycling the held keys
+	C64B_OP_SYNC,     // internal to the feed engine, wakes up the waiting task
+	C64B_OP_MARK      // internal to the feed engine, arg: device probed by the next key press
+} t_c64b_op_code;
+
+#define C64B_REL_SHFT 1 // the shift line is released too
+#define C64B_REL_OVLP 2 // a different key follows with the same shift state
+
+typedef struct
+{
+	uint8_t code;
+	uint8_t arg;
+} t_c64b_kb_op;
+
+// constant macros are compiled on first use and keep their op stream
+typedef struct
+{
+	const char*   str;
+	t_c64b_kb_op* ops;
+} t_c64b_macro;
+
+#define C64B_MACRO(s) {.str = (s), .ops = NULL}
+
 extern const t_c64b_key_id KEY_IDS[];
 //extern const unsigned int NUM_KEYS;
 
@@ -89,9 +150,15 @@ extern const t_c64b_key_id KEY_IDS[];
 
 void c64b_keyboard_init(t_c64b_keyboard *h);
 void c64b_keyboard_reset(t_c64b_keyboard *h);
+void c64b_keyboard_pace_set(t_c64b_keyboard *h, t_c64b_pace pace);
 
 void c64b_keyboard_cport_psh(t_c64b_keyboard *h, t_c64b_cport_key key, t_c64b_cport_idx idx);
 void c64b_keyboard_cport_rel(t_c64b_keyboard *h, t_c64b_cport_key key, t_c64b_cport_idx idx);
+void c64b_keyboard_cport_set(t_c64b_keyboard *h, uint8_t mask, t_c64b_cport_idx idx);
+
+void c64b_keyboard_afire_cfg(t_c64b_keyboard *h, uint32_t period_us, unsigned int duty_pct);
+void c64b_keyboard_afire_psh(t_c64b_keyboard *h, t_c64b_cport_idx idx);
+void c64b_keyboard_afire_rel(t_c64b_keyboard *h, t_c64b_cport_idx idx);
 
 void c64b_keyboard_rest_psh(t_c64b_keyboard *h);
 void c64b_keyboard_rest_rel(t_c64b_keyboard *h);
@@ -109,16 +176,26 @@ bool c64b_keyboard_key_psh(t_c64b_keyboard *h, const t_c64b_key_id *k);
 bool c64b_keyboard_key_rel(t_c64b_keyboard *h, const t_c64b_key_id *k);
 
 void c64b_keyboard_keys_rel(t_c64b_keyboard *h, bool rel_shft);
+bool c64b_keyboard_keys_scan(t_c64b_keyboard *h, const uint8_t* idx, unsigned int num, unsigned int slot_us);
 void c64b_keyboard_mods_rel(t_c64b_keyboard *h);
 
 bool c64b_keyboard_char_psh(t_c64b_keyboard *h, const char *s);
 bool c64b_keyboard_char_rel(t_c64b_keyboard *h, const char *s);
 
-bool c64b_keyboard_feed_str(t_c64b_keyboard *h, char* s);
+size_t c64b_keyboard_compile(const char* s, t_c64b_kb_op* ops, size_t max_ops);
+size_t c64b_keyboard_screen_keys(const char* s, uint8_t* keys, size_t max_keys);
+
+void c64b_keyboard_feed_sync(t_c64b_keyboard *h);
+void c64b_keyboard_feed_cancel(t_c64b_keyboard *h, bool cancel);
+
+bool c64b_keyboard_feed_ops(t_c64b_keyboard *h, const t_c64b_kb_op* ops);
+bool c64b_keyboard_feed_macro(t_c64b_keyboard *h, t_c64b_macro* m);
+bool c64b_keyboard_feed_str(t_c64b_keyboard *h, const char* s);
 bool c64b_keyboard_feed_prg(t_c64b_keyboard *h, char** s, uint32_t nlines);
 
 unsigned int c64b_keyboard_key_to_idx(const char* s);
 const char*  c64b_keyboard_idx_to_key(unsigned int i);
+const char*  c64b_keyboard_text_key(uint8_t c, char* buf);
 
 void                 c64b_keyboard_trace_reset(t_c64b_keyboard *h);
 const t_c64b_key_id* c64b_keyboard_trace_get(t_c64b_keyboard *h);
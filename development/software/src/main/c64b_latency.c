@@ -0,0 +1,236 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+#include <uni.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+#include "c64b_latency.h"
+
+//----------------------------------------------------------------------------//
+// every histogram has a single writer: the keyboard matrix is only driven by
+// the feed engine and the joystick lines only by the parser task. Readers may
+// see a sample being added, which is irrelevant for statistics
+
+typedef struct
+{
+	uint32_t bucket[LAT_BUCKETS];
+	uint32_t count;
+	uint32_t max_us;
+} t_c64b_lat_hist;
+
+// one stamp per device, a report of a device never overwrites the time of
+// another one still being parsed
+typedef struct
+{
+	TaskHandle_t task;
+	uint32_t     t_us;
+} t_c64b_lat_stamp;
+
+static t_c64b_lat_hist  hist[LAT_DEV_NUM][LAT_PATH_NUM];
+static t_c64b_lat_stamp stamp[LAT_DEV_NUM];
+
+static const char* LAT_DEV_IDS[LAT_DEV_NUM]   = {"kbd", "gp1", "gp2"};
+static const char* LAT_PATH_IDS[LAT_PATH_NUM] = {"joy", "key"};
+
+//----------------------------------------------------------------------------//
+
+static unsigned int c64b_latency_bucket(uint32_t us)
+{
+	if(us < 8)
+		return us;
+
+	unsigned int msb = 31 - __builtin_clz(us);
+	unsigned int b   = (msb - 2) * 8 + ((us >> (msb - 3)) & 7);
+
+	return (b < LAT_BUCKETS) ? b : (LAT_BUCKETS - 1);
+}
+
+//----------------------------------------------------------------------------//
+// first value above the bucket
+
+static uint32_t c64b_latency_bucket_top(unsigned int b)
+{
+	if(b < 8)
+		return b + 1;
+
+	unsigned int msb = b / 8 + 2;
+	return (uint32_t)(8 + (b & 7) + 1) << (msb - 3);
+}
+
+//----------------------------------------------------------------------------//
+// the parser marks the report being processed, so that any edge it causes,
+// directly or through the feed engine, can be attributed to it
+
+void c64b_latency_begin(unsigned int dev, uint32_t t_us)
+{
+	if(dev >= LAT_DEV_NUM)
+		return;
+
+	stamp[dev].t_us = t_us;
+	stamp[dev].task = xTaskGetCurrentTaskHandle();
+}
+
+//----------------------------------------------------------------------------//
+
+void c64b_latency_end(unsigned int dev)
+{
+	if(dev < LAT_DEV_NUM)
+		stamp[dev].task = NULL;
+}
+
+//----------------------------------------------------------------------------//
+// only the task that opened the probe sees it, macros typed by other tasks
+// while a report is being parsed are not measured
+
+bool c64b_latency_current(unsigned int* dev, uint32_t* t_us)
+{
+	TaskHandle_t task = xTaskGetCurrentTaskHandle();
+
+	for(unsigned int d = 0; d < LAT_DEV_NUM; ++d)
+	{
+		if(stamp[d].task != task)
+			continue;
+
+		*dev  = d;
+		*t_us = stamp[d].t_us;
+		return true;
+	}
+
+	return false;
+}
+
+//----------------------------------------------------------------------------//
+
+void c64b_latency_edge(t_c64b_lat_path path)
+{
+	unsigned int dev;
+	uint32_t     t_us;
+
+	if(c64b_latency_current(&dev, &t_us))
+		c64b_latency_add(dev, path, t_us);
+}
+
+//----------------------------------------------------------------------------//
+// t_us is the time of the report, the edge is the time of the call: the feed
+// engine calls this from its callback as soon as the lines are driven
+
+void c64b_latency_add(unsigned int dev, t_c64b_lat_path path, uint32_t t_us)
+{
+	if((dev >= LAT_DEV_NUM) || (path >= LAT_PATH_NUM))
+		return;
+
+	t_c64b_lat_hist* hs = &(hist[dev][path]);
+	uint32_t         us = (uint32_t)esp_timer_get_time() - t_us;
+
+	hs->bucket[c64b_latency_bucket(us)]++;
+	hs->count++;
+
+	if(us > hs->max_us)
+		hs->max_us = us;
+}
+
+//----------------------------------------------------------------------------//
+
+static uint32_t c64b_latency_pct(const t_c64b_lat_hist* hs, unsigned int pct)
+{
+	uint32_t rank = (uint32_t)(((uint64_t)hs->count * pct + 99) / 100);
+	uint32_t sum  = 0;
+
+	for(unsigned int b = 0; b < LAT_BUCKETS; ++b)
+	{
+		sum += hs->bucket[b];
+		if(sum >= rank)
+		{
+			uint32_t top = c64b_latency_bucket_top(b);
+			return (top < hs->max_us) ? top : hs->max_us;
+		}
+	}
+
+	return hs->max_us;
+}
+
+//----------------------------------------------------------------------------//
+
+bool c64b_latency_get(unsigned int dev, t_c64b_lat_path path, t_c64b_lat_stats* s)
+{
+	if((dev >= LAT_DEV_NUM) || (path >= LAT_PATH_NUM) || (s == NULL))
+		return false;
+
+	const t_c64b_lat_hist* hs = &(hist[dev][path]);
+
+	s->count  = hs->count;
+	s->max_us = hs->max_us;
+	s->p50_us = c64b_latency_pct(hs, 50);
+	s->p99_us = c64b_latency_pct(hs, 99);
+
+	return s->count != 0;
+}
+
+//----------------------------------------------------------------------------//
+// short labels used by the reports, "?" out of range
+
+void c64b_latency_name(unsigned int dev, t_c64b_lat_path path, const char** dev_id, const char** path_id)
+{
+	*dev_id  = (dev < LAT_DEV_NUM)   ? LAT_DEV_IDS[dev]   : "?";
+	*path_id = (path < LAT_PATH_NUM) ? LAT_PATH_IDS[path] : "?";
+}
+
+//----------------------------------------------------------------------------//
+// the run time of every task is printed too when the firmware is built with
+// CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS, which shows the load of the parser
+// next to the latency it achieves
+
+void c64b_latency_dump(void)
+{
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+	static char stats[1024];
+
+	vTaskGetRunTimeStats(stats);
+	logi("latency: task run time\n%s", stats);
+#endif
+
+	for(unsigned int d = 0; d < LAT_DEV_NUM; ++d)
+	{
+		for(unsigned int p = 0; p < LAT_PATH_NUM; ++p)
+		{
+			t_c64b_lat_stats s;
+			if(!c64b_latency_get(d, p, &s))
+				continue;
+
+			logi("latency: %s %s: n %lu, p50 %lu us, p99 %lu us, max %lu us\n",
+			     LAT_DEV_IDS[d], LAT_PATH_IDS[p], (unsigned long)s.count,
+			     (unsigned long)s.p50_us, (unsigned long)s.p99_us, (unsigned long)s.max_us);
+
+			const t_c64b_lat_hist* hs = &(hist[d][p]);
+			for(unsigned int b = 0; b < LAT_BUCKETS; ++b)
+				if(hs->bucket[b] != 0)
+					logi("latency:   < %lu us: %lu\n",
+					     (unsigned long)c64b_latency_bucket_top(b), (unsigned long)hs->bucket[b]);
+		}
+	}
+}
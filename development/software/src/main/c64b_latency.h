@@ -0,0 +1,70 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+#ifndef C64B_LATENCY_H
+#define C64B_LATENCY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//----------------------------------------------------------------------------//
+// Input latency probes: the time from the moment bluepad32 delivers a report
+// to the moment the resulting edge reaches the C64 lines is collected in one
+// histogram per device and per path. Buckets are log-linear, 8 per octave,
+// which keeps the error of the percentiles below 12.5%
+
+#define LAT_DEV_NUM  3   // same indexing as the parser devices
+#define LAT_BUCKETS  144 // up to about one second
+
+typedef enum
+{
+	LAT_PATH_CPORT = 0, // joystick lines, written by the parser
+	LAT_PATH_KEYS,      // keyboard matrix, written by the feed engine
+	LAT_PATH_NUM
+} t_c64b_lat_path;
+
+typedef struct
+{
+	uint32_t count;
+	uint32_t p50_us;
+	uint32_t p99_us;
+	uint32_t max_us;
+} t_c64b_lat_stats;
+
+//----------------------------------------------------------------------------//
+
+void c64b_latency_begin  (unsigned int dev, uint32_t t_us);
+void c64b_latency_end    (unsigned int dev);
+bool c64b_latency_current(unsigned int* dev, uint32_t* t_us);
+
+void c64b_latency_edge   (t_c64b_lat_path path);
+void c64b_latency_add    (unsigned int dev, t_c64b_lat_path path, uint32_t t_us);
+
+bool c64b_latency_get    (unsigned int dev, t_c64b_lat_path path, t_c64b_lat_stats* s);
+void c64b_latency_dump   (void);
+
+void c64b_latency_name   (unsigned int dev, t_c64b_lat_path path, const char** dev_id, const char** path_id);
+
+#endif
@@ -26,6 +26,7 @@
 #include "c64b_macros.h"
 #include "c64b_parser.h"
 #include "c64b_threadsafe.h"
+#include "c64b_typein.h"
 
 //----------------------------------------------------------------------------//
 // static variables
@@ -41,9 +42,9 @@ static menu menu_current_ext;
 static unsigned int step     = 0;
 static unsigned int menu_lvl = 0;
 static unsigned int menu_idx[MENU_LVL_MAX] = {0, KB_MAP_SYMBOLIC, 0};
-static unsigned int last_len = 0;
 
 static char str_buf[128] = {0};
+static char lat_buf[448] = {0};
 
 //----------------------------------------------------------------------------//
 //                       FORWARD FUNCTION DECLARATIONS                        //
@@ -86,12 +87,12 @@ unsigned int menu_restore_plt(int i)
 {
 	static const char* entries[] =
 	{
-		"~home~~ret~0 no",
-		"~home~~ret~1 yes"
+		"0 no",
+		"1 yes"
 	};
 
 	WRAP(i, entries);
-	keyboard_macro_feed(entries[i]);
+	keyboard_macro_redraw(menu_restore_plt, 1, entries[i]);
 	return i;
 }
 
@@ -101,6 +102,8 @@ unsigned int menu_restore_act(int i)
 	{
 		c64b_property_reset();
 		c64b_property_init();
+		c64b_keyboard_pace_set(&keyboard, kb_pace);
+		c64b_parse_gamepad_afire_cfg();
 	}
 
 	menu_current_plt = menu_main_plt;
@@ -121,6 +124,49 @@ unsigned int menu_restore_ext(int i)
 	return 0;
 }
 
+//----------------------------------------------------------------------------//
+//                                TYPE-IN MENU                                //
+//----------------------------------------------------------------------------//
+
+unsigned int menu_typein_plt(int i)
+{
+	if(c64b_typein_num() == 0)
+	{
+		keyboard_macro_redraw(menu_typein_plt, 1, "0 no listings found");
+		return 0;
+	}
+
+	i = wrap(i, c64b_typein_num());
+	snprintf(str_buf, sizeof(str_buf), "%d %s", i, c64b_typein_label(i));
+	keyboard_macro_redraw(menu_typein_plt, 1, str_buf);
+	return i;
+}
+
+unsigned int menu_typein_act(int i)
+{
+	menu_current_plt = menu_main_plt;
+	menu_current_act = menu_main_act;
+	menu_current_ext = menu_main_ext;
+	menu_lvl--;
+
+	// the listing is typed on a cleared screen, the menu is not plotted back
+	if(i < c64b_typein_num())
+		keyboard_macro_stream(c64b_typein_feed, c64b_typein_name(i));
+	else
+		menu_current_plt(menu_idx[menu_lvl]);
+	return 0;
+}
+
+unsigned int menu_typein_ext(int i)
+{
+	menu_current_plt = menu_main_plt;
+	menu_current_act = menu_main_act;
+	menu_current_ext = menu_main_ext;
+	menu_lvl--;
+	menu_current_plt(menu_idx[menu_lvl]);
+	return 0;
+}
+
 //----------------------------------------------------------------------------//
 //                               AUTOFIRE MENU                                //
 //----------------------------------------------------------------------------//
@@ -129,21 +175,24 @@ unsigned int menu_af_plt(int i)
 {
 	static const char* entries[] =
 	{
-		"~home~~ret~0 none ",
-		"~home~~ret~1 1hz  ",
-		"~home~~ret~2 2hz  ",
-		"~home~~ret~3 3hz  ",
-		"~home~~ret~4 4hz  ",
-		"~home~~ret~5 5hz  ",
-		"~home~~ret~6 6hz  ",
-		"~home~~ret~7 7hz  ",
-		"~home~~ret~8 8hz  ",
-		"~home~~ret~9 9hz  ",
-		"~home~~ret~10 10hz",
+		"0 none",
+		"1 1hz",
+		"2 2hz",
+		"3 3hz",
+		"4 4hz",
+		"5 5hz",
+		"6 6hz",
+		"7 7hz",
+		"8 8hz",
+		"9 9hz",
+		"10 10hz",
+		"11 4 frames",
+		"12 3 frames",
+		"13 2 frames",
 	};
 
 	WRAP(i, entries);
-	keyboard_macro_feed(entries[i]);
+	keyboard_macro_redraw(menu_af_plt, 1, entries[i]);
 	return i;
 }
 
@@ -153,10 +202,7 @@ unsigned int menu_af_act(int i)
 	{
 		af_rate = i;
 		c64b_property_set_u8(C64B_PROPERTY_KEY_AF_RATE, i);
-
-		af_prd = (TickType_t)portMAX_DELAY;
-		if (af_rate != 0)
-			af_prd = (1000 / (TickType_t)af_rate) / portTICK_PERIOD_MS;
+		c64b_parse_gamepad_afire_cfg();
 	}
 
 	menu_current_plt = menu_main_plt;
@@ -185,16 +231,16 @@ unsigned int menu_bts_plt(int i)
 {
 	static const char* entries[] =
 	{
-		"~home~~ret~0 forever   ",
-		"~home~~ret~1 1 minute  ",
-		"~home~~ret~2 2 minutes ",
-		"~home~~ret~3 5 minutes ",
-		"~home~~ret~4 10 minutes",
-		"~home~~ret~5 30 minutes",
+		"0 forever",
+		"1 1 minute",
+		"2 2 minutes",
+		"3 5 minutes",
+		"4 10 minutes",
+		"5 30 minutes",
 	};
 
 	WRAP(i, entries);
-	keyboard_macro_feed(entries[i]);
+	keyboard_macro_redraw(menu_bts_plt, 1, entries[i]);
 	return i;
 }
 
@@ -224,6 +270,98 @@ unsigned int menu_bts_ext(int i)
 	return 0;
 }
 
+//----------------------------------------------------------------------------//
+//                            KEYBOARD ROLLOVER MENU                          //
+//----------------------------------------------------------------------------//
+
+unsigned int menu_roll_plt(int i)
+{
+	static const char* entries[] =
+	{
+		"0 off",
+		"1 1ms slots",
+		"2 2ms slots",
+		"3 5ms slots",
+		"4 20ms slots",
+	};
+
+	WRAP(i, entries);
+	keyboard_macro_redraw(menu_roll_plt, 1, entries[i]);
+	return i;
+}
+
+unsigned int menu_roll_act(int i)
+{
+	if (kb_roll != i)
+	{
+		kb_roll = i;
+		c64b_property_set_u8(C64B_PROPERTY_KEY_KB_ROLL, i);
+	}
+
+	menu_current_plt = menu_main_plt;
+	menu_current_act = menu_main_act;
+	menu_current_ext = menu_main_ext;
+	menu_lvl--;
+	menu_current_plt(menu_idx[menu_lvl]);
+	return 0;
+}
+
+unsigned int menu_roll_ext(int i)
+{
+	menu_current_plt = menu_main_plt;
+	menu_current_act = menu_main_act;
+	menu_current_ext = menu_main_ext;
+	menu_lvl--;
+	menu_current_plt(menu_idx[menu_lvl]);
+	return 0;
+}
+
+//----------------------------------------------------------------------------//
+//                             KEYBOARD PACING MENU                           //
+//----------------------------------------------------------------------------//
+
+unsigned int menu_pace_plt(int i)
+{
+	static const char* entries[] =
+	{
+		[C64B_PACE_PAL]  = "0 pal (50hz)",
+		[C64B_PACE_NTSC] = "1 ntsc (60hz)",
+		[C64B_PACE_SAFE] = "2 safe",
+	};
+
+	WRAP(i, entries);
+	keyboard_macro_redraw(menu_pace_plt, 1, entries[i]);
+	return i;
+}
+
+unsigned int menu_pace_act(int i)
+{
+	if (kb_pace != i)
+	{
+		kb_pace = i;
+		c64b_property_set_u8(C64B_PROPERTY_KEY_KB_PACE, i);
+		c64b_keyboard_pace_set(&keyboard, kb_pace);
+		c64b_parse_gamepad_afire_cfg(); // frame synced rates follow the pacing
+	}
+
+	menu_current_plt = menu_main_plt;
+	menu_current_act = menu_main_act;
+	menu_current_ext = menu_main_ext;
+	menu_lvl--;
+	menu_current_plt(menu_idx[menu_lvl]);
+	return 0;
+}
+
+unsigned int menu_pace_ext(int i)
+{
+	menu_current_plt = menu_main_plt;
+	menu_current_act = menu_main_act;
+	menu_current_ext = menu_main_ext;
+	menu_lvl--;
+	menu_current_plt(menu_idx[menu_lvl]);
+	return 0;
+}
+
 //----------------------------------------------------------------------------//
 //                      BLUETOOTH FORGET DEVICES MENU                         //
 //----------------------------------------------------------------------------//
@@ -232,12 +370,12 @@ unsigned int menu_btf_plt(int i)
 {
 	static const char* entries[] =
 	{
-		"~home~~ret~0 no",
-		"~home~~ret~1 yes"
+		"0 no",
+		"1 yes"
 	};
 
 	WRAP(i, entries);
-	keyboard_macro_feed(entries[i]);
+	keyboard_macro_redraw(menu_btf_plt, 1, entries[i]);
 	return i;
 }
 
@@ -274,12 +412,12 @@ unsigned int menu_kb_plt(int i)
 {
 	static const char* entries[] =
 	{
-		"~home~~ret~0 symbolic         ",
-		"~home~~ret~1 positional (vice)"
+		"0 symbolic",
+		"1 positional (vice)"
 	};
 
 	WRAP(i, entries);
-	keyboard_macro_feed(entries[i]);
+	keyboard_macro_redraw(menu_kb_plt, 1, entries[i]);
 	return i;
 }
 
@@ -312,62 +450,45 @@ unsigned int menu_kb_ext(int i)
 //                            CONTROLLER MAP MENU                             //
 //----------------------------------------------------------------------------//
 
-unsigned int menu_ct_plt(int i)
+// a row of the controller map menu, the button and the key mapped to it
+
+static unsigned int menu_ct_line(int i)
 {
 	static const char* entries[] =
 	{
-		"~home~~ret~2 home button   : ",
-		"~home~~ret~3 menu button   : ",
-		"~home~~ret~4 left trigger  : ",
-		"~home~~ret~5 right trigger : ",
-		"~home~~ret~6 left shoulder : ",
-		"~home~~ret~7 right shoulder: "
+		"2 home button   : ",
+		"3 menu button   : ",
+		"4 left trigger  : ",
+		"5 right trigger : ",
+		"6 left shoulder : ",
+		"7 right shoulder: "
 	};
 
 	WRAP(i, entries);
 
-	strcpy(str_buf, "");
-	for (unsigned int j = 0; j < last_len; ++j)
-		strcat(str_buf, "~del~");
-
-	strcat(str_buf, entries[i]);
+	strcpy(str_buf, entries[i]);
 	strcat(str_buf, "\"~strip~");
-	last_len = strlen(str_buf);
 	strcat(str_buf, c64b_keyboard_idx_to_key(ct_map[i]));
 	strcat(str_buf, "\"");
+	return i;
+}
 
-	if(KEY_IDS[i].prnt)
-	{
-		last_len = 2;
-	}
-	else
-	{
-		for (unsigned int j = last_len; str_buf[j] != 0; ++j)
-			if(str_buf[j] == '~')
-				last_len++;
-
-		last_len = strlen(str_buf) - last_len + 1; // including the extra quotes
-	}
-
-	keyboard_macro_feed(str_buf);
+unsigned int menu_ct_plt(int i)
+{
+	i = menu_ct_line(i);
+	keyboard_macro_redraw(menu_ct_plt, 1, str_buf);
 	return i;
 }
 
 unsigned int menu_ct_act(int i)
 {
-	strcpy(str_buf, " -> ");
-
 	menu_current_plt = menu_key_plt;
 	menu_current_act = menu_key_act;
 	menu_current_ext = menu_key_ext;
-	last_len         = 0;
 	menu_lvl++;
 	menu_idx[menu_lvl] = C64B_KB_IDX_NONE;
 
-	keyboard_macro_feed(str_buf);
-
-	if(xSemaphoreTake(mcro_sem_h, (TickType_t)portMAX_DELAY) == true)
-		menu_current_plt(menu_idx[menu_lvl]);
+	menu_current_plt(menu_idx[menu_lvl]);
 
 	return i;
 }
@@ -377,7 +498,6 @@ unsigned int menu_ct_ext(int i)
 	menu_current_plt = menu_main_plt;
 	menu_current_act = menu_main_act;
 	menu_current_ext = menu_main_ext;
-	last_len         = 0;
 	menu_lvl--;
 	menu_current_plt(menu_idx[menu_lvl]);
 	return 0;
@@ -391,38 +511,19 @@ unsigned int menu_key_plt(int i)
 {
 	i = wrap(i, NUM_KEYS + 1);
 
-	strcpy(str_buf, "");
-	for (unsigned int j = 0; j < last_len; ++j)
-		strcat(str_buf, "~del~");
+	menu_ct_line(menu_idx[menu_lvl-1]);
+	strcat(str_buf, " -> ");
 
-	if(i == C64B_KB_IDX_NONE)
-	{
-		last_len = 0;
-	}
-	else
+	if(i != C64B_KB_IDX_NONE)
 	{
 		strcat(str_buf, "\"~strip~");
-		last_len = strlen(str_buf);
 		strcat(str_buf, c64b_keyboard_idx_to_key(i));
 		strcat(str_buf, "\"");
-
-		if(KEY_IDS[i].prnt)
-		{
-			last_len = 3;
-		}
-		else
-		{
-			for (unsigned int j = last_len; str_buf[j] != 0; ++j)
-				if(str_buf[j] == '~')
-					last_len++;
-
-			last_len = strlen(str_buf) - last_len + 1; // including extra quotes
-		}
 	}
 
 	logi("printing string: %s\n", str_buf);
 
-	keyboard_macro_feed(str_buf);
+	keyboard_macro_redraw(menu_key_plt, 1, str_buf);
 	return i;
 }
 
@@ -453,7 +554,6 @@ unsigned int menu_key_act(int i)
 	menu_current_plt = menu_ct_plt;
 	menu_current_act = menu_ct_act;
 	menu_current_ext = menu_ct_ext;
-	last_len         = last_len + 10; // deleting the arrow character and the original character
 	menu_lvl--;
 	menu_current_plt(menu_idx[menu_lvl]);
 	return 0;
@@ -464,34 +564,80 @@ unsigned int menu_key_ext(int i)
 	menu_current_plt = menu_ct_plt;
 	menu_current_act = menu_ct_act;
 	menu_current_ext = menu_ct_ext;
-	last_len         = last_len + 10; // deleting the arrow character and the original character
 	menu_lvl--;
 	menu_current_plt(menu_idx[menu_lvl]);
 	return 0;
 }
 
 //----------------------------------------------------------------------------//
-//                                  MAIN MENU                                 //
+//                               LATENCY REPORT                               //
 //----------------------------------------------------------------------------//
 
-unsigned int menu_main_plt(int i)
+static void menu_lat_print(char* buf, size_t len)
 {
-	static const char* entries[] =
+	size_t n = snprintf(buf, len, "~clr~0 input latency ms p50/p99/max:");
+
+	for(unsigned int d = 0; d < LAT_DEV_NUM; ++d)
 	{
-		"~clr~0 load tape",
-		"~clr~1 load disk",
-		"~clr~2 run disk",
-		"~clr~3 device info",
-		"~clr~4 keyboard mapping",
-		"~clr~5 controller mapping (xbox)",
-		"~clr~6 autofire rate",
-		"~clr~7 bluetooth scan time",
-		"~clr~8 bluetooth forget devices",
-		"~clr~9 restore defaults"
-	};
+		for(unsigned int p = 0; p < LAT_PATH_NUM; ++p)
+		{
+			t_c64b_lat_stats st;
+			const char*      dev_id;
+			const char*      path_id;
 
-	WRAP(i, entries);
-	keyboard_macro_feed(entries[i]);
+			if(!c64b_latency_get(d, p, &st) || (n >= len))
+				continue;
+
+			c64b_latency_name(d, p, &dev_id, &path_id);
+
+			n += snprintf(buf + n, len - n, "~ret~0 %s %s %lu.%lu/%lu.%lu/%lu.%lu n%lu",
+			              dev_id, path_id,
+			              (unsigned long)(st.p50_us / 1000), (unsigned long)((st.p50_us % 1000) / 100),
+			              (unsigned long)(st.p99_us / 1000), (unsigned long)((st.p99_us % 1000) / 100),
+			              (unsigned long)(st.max_us / 1000), (unsigned long)((st.max_us % 1000) / 100),
+			              (unsigned long)st.count);
+		}
+	}
+
+	// inputs that found the keyboard taken and were applied later
+	if(n < len)
+		n += snprintf(buf + n, len - n, "~ret~0 deferred kbd %lu p1 %lu p2 %lu mac %lu",
+		              (unsigned long)kb_defer_cnt[KB_OWNER_KBRD], (unsigned long)kb_defer_cnt[KB_OWNER_CTL1],
+		              (unsigned long)kb_defer_cnt[KB_OWNER_CTL2], (unsigned long)kb_defer_cnt[KB_OWNER_FEED]);
+
+	// reports that found their ring full, merged on the gamepads
+	if(n < len)
+		snprintf(buf + n, len - n, "~ret~0 full kbd %lu p1 %lu p2 %lu",
+		         (unsigned long)input_ring[0].drops, (unsigned long)input_ring[1].drops,
+		         (unsigned long)input_ring[2].drops);
+}
+
+//----------------------------------------------------------------------------//
+//                                  MAIN MENU                                 //
+//----------------------------------------------------------------------------//
+
+static const char* main_entries[] =
+{
+	"0 load tape",
+	"1 load disk",
+	"2 run disk",
+	"3 device info",
+	"4 keyboard mapping",
+	"5 controller mapping (xbox)",
+	"6 autofire rate",
+	"7 bluetooth scan time",
+	"8 bluetooth forget devices",
+	"9 keyboard rollover",
+	"10 keyboard pacing",
+	"11 input latency",
+	"12 type-in from sd",
+	"13 restore defaults"
+};
+
+unsigned int menu_main_plt(int i)
+{
+	WRAP(i, main_entries);
+	keyboard_macro_redraw(menu_main_plt, 0, main_entries[i]);
 	return i;
 }
 
@@ -503,20 +649,29 @@ unsigned int menu_main_act(int i)
 		"0 blue-64 by side-projects-lab~ret~"
 		"0 firmware version: "C64B_FW_VERSION;
 
-	static const char* entries[] =
+	static t_c64b_macro entries[] =
 	{
-		"~clr~load~ret~",
-		"~clr~load \"$\",8~ret~",
-		"~clr~load \"*\",8~ret~",
-		device_info,
-		":",
-		":",
-		":",
-		":",
-		"?"
+		C64B_MACRO("~clr~load~ret~"),
+		C64B_MACRO("~clr~load \"$\",8~ret~"),
+		C64B_MACRO("~clr~load \"*\",8~ret~"),
+		C64B_MACRO(device_info)
 	};
 
-	keyboard_macro_feed(entries[i]);
+	// entering a submenu marks the main menu entry
+	static const char* marks[] =
+	{
+		NULL, NULL, NULL, NULL, ":", ":", ":", ":", "?", ":", ":", NULL, ":", "?"
+	};
+
+	if(i < sizeof(entries) / sizeof(entries[0]))
+	{
+		keyboard_macro_feed_macro(&entries[i]);
+	}
+	else if(marks[i] != NULL)
+	{
+		snprintf(str_buf, sizeof(str_buf), "%s%s", main_entries[i], marks[i]);
+		keyboard_macro_redraw(menu_main_plt, 0, str_buf);
+	}
 
 	switch(i)
 	{
@@ -527,20 +682,17 @@ unsigned int menu_main_act(int i)
 			menu_lvl++;
 			menu_idx[menu_lvl] = kb_map;
 
-			if(xSemaphoreTake(mcro_sem_h, (TickType_t)portMAX_DELAY) == true)
-				menu_current_plt(menu_idx[menu_lvl]);
+			menu_current_plt(menu_idx[menu_lvl]);
 			break;
 
 		case 5:
 			menu_current_plt = menu_ct_plt;
 			menu_current_act = menu_ct_act;
 			menu_current_ext = menu_ct_ext;
-			last_len         = 0;
 			menu_lvl++;
 			menu_idx[menu_lvl] = 0;
 
-			if(xSemaphoreTake(mcro_sem_h, (TickType_t)portMAX_DELAY) == true)
-				menu_current_plt(menu_idx[menu_lvl]);
+			menu_current_plt(menu_idx[menu_lvl]);
 			break;
 
 		case 6:
@@ -550,8 +702,7 @@ unsigned int menu_main_act(int i)
 			menu_lvl++;
 			menu_idx[menu_lvl] = af_rate;
 
-			if(xSemaphoreTake(mcro_sem_h, (TickType_t)portMAX_DELAY) == true)
-				menu_current_plt(menu_idx[menu_lvl]);
+			menu_current_plt(menu_idx[menu_lvl]);
 			break;
 
 		case 7:
@@ -561,8 +712,7 @@ unsigned int menu_main_act(int i)
 			menu_lvl++;
 			menu_idx[menu_lvl] = scan_time;
 
-			if(xSemaphoreTake(mcro_sem_h, (TickType_t)portMAX_DELAY) == true)
-				menu_current_plt(menu_idx[menu_lvl]);
+			menu_current_plt(menu_idx[menu_lvl]);
 			break;
 
 		case 8:
@@ -572,19 +722,60 @@ unsigned int menu_main_act(int i)
 			menu_lvl++;
 			menu_idx[menu_lvl] = 0;
 
-			if(xSemaphoreTake(mcro_sem_h, (TickType_t)portMAX_DELAY) == true)
-				menu_current_plt(menu_idx[menu_lvl]);
+			menu_current_plt(menu_idx[menu_lvl]);
 			break;
 
 		case 9:
+			menu_current_plt = menu_roll_plt;
+			menu_current_act = menu_roll_act;
+			menu_current_ext = menu_roll_ext;
+			menu_lvl++;
+			menu_idx[menu_lvl] = kb_roll;
+
+			menu_current_plt(menu_idx[menu_lvl]);
+			break;
+
+		case 10:
+			menu_current_plt = menu_pace_plt;
+			menu_current_act = menu_pace_act;
+			menu_current_ext = menu_pace_ext;
+			menu_lvl++;
+			menu_idx[menu_lvl] = kb_pace;
+
+			menu_current_plt(menu_idx[menu_lvl]);
+			break;
+
+		case 11:
+			c64b_latency_dump();
+			logi("latency: deferred keyboard %lu, port 1 %lu, port 2 %lu, macros %lu\n",
+			     (unsigned long)kb_defer_cnt[KB_OWNER_KBRD], (unsigned long)kb_defer_cnt[KB_OWNER_CTL1],
+			     (unsigned long)kb_defer_cnt[KB_OWNER_CTL2], (unsigned long)kb_defer_cnt[KB_OWNER_FEED]);
+			logi("latency: ring full keyboard %lu, port 1 %lu, port 2 %lu\n",
+			     (unsigned long)input_ring[0].drops, (unsigned long)input_ring[1].drops,
+			     (unsigned long)input_ring[2].drops);
+			menu_lat_print(lat_buf, sizeof(lat_buf));
+
+			keyboard_macro_feed(lat_buf);
+			break;
+
+		case 12:
+			menu_current_plt = menu_typein_plt;
+			menu_current_act = menu_typein_act;
+			menu_current_ext = menu_typein_ext;
+			menu_lvl++;
+			menu_idx[menu_lvl] = 0;
+
+			menu_current_plt(menu_idx[menu_lvl]);
+			break;
+
+		case 13:
 			menu_current_plt = menu_restore_plt;
 			menu_current_act = menu_restore_act;
 			menu_current_ext = menu_restore_ext;
 			menu_lvl++;
 			menu_idx[menu_lvl] = 0;
 
-			if(xSemaphoreTake(mcro_sem_h, (TickType_t)portMAX_DELAY) == true)
-				menu_current_plt(menu_idx[menu_lvl]);
+			menu_current_plt(menu_idx[menu_lvl]);
 			break;
 		default:
 	}
@@ -593,7 +784,9 @@ unsigned int menu_main_act(int i)
 
 unsigned int menu_main_ext(int i)
 {
-	keyboard_macro_feed("~clr~");
+	static t_c64b_macro clr = C64B_MACRO("~clr~");
+
+	keyboard_macro_feed_macro(&clr);
 	menu_idx[0] = 0;
 	step = 0;
 	return i;
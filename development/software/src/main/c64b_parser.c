@@ -25,27 +25,93 @@
 
 #include "c64b_parser.h"
 #include "c64b_update.h"
+#include "c64b_sdcard.h"
+#include "c64b_typein.h"
 #include "esp_task_wdt.h"
+#include "esp_timer.h"
 
 extern bool c64b_parse_keyboard_menu (uni_keyboard_t* kb, uni_keyboard_t* kb_old);
 extern bool c64b_parse_keyboard_keys (uni_keyboard_t* kb, uni_keyboard_t* kb_old);
-extern bool c64b_parse_gamepad_menu  (uni_gamepad_t*  gp, uni_gamepad_t*  gp_old);
-extern bool c64b_parse_gamepad_swap  (uni_gamepad_t*  gp, uni_gamepad_t*  gp_old);
-extern bool c64b_parse_gamepad_kbemu (uni_gamepad_t*  gp, uni_gamepad_t*  gp_old, t_c64b_cport_idx cport_idx);
-extern bool c64b_parse_gamepad_ctrl  (uni_gamepad_t*  gp, uni_gamepad_t*  gp_old, t_c64b_cport_idx cport_idx);
+extern bool c64b_parse_gamepad_menu  (t_c64b_gp_state* gp, t_c64b_gp_state* gp_old);
+extern bool c64b_parse_gamepad_swap  (t_c64b_gp_state* gp, t_c64b_gp_state* gp_old);
+extern bool c64b_parse_gamepad_kbemu (t_c64b_gp_state* gp, t_c64b_gp_state* gp_old, t_c64b_cport_idx cport_idx);
+extern bool c64b_parse_gamepad_ctrl  (t_c64b_gp_state* gp, t_c64b_gp_state* gp_old, t_c64b_cport_idx cport_idx);
 extern void c64b_parse_gamepad_init  ();
-extern bool c64b_gamepad_interesting (uni_gamepad_t* gp, uni_gamepad_t* gp_old);
+extern void c64b_parse_keyboard_init ();
+extern bool c64b_gamepad_interesting (t_c64b_gp_state* gp, t_c64b_gp_state* gp_old);
+extern void c64b_gamepad_pack        (const uni_gamepad_t* gp, t_c64b_gp_state* st, const t_c64b_gp_state* prev);
+
+#define FEED_WAIT_MS 2000
+
+// macro jobs, see keyboard_macro_post()
+#define MCRO_JOBS    4
+#define MCRO_STR_LEN 448
+
+typedef struct
+{
+	t_c64b_macro*      mcro;     // constant macro, NULL when the job carries a string
+	const void*        tag;      // menu being redrawn, NULL for plain macros
+	unsigned int       row;      // screen row set by a redraw, SCR_ROWS for macros
+	bool               anchored; // redraw typed from a cleared screen
+	t_c64b_mcro_stream stream;   // feeds its own text, str is its argument
+	char               str[MCRO_STR_LEN];
+} t_c64b_mcro_job;
 
 //----------------------------------------------------------------------------//
 // Static Variables
 
 static uni_hid_device_t* dev_ptr[3]  = {NULL, NULL, NULL};
-static uni_controller_t  ctrl_new[3] = {{0}, {0}, {0}};
-static uni_controller_t  ctrl_old[3] = {{0}, {0}, {0}};
+static uni_keyboard_t    kb_last     = {0};
+static t_c64b_gp_state   gp_last[3]  = {{0}, {0}, {0}};
+
+static t_c64b_mcro_job   mcro_jobs[MCRO_JOBS];
+static unsigned int      mcro_num   = 0;
+static t_c64b_mcro_job   mcro_run;
+static bool              mcro_busy  = false;
+static t_c64b_screen     screen     = {.valid = false};
+static uint32_t          live_keys  = 0;
+static char              mcro_keys[SCR_OUT_LEN];
+
+static TaskHandle_t      parse_task_h = NULL;
 
 static bool              swap_ports = false;
 static const uint8_t     col_perm[] = COL_PERM;
 static const uint8_t     row_perm[] = ROW_PERM;
+static volatile bool     update_running = false; // inputs are dropped
+
+//----------------------------------------------------------------------------//
+// Boot timing trace: each milestone is logged once, with the time elapsed
+// since the application started
+
+typedef enum
+{
+	BOOT_PARSER = 0, // c64b_parser_init() entered
+	BOOT_READY,      // parser running, inputs are accepted from here on
+	BOOT_PROBE,      // sd-card probed for listings and firmware
+	BOOT_DEVICE,     // first device ready
+	BOOT_INPUT,      // first report parsed
+	BOOT_NUM
+} t_c64b_boot_mark;
+
+static const char* const boot_mark_str[BOOT_NUM] =
+{
+	"parser init",
+	"parser ready",
+	"sd-card probed",
+	"first device",
+	"first input"
+};
+
+static int64_t boot_t[BOOT_NUM] = {0};
+
+static void boot_mark(t_c64b_boot_mark m)
+{
+	if(boot_t[m] != 0)
+		return;
+
+	boot_t[m] = esp_timer_get_time();
+	logi("boot: %s at %lld ms\n", boot_mark_str[m], (long long)(boot_t[m] / 1000));
+}
 
 //----------------------------------------------------------------------------//
 // C64-Blue functions
@@ -103,57 +169,176 @@ void c64b_parser_set_gp_seat(unsigned int idx, unsigned int seat)
 
 //----------------------------------------------------------------------------//
 
+// takes the oldest job out of the queue, a cancellation that arrived after
+// the previous job had already completed must not reach the next one
+
+static bool keyboard_macro_next(void)
+{
+	xSemaphoreTake(mcro_sem_h, portMAX_DELAY);
+
+	mcro_busy = (mcro_num > 0);
+	if(mcro_busy)
+	{
+		mcro_run = mcro_jobs[0];
+		--mcro_num;
+		memmove(&mcro_jobs[0], &mcro_jobs[1], mcro_num * sizeof(t_c64b_mcro_job));
+	}
+	c64b_keyboard_feed_cancel(&keyboard, false);
+
+	xSemaphoreGive(mcro_sem_h);
+	return mcro_busy;
+}
+
+//----------------------------------------------------------------------------//
+
 static void task_keyboard_macro_feed(void *arg)
 {
 	while(1)
 	{
-		if(xSemaphoreTake(feed_sem_h, portMAX_DELAY) == pdTRUE)
+		if(xSemaphoreTake(feed_sem_h, portMAX_DELAY) != pdTRUE)
+			continue;
+
+		while(keyboard_macro_next())
 		{
-			const char * str = *(char **)arg;
 			logi("Starting Keyboard Feed\n");
-			if(xSemaphoreTake(kbrd_sem_h, (TickType_t)10) == pdTRUE)
+			// the keys held on a controller are released within a few
+			// reports, the macro waits for them instead of being dropped
+			if(c64b_kb_acquire_wait(KB_OWNER_FEED, FEED_WAIT_MS / portTICK_PERIOD_MS))
 			{
-				if((kb_owner == KB_OWNER_FEED) || (kb_owner == KB_OWNER_NONE))
+				bool done;
+
+				// keys typed by a device land at the cursor, the screen no
+				// longer matches the model
+				if(keyboard.live_keys != live_keys)
+					c64b_screen_reset(&screen);
+
+				if(mcro_run.row < SCR_ROWS)
 				{
-					kb_owner = KB_OWNER_FEED;
-					c64b_keyboard_feed_str(&keyboard, str);
-					c64b_keyboard_trace_reset(&keyboard);
-					kb_owner = KB_OWNER_NONE;
+					// redraws are turned into keystrokes only now, against
+					// what the previous jobs have actually typed
+					bool clr = c64b_screen_line(&screen, mcro_run.row, mcro_run.str, mcro_keys, sizeof(mcro_keys));
+
+					xSemaphoreTake(mcro_sem_h, portMAX_DELAY);
+					mcro_run.anchored = clr;
+					xSemaphoreGive(mcro_sem_h);
+
+					done = c64b_keyboard_feed_str(&keyboard, mcro_keys);
+				}
+				else if(mcro_run.stream != NULL)
+				{
+					done = mcro_run.stream(&keyboard, mcro_run.str);
 				}
-				xSemaphoreGive(kbrd_sem_h);
+				// constant macros keep their compiled form, dynamic strings
+				// are compiled again on every feed
+				else if(mcro_run.mcro != NULL)
+				{
+					done = c64b_keyboard_feed_macro(&keyboard, mcro_run.mcro);
+				}
+				else
+				{
+					done = c64b_keyboard_feed_str(&keyboard, mcro_run.str);
+				}
+
+				// plain macros and cancelled redraws leave the screen unknown
+				if(!done || (mcro_run.row >= SCR_ROWS))
+					c64b_screen_reset(&screen);
+
+				live_keys = keyboard.live_keys;
+				c64b_keyboard_trace_reset(&keyboard);
+				c64b_kb_release(KB_OWNER_FEED);
+
+				if(!done)
+					logi("parser: macro cancelled\n");
+			}
+			else
+			{
+				logi("parser: keyboard busy, macro dropped\n");
 			}
-			xSemaphoreGive(mcro_sem_h);
 			logi("Completed Keyboard Feed\n");
 		}
 	}
 }
 
 //----------------------------------------------------------------------------//
+// Macros are fed in order from a small queue. A redraw is tagged with the
+// menu it belongs to: when the last queued job redraws the same menu it has
+// not reached the screen yet and it is replaced. A redraw being typed from a
+// cleared screen is cancelled by a new one, which then starts from a cleared
+// screen as well, see c64b_screen_line()
 
-void keyboard_macro_feed(const char* str)
+static bool keyboard_macro_post(t_c64b_macro* mcro, const char* str, const void* tag, unsigned int row, t_c64b_mcro_stream stream)
 {
-	static bool first_feed = true;
-	static char* str_h;
+	if((mcro == NULL) && (str == NULL))
+		return false;
 
-	str_h = str;
+	t_c64b_mcro_job* j = NULL;
 
-	if (first_feed)
-	{
-		logi("parser: Creating macro feed thread\n");
-		xTaskCreatePinnedToCore(task_keyboard_macro_feed,
-								"keyboard-macro-feed",
-								1024*6,
-								(void * const)&str_h,
-								TASK_PRIO_MACRO,
-								NULL,
-								CORE_AFFINITY);
+	xSemaphoreTake(mcro_sem_h, portMAX_DELAY);
 
-		first_feed = false;
+	if((tag != NULL) && (mcro_num > 0) && (mcro_jobs[mcro_num - 1].tag == tag))
+	{
+		j = &mcro_jobs[mcro_num - 1];
 	}
-	else
+	else if(mcro_num < MCRO_JOBS)
 	{
-		xSemaphoreGive(feed_sem_h);
+		j = &mcro_jobs[mcro_num++];
 	}
+
+	if(j == NULL)
+	{
+		xSemaphoreGive(mcro_sem_h);
+		loge("parser: macro queue full, macro dropped\n");
+		return false;
+	}
+
+	j->mcro     = mcro;
+	j->tag      = tag;
+	j->row      = row;
+	j->anchored = false;
+	j->stream   = stream;
+	j->str[0]   = '\0';
+
+	if((mcro == NULL) && (snprintf(j->str, MCRO_STR_LEN, "%s", str) >= MCRO_STR_LEN))
+		loge("parser: macro truncated\n");
+
+	if((tag != NULL) && (mcro_num == 1) && mcro_busy && (mcro_run.tag == tag) &&
+	   mcro_run.anchored && (row < SCR_ROWS))
+		c64b_keyboard_feed_cancel(&keyboard, true);
+
+	xSemaphoreGive(mcro_sem_h);
+	xSemaphoreGive(feed_sem_h);
+	return true;
+}
+
+//----------------------------------------------------------------------------//
+
+void keyboard_macro_feed_macro(t_c64b_macro* mcro)
+{
+	keyboard_macro_post(mcro, NULL, NULL, SCR_ROWS, NULL);
+}
+
+//----------------------------------------------------------------------------//
+
+void keyboard_macro_feed(const char* str)
+{
+	keyboard_macro_post(NULL, str, NULL, SCR_ROWS, NULL);
+}
+
+//----------------------------------------------------------------------------//
+// sets a row of the menu on screen, the deeper rows are emptied
+
+void keyboard_macro_redraw(const void* tag, unsigned int row, const char* str)
+{
+	keyboard_macro_post(NULL, str, tag, row, NULL);
+}
+
+//----------------------------------------------------------------------------//
+// text streamed by a feed function of its own, such as a listing from the
+// sd-card, see c64b_typein_feed()
+
+bool keyboard_macro_stream(t_c64b_mcro_stream stream, const char* arg)
+{
+	return keyboard_macro_post(NULL, arg, NULL, SCR_ROWS, stream);
 }
 
 //----------------------------------------------------------------------------//
@@ -187,6 +372,8 @@ uni_error_t c64b_parser_discover(bd_addr_t addr, const char* name, uint16_t cod,
 
 void c64b_parser_connect(uni_hid_device_t* d)
 {
+	boot_mark(BOOT_DEVICE);
+
 	// keyboard ID always sits on index 0
 	if(uni_hid_device_is_keyboard(d))
 	{
@@ -220,59 +407,44 @@ void c64b_parser_connect(uni_hid_device_t* d)
 
 //----------------------------------------------------------------------------//
 
-void c64b_parse_keyboard(uni_controller_t* ctl)
+void c64b_parse_keyboard(uni_keyboard_t* kb)
 {
-	if(ctl == NULL)
+	if(kb == NULL)
 		return;
 
-	// this function only supports keyboard
-	if(ctl->klass != UNI_CONTROLLER_CLASS_KEYBOARD)
-		return;
-
-	uni_keyboard_t* kb = &(ctl->keyboard);
-	uni_keyboard_t* kb_old;
-
-	kb_old = &(ctrl_old[0].keyboard);
-
-	if (memcmp(kb_old, kb, sizeof(uni_keyboard_t)) == 0)
+	if (memcmp(&kb_last, kb, sizeof(uni_keyboard_t)) == 0)
 		return;
 
 	#ifndef CONFIG_ESP_CONSOLE_NONE
-		uni_controller_dump(ctl);
+		uni_keyboard_dump(kb);
 	#endif
 
 	if(kb->modifiers & (KB_RALT_MASK | KB_LALT_MASK))
-		c64b_parse_keyboard_menu(kb, kb_old);
+		c64b_parse_keyboard_menu(kb, &kb_last);
 	else
-		c64b_parse_keyboard_keys(kb, kb_old);
+		c64b_parse_keyboard_keys(kb, &kb_last);
 
-	*kb_old = *kb;
+	kb_last = *kb;
 }
 
 //----------------------------------------------------------------------------//
 
-void c64b_parse_gamepad(uni_controller_t* ctl, t_c64b_cport_idx cport_idx)
+void c64b_parse_gamepad(t_c64b_gp_state* gp, t_c64b_cport_idx cport_idx)
 {
-	if(ctl == NULL)
-		return;
-
-	// this function only supports gamepads
-	if(ctl->klass != UNI_CONTROLLER_CLASS_GAMEPAD)
+	if(gp == NULL)
 		return;
 
 	t_c64b_parse_fbak fbak;
-
-	uni_gamepad_t*   gp = &(ctl->gamepad);
-	uni_gamepad_t*   gp_old;
+	t_c64b_gp_state*  gp_old;
 
 	if(cport_idx == CPORT_1)
 	{
-		gp_old    = &(ctrl_old[1].gamepad);
+		gp_old    = &(gp_last[1]);
 		cport_idx = swap_ports ? CPORT_2 : CPORT_1;
 	}
 	else if(cport_idx == CPORT_2)
 	{
-		gp_old    = &(ctrl_old[2].gamepad);
+		gp_old    = &(gp_last[2]);
 		cport_idx = swap_ports ? CPORT_1 : CPORT_2;
 	}
 	else
@@ -285,7 +457,8 @@ void c64b_parse_gamepad(uni_controller_t* ctl, t_c64b_cport_idx cport_idx)
 		return;
 
 	#ifndef CONFIG_ESP_CONSOLE_NONE
-		uni_controller_dump(ctl);
+		logi("parser: gamepad %d: dpad 0x%02x, buttons 0x%04x, misc 0x%02x, analog 0x%02x, triggers 0x%02x\n",
+		     cport_idx, gp->dpad, gp->buttons, gp->misc_buttons, gp->analog, gp->triggers);
 	#endif
 
 	//------------------------------------------------------------------------//
@@ -293,11 +466,7 @@ void c64b_parse_gamepad(uni_controller_t* ctl, t_c64b_cport_idx cport_idx)
 	if(gp->misc_buttons & BTN_SELECT_MASK)
 	{
 		if(!(gp_old->misc_buttons & BTN_SELECT_MASK))
-			if(xSemaphoreTake(kbrd_sem_h, portMAX_DELAY) == pdTRUE)
-			{
-				kb_owner = KB_OWNER_NONE;
-				xSemaphoreGive(kbrd_sem_h);
-			}
+			c64b_kb_revoke();
 
 		// processing special keys, all controller lines are disabled
 		c64b_keyboard_cport_rel(&keyboard, CPORT_UP, cport_idx);
@@ -339,18 +508,106 @@ void c64b_parse_gamepad(uni_controller_t* ctl, t_c64b_cport_idx cport_idx)
 
 //----------------------------------------------------------------------------//
 
+// every keyboard report is parsed, since each one may carry a different set
+// of held keys
+
+static void c64b_parse_drain_keyboard()
+{
+	t_c64b_input in;
+
+	while(c64b_input_pop(&(input_ring[0]), &in))
+	{
+		c64b_latency_begin(0, in.t_us);
+		c64b_parse_keyboard(&(in.kb));
+		c64b_latency_end(0);
+	}
+}
+
+//----------------------------------------------------------------------------//
+// gamepad reports are merged while the next one does not revert any of the
+// bits that changed with the current one, so every press and release is seen
+// by the parser at least once. Merged reports are timed from the oldest one
+
+static void c64b_parse_drain_gamepad(unsigned int i)
+{
+	t_c64b_input in;
+	t_c64b_input nx;
+
+	while(c64b_input_pop(&(input_ring[i]), &in))
+	{
+		uint64_t prv  = c64b_input_gp_bits(&(gp_last[i]));
+		uint32_t t_us = in.t_us;
+
+		while(c64b_input_peek(&(input_ring[i]), &nx))
+		{
+			uint64_t cur = c64b_input_gp_bits(&(in.gp));
+			uint64_t nxt = c64b_input_gp_bits(&(nx.gp));
+
+			if((prv ^ cur) & (cur ^ nxt))
+				break;
+
+			c64b_input_pop(&(input_ring[i]), &in);
+		}
+
+		c64b_latency_begin(i, t_us);
+		c64b_parse_gamepad(&(in.gp), i);
+		c64b_latency_end(i);
+	}
+}
+
+//----------------------------------------------------------------------------//
+// a device that could not take the keyboard gets its latest state applied
+// again once the keyboard is released, see c64b_kb_acquire()
+
+static void c64b_parse_replay_keyboard()
+{
+	if(!(kb_last.modifiers & (KB_RALT_MASK | KB_LALT_MASK)))
+		c64b_parse_keyboard_keys(&kb_last, &kb_last);
+}
+
+static void c64b_parse_replay_gamepad(t_c64b_cport_idx cport_idx)
+{
+	unsigned int i = cport_idx;
+
+	if(swap_ports)
+		i = (cport_idx == CPORT_1) ? CPORT_2 : CPORT_1;
+
+	if((dev_ptr[i] != NULL) && !(gp_last[i].misc_buttons & BTN_SELECT_MASK))
+		c64b_parse_gamepad_kbemu(&(gp_last[i]), &(gp_last[i]), cport_idx);
+}
+
+//----------------------------------------------------------------------------//
+
+// the parser sleeps until c64b_parse() notifies it, each bit of the
+// notification value marks the device whose ring holds new reports, or a
+// device whose keyboard intent has to be replayed
+
 void task_c64b_parse(void *arg)
 {
+	uint32_t dirty;
+
 	while(1)
 	{
-		if(xQueueReceive(queue_ctl_data[0], &ctrl_new[0], 0))
-			c64b_parse_keyboard(&ctrl_new[0]);
+		if(xTaskNotifyWait(0, UINT32_MAX, &dirty, portMAX_DELAY) != pdTRUE)
+			continue;
 
-		if(xQueueReceive(queue_ctl_data[1], &ctrl_new[1], 0))
-			c64b_parse_gamepad(&ctrl_new[1], CPORT_1);
+		if(dirty & (1 << 0))
+			c64b_parse_drain_keyboard();
 
-		if(xQueueReceive(queue_ctl_data[2], &ctrl_new[2], 0))
-			c64b_parse_gamepad(&ctrl_new[2], CPORT_2);
+		if(dirty & (1 << 1))
+			c64b_parse_drain_gamepad(CPORT_1);
+
+		if(dirty & (1 << 2))
+			c64b_parse_drain_gamepad(CPORT_2);
+
+		if(dirty & KB_INTENT_BIT(KB_OWNER_KBRD))
+			c64b_parse_replay_keyboard();
+
+		if(dirty & KB_INTENT_BIT(KB_OWNER_CTL1))
+			c64b_parse_replay_gamepad(CPORT_1);
+
+		if(dirty & KB_INTENT_BIT(KB_OWNER_CTL2))
+			c64b_parse_replay_gamepad(CPORT_2);
 	}
 }
 
@@ -372,12 +629,47 @@ void task_c64b_disable_pairing(void * arg)
 
 void c64b_parse(uni_hid_device_t* d)
 {
-	if(dev_ptr[0] == d)
-		xQueueOverwrite(queue_ctl_data[0], (void *)get_ctl(dev_ptr[0]));
-	else if(dev_ptr[1] == d)
-		xQueueOverwrite(queue_ctl_data[1], (void *)get_ctl(dev_ptr[1]));
-	else if(dev_ptr[2] == d)
-		xQueueOverwrite(queue_ctl_data[2], (void *)get_ctl(dev_ptr[2]));
+	// the keyboard lines belong to the firmware update until power-off
+	if(update_running)
+		return;
+
+	for(unsigned int i = 0; i < 3; ++i)
+	{
+		if(dev_ptr[i] == d)
+		{
+			uni_controller_t* ctl = get_ctl(d);
+			t_c64b_input      in  = {0};
+			size_t            len;
+
+			in.t_us = (uint32_t)esp_timer_get_time();
+
+			// the keyboard sits on index 0, gamepads on the others
+			if((i == 0) && (ctl->klass == UNI_CONTROLLER_CLASS_KEYBOARD))
+			{
+				in.kb = ctl->keyboard;
+				len   = sizeof(uni_keyboard_t);
+			}
+			else if((i != 0) && (ctl->klass == UNI_CONTROLLER_CLASS_GAMEPAD))
+			{
+				c64b_gamepad_pack(&(ctl->gamepad), &(in.gp), &(input_ring[i].last.gp));
+				len = sizeof(t_c64b_gp_state);
+			}
+			else
+				break;
+
+			// gamepad reports are merged while the ring is full
+			bool queued = (i == 0) ? c64b_input_push(&(input_ring[i]), &in, len) :
+			                         c64b_input_push_gp(&(input_ring[i]), &in);
+			if(!queued)
+				logi("parser: ring full on device %d (%lu reports not queued)\n", i, (unsigned long)input_ring[i].drops);
+
+			boot_mark(BOOT_INPUT);
+
+			if(parse_task_h != NULL)
+				xTaskNotify(parse_task_h, 1 << i, eSetBits);
+			break;
+		}
+	}
 
 	// it's fine to check here because we can catch feedback on
 	// button release events
@@ -416,31 +708,124 @@ void c64b_parser_disconnect(uni_hid_device_t* d)
 
 	dev_ptr[idx] = NULL;
 
-	if(xSemaphoreTake(kbrd_sem_h, portMAX_DELAY) == pdTRUE)
+	c64b_kb_seize(KB_OWNER_SYS);
+	c64b_keyboard_reset(&keyboard);
+	c64b_kb_release(KB_OWNER_SYS);
+}
+
+//----------------------------------------------------------------------------//
+// one mark for every step of the firmware update, see c64b_update(). The
+// steps are evenly spaced, so the marks alone show the progress
+
+static void update_progress(unsigned int pct)
+{
+	ARG_UNUSED(pct);
+	c64b_keyboard_feed_str(&keyboard, "*");
+}
+
+//----------------------------------------------------------------------------//
+
+static _Noreturn void update_park(void)
+{
+	while(1)
+		vTaskDelay(portMAX_DELAY);
+}
+
+//----------------------------------------------------------------------------//
+// Runs the firmware update as a streamed macro, so it owns the keyboard like
+// any other text fed to the C64. Inputs are dropped once it starts and the
+// feed thread is parked when the result is shown
+
+static bool update_stream(t_c64b_keyboard* h, const char* arg)
+{
+	const char update_started[] =
+		"~clr~0 firmware update started!"
+		"~ret~0 should take less than a minute"
+		"~ret~0 text might change color and/or size"
+		"~ret~"
+		"~ret~0 ";
+
+	const char update_successful[] =
+		"~ret~~clr~"
+		"~cmdr-psh~7~cmdr-rel~"
+		"~ctrl-psh~0~ctrl-rel~"
+		"0 successfully updated firmware!~ret~"
+		"~ret~"
+		"0 please switch off the computer and~ret~"
+		"0 remove the sd-card"
+		"~ret~";
+
+	const char update_failed[] =
+		"~ret~~clr~"
+		"~cmdr-psh~7~cmdr-rel~"
+		"~ctrl-psh~0~ctrl-rel~"
+		"0 firmware updated failed!~ret~"
+		"~ret~"
+		"0 please switch off the computer and~ret~"
+		"0 remove the sd-card"
+		"~ret~";
+
+	// the C64 needs a few seconds from power-on to the BASIC prompt
+	int64_t wait_ms = UPDATE_BOOT_MS - esp_timer_get_time() / 1000;
+	if(wait_ms > 0)
+		vTaskDelay(wait_ms / portTICK_PERIOD_MS);
+
+	c64b_keyboard_feed_str(h, update_started);
+
+	update_running = true;
+
+	bool ok = (c64b_update(update_progress) == UPDATE_OK);
+
+	vTaskDelay(500 / portTICK_PERIOD_MS);
+	c64b_keyboard_feed_str(h, ok ? update_successful : update_failed);
+
+	// the job never ends and keeps the keyboard token on purpose: nothing
+	// else may drive the keyboard while the result is on the screen
+	update_park();
+}
+
+//----------------------------------------------------------------------------//
+// Nearly every boot finds no card, so the probe runs next to the bluetooth
+// bring-up instead of delaying it: the listings are looked up and the update
+// flow is only started when application.bin is there. The card shares its
+// lines with the keyboard, the probe owns the keyboard while it is mounted
+
+static void task_c64b_sdcard_probe(void* arg)
+{
+	bool update = false;
+
+	c64b_kb_acquire_wait(KB_OWNER_SYS, portMAX_DELAY);
+
+	if(c64b_sdcard_mount())
 	{
-		c64b_keyboard_reset(&keyboard);
-		xSemaphoreGive(kbrd_sem_h);
+		c64b_typein_scan();
+		c64b_sdcard_unmount();
+
+		update = (c64b_update_init(true) == UPDATE_OK);
 	}
+
+	c64b_kb_release(KB_OWNER_SYS);
+
+	boot_mark(BOOT_PROBE);
+
+	if(update)
+		keyboard_macro_stream(update_stream, "");
+
+	vTaskDelete(NULL);
 }
 
 //----------------------------------------------------------------------------//
 
 void c64b_parser_init()
 {
-	queue_ctl_data[0] = xQueueCreate(1, sizeof(uni_controller_t));
-	queue_ctl_data[1] = xQueueCreate(1, sizeof(uni_controller_t));
-	queue_ctl_data[2] = xQueueCreate(1, sizeof(uni_controller_t));
+	boot_mark(BOOT_PARSER);
+
 	queue_ctl_fbak    = xQueueCreate(1, sizeof(t_c64b_parse_fbak));
 
-	kbrd_sem_h = xSemaphoreCreateBinary();
-	mcro_sem_h = xSemaphoreCreateBinary();
+	mcro_sem_h = xSemaphoreCreateMutex();
 	feed_sem_h = xSemaphoreCreateBinary();
 
-	xSemaphoreGive(kbrd_sem_h);
-	xSemaphoreGive(mcro_sem_h);
-	xSemaphoreGive(feed_sem_h);
-
-	kb_owner = KB_OWNER_NONE;
+	c64b_kb_init();
 
 	keyboard.pin_col[0] = PIN_COL0;
 	keyboard.pin_col[1] = PIN_COL1;
@@ -468,63 +853,14 @@ void c64b_parser_init()
 	keyboard.pin_shft  = PIN_SHFT;
 	keyboard.pin_cmdr  = PIN_CMDR;
 
-	keyboard.feed_psh_ms = 30;
-	keyboard.feed_rel_ms = 30;
-
 	keyboard.col_perm  = col_perm;
 	keyboard.row_perm  = row_perm;
 
 	c64b_property_init();
+	c64b_keyboard_pace_set(&keyboard, kb_pace);
 	c64b_parse_gamepad_init();
-
-	if(c64b_update_init(true) == UPDATE_OK)
-	{
-		const char update_started[] =
-			"~clr~0 firmware update started!"
-			"~ret~0 should take about a minute"
-			"~ret~0 text might change color and/or size"
-			"~ret~";
-
-		const char update_successful[] =
-			"~ret~~clr~"
-			"~cmdr-psh~7~cmdr-rel~"
-			"~ctrl-psh~0~ctrl-rel~"
-			"0 successfully updated firmware!~ret~"
-			"~ret~"
-			"0 please switch off the computer and~ret~"
-			"0 remove the sd-card"
-			"~ret~";
-
-		const char update_failed[] =
-			"~ret~~clr~"
-			"~cmdr-psh~7~cmdr-rel~"
-			"~ctrl-psh~0~ctrl-rel~"
-			"0 firmware updated failed!~ret~"
-			"~ret~"
-			"0 please switch off the computer and~ret~"
-			"0 remove the sd-card"
-			"~ret~";
-
-		vTaskDelay(3000 / portTICK_PERIOD_MS);
-
-		c64b_keyboard_init(&keyboard);
-		c64b_keyboard_feed_str(&keyboard, update_started);
-
-		if(c64b_update() == UPDATE_OK)
-		{
-			vTaskDelay(500 / portTICK_PERIOD_MS);
-			c64b_keyboard_init(&keyboard);
-			c64b_keyboard_feed_str(&keyboard, update_successful);
-		}
-		else
-		{
-			vTaskDelay(500 / portTICK_PERIOD_MS);
-			c64b_keyboard_init(&keyboard);
-			c64b_keyboard_feed_str(&keyboard, update_failed);
-		}
-
-		while(1){}
-	}
+	c64b_parse_keyboard_init();
+	c64b_sdcard_init();
 
 	logi("parser: Creating parser thread\n");
 	xTaskCreatePinnedToCore(task_c64b_parse,
@@ -532,6 +868,17 @@ void c64b_parser_init()
 							1024*16,
 							NULL,
 							TASK_PRIO_PARSE,
+							&parse_task_h,
+							CORE_AFFINITY);
+
+	kb_intent_task = parse_task_h;
+
+	logi("parser: Creating macro feed thread\n");
+	xTaskCreatePinnedToCore(task_keyboard_macro_feed,
+							"keyboard-macro-feed",
+							1024*8,
+							NULL,
+							TASK_PRIO_MACRO,
 							NULL,
 							CORE_AFFINITY);
 
@@ -548,4 +895,14 @@ void c64b_parser_init()
 	}
 
 	c64b_keyboard_init(&keyboard);
+	boot_mark(BOOT_READY);
+
+	logi("parser: Creating sd-card probe thread\n");
+	xTaskCreatePinnedToCore(task_c64b_sdcard_probe,
+							"sdcard_probe",
+							1024*4,
+							NULL,
+							TASK_PRIO_PROBE,
+							NULL,
+							CORE_AFFINITY);
 }
@@ -42,6 +42,8 @@
 #include "c64b_keyboard.h"
 #include "c64b_properties.h"
 #include "c64b_macros.h"
+#include "c64b_latency.h"
+#include "c64b_screen.h"
 
 #include "c64b_pinout_0v2.h"
 
@@ -74,7 +76,9 @@
 #define KB_RALT_MASK     0x40
 #define KB_START_MASK    0x8
 
-#define ANL_DEADZONE     256
+#define ANL_DEADZONE     256 // radius, axes range from -512 to 511
+#define ANL_HYST_RAD     32  // the stick is released below ANL_DEADZONE - ANL_HYST_RAD
+#define ANL_HYST_ANG     4   // sector edges move by this much (256 per turn) towards the next sector
 #define TRG_DEADZONE     40
 #define ANL_RRMASK       (1 << 3)
 #define ANL_LLMASK       (1 << 2)
@@ -84,7 +88,12 @@
 #define CORE_AFFINITY    1
 #define TASK_PRIO_PARSE  3
 #define TASK_PRIO_MACRO  4
-#define TASK_PRIO_AFIRE  5
+#define TASK_PRIO_PROBE  1
+
+#define UPDATE_BOOT_MS   3000 // the update starts typing once the C64 is up
+
+// streamed macros feed text of their own from the keyboard feed thread
+typedef bool (*t_c64b_mcro_stream)(t_c64b_keyboard* h, const char* arg);
 
 //----------------------------------------------------------------------------//
 
@@ -94,7 +103,11 @@ void c64b_parser_connect(uni_hid_device_t* d);
 void c64b_parser_disconnect(uni_hid_device_t* d);
 void c64b_parser_set_kb_leds(uint8_t mask);
 void c64b_parse(uni_hid_device_t* d);
+void c64b_parse_gamepad_afire_cfg();
 
 void keyboard_macro_feed(const char* str);
+void keyboard_macro_feed_macro(t_c64b_macro* mcro);
+void keyboard_macro_redraw(const void* tag, unsigned int row, const char* str);
+bool keyboard_macro_stream(t_c64b_mcro_stream stream, const char* arg);
 
 #endif
@@ -27,9 +27,7 @@
 
 //----------------------------------------------------------------------------//
 
-SemaphoreHandle_t autofire_sem_h[3];
-SemaphoreHandle_t afsleep_sem_h[3];
-bool              autofire[3] = {0};
+static uint8_t cport_last[3] = {0};
 
 //----------------------------------------------------------------------------//
 bool c64b_gamepad_trigger_active(int32_t trig)
@@ -38,207 +36,192 @@ bool c64b_gamepad_trigger_active(int32_t trig)
 }
 
 //----------------------------------------------------------------------------//
-uint8_t c64b_gamepad_analog_active(int32_t x, int32_t y)
-{
-	uint8_t ret = 0;
+// Analog stick: the stick is classified into 8 sectors of 45 degrees, with a
+// radial deadzone. Angles are binary (256 per turn) and come from an integer
+// arctangent table over one octant. Both the radius and the sector edges have
+// some hysteresis, so that a stick resting on a boundary does not chatter.
 
-	if((abs(x) > ANL_DEADZONE) || (abs(y) > ANL_DEADZONE))
-	{
-		unsigned int quadrant = 0;
-		if((x >= 0) && (y < 0))
-		{
-			quadrant = 0;
-		}
-		else if((x < 0) && (y < 0))
-		{
-			quadrant = 1;
-		}
-		else if((x < 0) && (y >= 0))
-		{
-			quadrant = 2;
-		}
-		else if((x >= 0) && (y >= 0))
-		{
-			quadrant = 3;
-		}
+// atan(i / 64) in binary angle units, 0 to 32 (45 degrees)
+static const uint8_t ANL_ATAN[65] =
+{
+	 0,  1,  1,  2,  3,  3,  4,  4,  5,  6,  6,  7,  8,  8,  9,  9,
+	10, 11, 11, 12, 12, 13, 13, 14, 15, 15, 16, 16, 17, 17, 18, 18,
+	19, 19, 20, 20, 21, 21, 22, 22, 23, 23, 24, 24, 25, 25, 25, 26,
+	26, 27, 27, 27, 28, 28, 29, 29, 29, 30, 30, 30, 31, 31, 31, 32,
+	32
+};
+
+// sectors counterclockwise starting from right
+static const uint8_t ANL_SECTOR_MASK[8] =
+{
+	ANL_RRMASK,
+	ANL_RRMASK | ANL_UPMASK,
+	ANL_UPMASK,
+	ANL_UPMASK | ANL_LLMASK,
+	ANL_LLMASK,
+	ANL_LLMASK | ANL_DNMASK,
+	ANL_DNMASK,
+	ANL_DNMASK | ANL_RRMASK
+};
+
+#define ANL_SECTOR_NONE 0xff
 
-		if(abs(y) < abs(x) * 2)
-		{
-			if(quadrant == 0 || quadrant == 3)
-				ret |= ANL_RRMASK;
-			else
-				ret |= ANL_LLMASK;
-		}
+//----------------------------------------------------------------------------//
 
-		if(abs(x) < abs(y * 2))
-		{
-			if(quadrant == 0 || quadrant == 1)
-				ret |= ANL_UPMASK;
-			else
-				ret |= ANL_DNMASK;
-		}
-	}
+static unsigned int c64b_gamepad_analog_sector(uint8_t mask)
+{
+	for(unsigned int s = 0; s < 8; ++s)
+		if(ANL_SECTOR_MASK[s] == mask)
+			return s;
 
-	return ret;
+	return ANL_SECTOR_NONE;
 }
 
 //----------------------------------------------------------------------------//
+// returns the ANL_* mask of the stick, prev is the mask of the previous report
 
-bool c64b_gamepad_interesting(uni_gamepad_t* gp, uni_gamepad_t* gp_old)
+uint8_t c64b_gamepad_analog_active(int32_t x, int32_t y, uint8_t prev)
 {
-	if(gp->dpad != gp_old->dpad)
-		return true;
+	const int32_t dz_on  = ANL_DEADZONE;
+	const int32_t dz_off = ANL_DEADZONE - ANL_HYST_RAD;
 
-	if(gp->buttons != gp_old->buttons)
-		return true;
+	unsigned int prev_s = c64b_gamepad_analog_sector(prev);
+	int32_t      dz     = (prev_s == ANL_SECTOR_NONE) ? dz_on : dz_off;
 
-	if(gp->misc_buttons != gp_old->misc_buttons)
-		return true;
+	if((x * x + y * y) <= (dz * dz))
+		return 0;
 
-	if(c64b_gamepad_trigger_active(gp->brake) !=
-	   c64b_gamepad_trigger_active(gp_old->brake))
-		return true;
+	// y grows downwards
+	int32_t  ax = abs(x);
+	int32_t  ay = abs(y);
+	uint32_t a;
 
-	if(c64b_gamepad_trigger_active(gp->throttle) !=
-	   c64b_gamepad_trigger_active(gp_old->throttle))
-		return true;
-
-	if(c64b_gamepad_analog_active(gp->axis_x, gp->axis_y) !=
-	   c64b_gamepad_analog_active(gp_old->axis_x, gp_old->axis_y))
-		return true;
+	if(ax >= ay)
+		a = ANL_ATAN[(ay * 64 + ax / 2) / ax];
+	else
+		a = 64 - ANL_ATAN[(ax * 64 + ay / 2) / ay];
 
-	return false;
-}
+	if(x < 0)
+		a = 128 - a;
+	if(y > 0)
+		a = 256 - a;
 
-//----------------------------------------------------------------------------//
+	uint8_t ang = (uint8_t)a;
 
-static void c64b_gamepad_autofire(t_c64b_cport_idx i)
-{
-	while(1)
+	// the previous sector is kept while the stick stays close enough to it
+	if(prev_s != ANL_SECTOR_NONE)
 	{
-		if(xSemaphoreTake(autofire_sem_h[i], (TickType_t)portMAX_DELAY) == pdTRUE)
-		{
-			bool active = autofire[i];
-			xSemaphoreGive(autofire_sem_h[i]);
-
-			if (active)
-			{
-				// make sure this tpress is smaller than the smallest autofire
-				// interval (currently 100ms)
-				const TickType_t tpress = 40 / portTICK_PERIOD_MS;
-
-				c64b_keyboard_cport_psh(&keyboard, CPORT_FF, i);
-				vTaskDelay(tpress);
-				c64b_keyboard_cport_rel(&keyboard, CPORT_FF, i);
-				vTaskDelay(tpress);
-
-				xSemaphoreTake(afsleep_sem_h[i], af_prd - tpress * 2);
-			}
-			else
-			{
-				xSemaphoreTake(afsleep_sem_h[i], (TickType_t)portMAX_DELAY);
-			}
-		}
+		int8_t d = (int8_t)(ang - (uint8_t)(prev_s * 32));
+		if(abs(d) <= 16 + ANL_HYST_ANG)
+			return prev;
 	}
+
+	return ANL_SECTOR_MASK[((ang + 16) >> 5) & 7];
 }
 
 //----------------------------------------------------------------------------//
 
-static void task_c64b_gamepad_autofire_2(void *arg)
+// reduces a bluepad32 report to the state used by the parsers, so that
+// reports differing only in the analog values are not queued at all. The
+// stick is classified here, once per report, against the last queued state
+
+void c64b_gamepad_pack(const uni_gamepad_t* gp, t_c64b_gp_state* st, const t_c64b_gp_state* prev)
 {
-	c64b_gamepad_autofire(CPORT_2);
+	st->buttons      = gp->buttons;
+	st->dpad         = gp->dpad;
+	st->misc_buttons = gp->misc_buttons;
+	st->analog       = c64b_gamepad_analog_active(gp->axis_x, gp->axis_y, prev->analog);
+	st->triggers     = 0;
+
+	if(c64b_gamepad_trigger_active(gp->brake))
+		st->triggers |= TRG_LTMASK;
+
+	if(c64b_gamepad_trigger_active(gp->throttle))
+		st->triggers |= TRG_RTMASK;
 }
 
-static void task_c64b_gamepad_autofire_1(void *arg)
+//----------------------------------------------------------------------------//
+
+bool c64b_gamepad_interesting(t_c64b_gp_state* gp, t_c64b_gp_state* gp_old)
 {
-	c64b_gamepad_autofire(CPORT_1);
+	return c64b_input_gp_bits(gp) != c64b_input_gp_bits(gp_old);
 }
 
 //----------------------------------------------------------------------------//
 
-static void c64b_gamepad_autofire_start(unsigned int i)
+// autofire rates, the stored index keeps its meaning in Hz for the first
+// entries, the others are multiples of the frame of the selected pacing
+
+typedef struct
 {
-	if(xSemaphoreTake(autofire_sem_h[i], (TickType_t)portMAX_DELAY) == pdTRUE)
-	{
-		if (!autofire[i])
-		{
-			logi("starting autofire on port %i\n", i);
-			autofire[i] = true;
-			if(uxSemaphoreGetCount(afsleep_sem_h[i]) == 0)
-				xSemaphoreGive(afsleep_sem_h[i]); // for instant restart
-		}
-		xSemaphoreGive(autofire_sem_h[i]);
-	}
-}
+	uint8_t hz;
+	uint8_t frames;
+	uint8_t duty_pct;
+} t_c64b_af_rate;
+
+static const t_c64b_af_rate AF_RATES[AF_RATE_NUM] =
+{
+	{ 0, 0,  0}, // single shot
+	{ 1, 0, 50},
+	{ 2, 0, 50},
+	{ 3, 0, 50},
+	{ 4, 0, 50},
+	{ 5, 0, 50},
+	{ 6, 0, 50},
+	{ 7, 0, 50},
+	{ 8, 0, 50},
+	{ 9, 0, 50},
+	{10, 0, 50},
+	{ 0, 4, 50},
+	{ 0, 3, 34}, // held for one frame
+	{ 0, 2, 50}
+};
+
+// VIC-II frame periods
+#define FRAME_PAL_US  19950
+#define FRAME_NTSC_US 16715
 
 //----------------------------------------------------------------------------//
 
-static void c64b_gamepad_autofire_stop(unsigned int i)
+void c64b_parse_gamepad_afire_cfg()
 {
-	if(xSemaphoreTake(autofire_sem_h[i], (TickType_t)portMAX_DELAY) == pdTRUE)
-	{
-		if (autofire[i])
-		{
-			logi("stopping autofire on port %i\n", i);
-			autofire[i] = false;
-		}
-		xSemaphoreGive(autofire_sem_h[i]);
-	}
+	const t_c64b_af_rate* r = &(AF_RATES[(af_rate < AF_RATE_NUM) ? af_rate : 0]);
+
+	uint32_t period_us = 0;
+	if(r->hz != 0)
+		period_us = 1000000 / r->hz;
+	else if(r->frames != 0)
+		period_us = r->frames * ((kb_pace == C64B_PACE_NTSC) ? FRAME_NTSC_US : FRAME_PAL_US);
+
+	c64b_keyboard_afire_cfg(&keyboard, period_us, r->duty_pct);
 }
 
 //----------------------------------------------------------------------------//
 
 void c64b_parse_gamepad_init()
 {
-	autofire_sem_h[1] = xSemaphoreCreateBinary();
-	autofire_sem_h[2] = xSemaphoreCreateBinary();
-	afsleep_sem_h[1] = xSemaphoreCreateBinary();
-	afsleep_sem_h[2] = xSemaphoreCreateBinary();
-	xSemaphoreGive(autofire_sem_h[1]);
-	xSemaphoreGive(autofire_sem_h[2]);
-	xSemaphoreGive(afsleep_sem_h[1]);
-	xSemaphoreGive(afsleep_sem_h[2]);
-
-	xTaskCreatePinnedToCore(task_c64b_gamepad_autofire_2,
-	                        "autofire 2",
-	                        4096,
-	                        NULL,
-	                        TASK_PRIO_AFIRE,
-	                        NULL,
-	                        CORE_AFFINITY);
-
-	xTaskCreatePinnedToCore(task_c64b_gamepad_autofire_1,
-	                        "autofire 1",
-	                        4096,
-	                        NULL,
-	                        TASK_PRIO_AFIRE,
-	                        NULL,
-	                        CORE_AFFINITY);
+	c64b_parse_gamepad_afire_cfg();
 }
 
 //----------------------------------------------------------------------------//
 
-bool c64b_parse_gamepad_menu(uni_gamepad_t* gp, uni_gamepad_t* gp_old)
+bool c64b_parse_gamepad_menu(t_c64b_gp_state* gp, t_c64b_gp_state* gp_old)
 {
 	if((gp->buttons & BTN_B_MASK) && !(gp_old->buttons & BTN_B_MASK))
 	{
-		if(xSemaphoreTake(mcro_sem_h, (TickType_t)0) == pdTRUE)
-			menu_fwd();
+		menu_fwd();
 	}
 	else if((gp->buttons & BTN_A_MASK) && !(gp_old->buttons & BTN_A_MASK))
 	{
-		if(xSemaphoreTake(mcro_sem_h, (TickType_t)0) == pdTRUE)
-			menu_bwd();
+		menu_bwd();
 	}
 	else if((gp->buttons & BTN_X_MASK) && !(gp_old->buttons & BTN_X_MASK))
 	{
-		if(xSemaphoreTake(mcro_sem_h, (TickType_t)0) == pdTRUE)
-			menu_ext();
+		menu_ext();
 	}
 	else if((gp->misc_buttons & BTN_MENU_MASK) && !(gp_old->misc_buttons & BTN_MENU_MASK))
 	{
-		if(xSemaphoreTake(mcro_sem_h, (TickType_t)0) == pdTRUE)
-			menu_act();
+		menu_act();
 	}
 
 	return true; // placeholder for now
@@ -246,7 +229,7 @@ bool c64b_parse_gamepad_menu(uni_gamepad_t* gp, uni_gamepad_t* gp_old)
 
 //----------------------------------------------------------------------------//
 
-bool c64b_parse_gamepad_swap(uni_gamepad_t* gp, uni_gamepad_t* gp_old)
+bool c64b_parse_gamepad_swap(t_c64b_gp_state* gp, t_c64b_gp_state* gp_old)
 {
 	bool swap_ports = false;
 
@@ -254,12 +237,9 @@ bool c64b_parse_gamepad_swap(uni_gamepad_t* gp, uni_gamepad_t* gp_old)
 	{
 		logi("Swapping Ports\n");
 		swap_ports = true;
-		if(xSemaphoreTake(kbrd_sem_h, portMAX_DELAY) == pdTRUE)
-		{
-			c64b_keyboard_reset(&keyboard);
-			kb_owner = KB_OWNER_NONE;
-			xSemaphoreGive(kbrd_sem_h);
-		}
+		c64b_kb_seize(KB_OWNER_SYS);
+		c64b_keyboard_reset(&keyboard);
+		c64b_kb_release(KB_OWNER_SYS);
 	}
 
 	return swap_ports;
@@ -267,47 +247,45 @@ bool c64b_parse_gamepad_swap(uni_gamepad_t* gp, uni_gamepad_t* gp_old)
 
 //----------------------------------------------------------------------------//
 
-bool c64b_parse_gamepad_kbemu(uni_gamepad_t* gp, uni_gamepad_t* gp_old, t_c64b_cport_idx cport_idx)
+bool c64b_parse_gamepad_kbemu(t_c64b_gp_state* gp, t_c64b_gp_state* gp_old, t_c64b_cport_idx cport_idx)
 {
-	bool kb_nop = true;
-
-	if(xSemaphoreTake(kbrd_sem_h, (TickType_t)0) == pdTRUE)
+	t_c64b_kb_owner owner = (t_c64b_kb_owner)cport_idx;
+	int             map   = -1;
+
+	if(gp->misc_buttons & BTN_MENU_MASK)
+		map = CT_MAP_IDX_BM;
+	else if(gp->misc_buttons & BTN_HOME_MASK)
+		map = CT_MAP_IDX_BH;
+	else if(gp->buttons & BTN_LS_MASK)
+		map = CT_MAP_IDX_LS;
+	else if(gp->buttons & BTN_RS_MASK)
+		map = CT_MAP_IDX_RS;
+	else if((gp->triggers & TRG_LTMASK) || (gp->buttons & BTN_LT_MASK))
+		map = CT_MAP_IDX_LT;
+	else if((gp->triggers & TRG_RTMASK) || (gp->buttons & BTN_RT_MASK))
+		map = CT_MAP_IDX_RT;
+
+	// the keyboard is only taken when there is something to press
+	if(map < 0)
 	{
-		if((kb_owner == cport_idx) || (kb_owner == KB_OWNER_NONE))
+		if(c64b_kb_owned(owner))
 		{
-			kb_owner = cport_idx;
-			kb_nop   = false;
-
-			if(gp->misc_buttons & BTN_MENU_MASK)
-				c64b_keyboard_char_psh(&keyboard, c64b_keyboard_idx_to_key(ct_map[CT_MAP_IDX_BM]));
-			else if(gp->misc_buttons & BTN_HOME_MASK)
-				c64b_keyboard_char_psh(&keyboard, c64b_keyboard_idx_to_key(ct_map[CT_MAP_IDX_BH]));
-			else if(gp->buttons & BTN_LS_MASK)
-				c64b_keyboard_char_psh(&keyboard, c64b_keyboard_idx_to_key(ct_map[CT_MAP_IDX_LS]));
-			else if(gp->buttons & BTN_RS_MASK)
-				c64b_keyboard_char_psh(&keyboard, c64b_keyboard_idx_to_key(ct_map[CT_MAP_IDX_RS]));
-			else if(c64b_gamepad_trigger_active(gp->brake) || (gp->buttons & BTN_LT_MASK))
-				c64b_keyboard_char_psh(&keyboard, c64b_keyboard_idx_to_key(ct_map[CT_MAP_IDX_LT]));
-			else if(c64b_gamepad_trigger_active(gp->throttle) || (gp->buttons & BTN_RT_MASK))
-				c64b_keyboard_char_psh(&keyboard, c64b_keyboard_idx_to_key(ct_map[CT_MAP_IDX_RT]));
-			else
-				kb_nop = true;
-
-			if(kb_nop)
-			{
-				c64b_keyboard_keys_rel(&keyboard, true);
-				kb_owner = KB_OWNER_NONE;
-			}
+			c64b_keyboard_keys_rel(&keyboard, true);
+			c64b_kb_release(owner);
 		}
-		xSemaphoreGive(kbrd_sem_h);
+		return true;
 	}
 
-	return kb_nop;
+	if(!c64b_kb_acquire(owner))
+		return true;
+
+	c64b_keyboard_char_psh(&keyboard, c64b_keyboard_idx_to_key(ct_map[map]));
+	return false;
 }
 
 //----------------------------------------------------------------------------//
 
-bool c64b_parse_gamepad_ctrl(uni_gamepad_t* gp, uni_gamepad_t* gp_old, t_c64b_cport_idx cport_idx)
+bool c64b_parse_gamepad_ctrl(t_c64b_gp_state* gp, t_c64b_gp_state* gp_old, t_c64b_cport_idx cport_idx)
 {
 	bool rr_pressed = false;
 	bool ll_pressed = false;
@@ -334,46 +312,42 @@ bool c64b_parse_gamepad_ctrl(uni_gamepad_t* gp, uni_gamepad_t* gp_old, t_c64b_cp
 	if(gp->buttons & BTN_Y_MASK)
 		af_pressed = true;
 
-	uint8_t analog = c64b_gamepad_analog_active(gp->axis_x, gp->axis_y);
-	if(analog & ANL_RRMASK)
+	if(gp->analog & ANL_RRMASK)
 		rr_pressed = true;
-	if(analog & ANL_LLMASK)
+	if(gp->analog & ANL_LLMASK)
 		ll_pressed = true;
-	if(analog & ANL_UPMASK)
+	if(gp->analog & ANL_UPMASK)
 		up_pressed = true;
-	if(analog & ANL_DNMASK)
+	if(gp->analog & ANL_DNMASK)
 		dn_pressed = true;
 
-	// these GPIO accesses are all thread-safe on the ESP32
+	uint8_t cport = 0;
 	if(rr_pressed)
-		c64b_keyboard_cport_psh(&keyboard, CPORT_RR, cport_idx);
-	else
-		c64b_keyboard_cport_rel(&keyboard, CPORT_RR, cport_idx);
-
+		cport |= CPORT_MASK(CPORT_RR);
 	if(ll_pressed)
-		c64b_keyboard_cport_psh(&keyboard, CPORT_LL, cport_idx);
-	else
-		c64b_keyboard_cport_rel(&keyboard, CPORT_LL, cport_idx);
-
+		cport |= CPORT_MASK(CPORT_LL);
 	if(up_pressed)
-		c64b_keyboard_cport_psh(&keyboard, CPORT_UP, cport_idx);
-	else
-		c64b_keyboard_cport_rel(&keyboard, CPORT_UP, cport_idx);
-
+		cport |= CPORT_MASK(CPORT_UP);
 	if(dn_pressed)
-		c64b_keyboard_cport_psh(&keyboard, CPORT_DN, cport_idx);
-	else
-		c64b_keyboard_cport_rel(&keyboard, CPORT_DN, cport_idx);
-
+		cport |= CPORT_MASK(CPORT_DN);
 	if(ff_pressed)
-		c64b_keyboard_cport_psh(&keyboard, CPORT_FF, cport_idx);
-	else
-		c64b_keyboard_cport_rel(&keyboard, CPORT_FF, cport_idx);
+		cport |= CPORT_MASK(CPORT_FF);
+
+	// all the lines of the port are updated together through the set and
+	// clear registers, which are atomic with respect to the other pins
+	c64b_keyboard_cport_set(&keyboard, cport, cport_idx);
+
+	// only a change of the lines closes the latency probe of the report
+	if(cport != cport_last[cport_idx])
+	{
+		c64b_latency_edge(LAT_PATH_CPORT);
+		cport_last[cport_idx] = cport;
+	}
 
 	if(af_pressed)
-		c64b_gamepad_autofire_start(cport_idx);
+		c64b_keyboard_afire_psh(&keyboard, cport_idx);
 	else
-		c64b_gamepad_autofire_stop(cport_idx);
+		c64b_keyboard_afire_rel(&keyboard, cport_idx);
 
 	return true;
 }
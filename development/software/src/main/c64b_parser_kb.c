@@ -26,85 +26,117 @@
 #include "c64b_parser_kb.h"
 
 //------------------------------------------------------------------------------
-// functions to implement key precedence logic
+// functions to implement key precedence logic. The pressed keys are kept as a
+// bitmap over KEY_IDS, so that pressed and released keys come out of two word
+// operations, while a ring keeps the held keys in press order
 
-static const t_c64b_key_id* old_keys[MAX_KEYPRESS] = {0};
-static const t_c64b_key_id* new_keys[MAX_KEYPRESS] = {0};
-       uint8_t new_pressed = 0;
-static uint8_t old_pressed = 0;
+typedef struct
+{
+	uint64_t w[2];
+} t_c64b_keyset;
+
+static t_c64b_keyset old_set = {0};
+static t_c64b_keyset new_set = {0};
+
+static uint8_t       order[KEYCHAIN_RING_LEN];
+static unsigned int  order_head = 0; // oldest key
+static unsigned int  order_len  = 0;
 
 void c64b_keychain_clear()
 {
-	new_pressed = 0;
+	new_set.w[0] = 0;
+	new_set.w[1] = 0;
 }
 
 uint8_t c64b_keychain_get_size()
 {
-	return new_pressed;
+	return __builtin_popcountll(new_set.w[0]) + __builtin_popcountll(new_set.w[1]);
 }
 
-
-bool c64b_keychain_add(const char* s)
+bool c64b_keychain_add(unsigned int idx)
 {
-	unsigned int   idx = c64b_keyboard_key_to_idx(s);
-	const t_c64b_key_id* h   = &(KEY_IDS[idx]);
-
-	if(new_pressed >= MAX_KEYPRESS)
+	if(idx >= NUM_KEYS)
 		return false;
 
-	new_keys[new_pressed++] = h;
+	new_set.w[idx >> 6] |= 1ULL << (idx & 63);
 	return true;
 }
 
-void c64b_keychain_update()
+static void c64b_keychain_order_rel(const t_c64b_keyset* rel)
 {
-	// first we check if the old keys are still there in the new keys.
-	// if an old key is not pressed any more is removed from the list of old
-	// keys. If an old key is still pressed it is removed from the list of new
-	// keys
+	unsigned int len = 0;
 
-	for(unsigned int i = 0; i < old_pressed; ++i)
+	for(unsigned int i = 0; i < order_len; ++i)
 	{
-		if(old_keys[i] == NULL)
-			break;
+		uint8_t idx = order[(order_head + i) % KEYCHAIN_RING_LEN];
+		if(!(rel->w[idx >> 6] & (1ULL << (idx & 63))))
+			order[(order_head + len++) % KEYCHAIN_RING_LEN] = idx;
+	}
+	order_len = len;
+}
 
-		bool still_pressed = false;
-		for(unsigned int j = 0; j < new_pressed; ++j)
-		{
-			if(old_keys[i] == new_keys[j])
-			{
-				still_pressed = true;
-				new_keys[j] = NULL;
-				break;
-			}
-		}
+static void c64b_keychain_order_psh(uint8_t idx)
+{
+	// the oldest key drops out of the order when the ring is full, it
+	// stays pressed in the bitmap though
+	if(order_len == KEYCHAIN_RING_LEN)
+	{
+		order_head = (order_head + 1) % KEYCHAIN_RING_LEN;
+		order_len -= 1;
+	}
+	order[(order_head + order_len++) % KEYCHAIN_RING_LEN] = idx;
+}
 
-		if(still_pressed == false)
-			old_keys[i] = NULL;
+void c64b_keychain_update()
+{
+	t_c64b_keyset rel;
+	t_c64b_keyset psh;
+
+	for(unsigned int i = 0; i < 2; ++i)
+	{
+		rel.w[i] = old_set.w[i] & ~new_set.w[i];
+		psh.w[i] = new_set.w[i] & ~old_set.w[i];
 	}
 
-	// next, the old keys are compacted to remove holes
-	unsigned int missing = 0;
-	for(unsigned int i = 0; i < old_pressed; ++i)
+	if(rel.w[0] | rel.w[1])
+		c64b_keychain_order_rel(&rel);
+
+	for(unsigned int i = 0; i < 2; ++i)
 	{
-		if(old_keys[i] == NULL)
-			missing += 1;
-		else
-			old_keys[i - missing] = old_keys[i];
+		while(psh.w[i])
+		{
+			c64b_keychain_order_psh((i << 6) + __builtin_ctzll(psh.w[i]));
+			psh.w[i] &= psh.w[i] - 1;
+		}
 	}
 
-	// then we add the new keys to the buffer in no particular order
-	old_pressed = old_pressed - missing;
-	for(unsigned int i = 0; i < new_pressed; ++i)
-		if(new_keys[i] != NULL)
-			old_keys[old_pressed++] = new_keys[i];
+	old_set = new_set;
+}
+
+// copies the latest held keys, up to max, from the oldest to the latest one
+unsigned int c64b_keychain_get_order(uint8_t* idx, unsigned int max)
+{
+	unsigned int num  = (order_len < max) ? order_len : max;
+	unsigned int skip = order_len - num;
+
+	for(unsigned int i = 0; i < num; ++i)
+		idx[i] = order[(order_head + skip + i) % KEYCHAIN_RING_LEN];
+	return num;
 }
 
 bool c64b_keychain_press_latest()
 {
-	if(old_pressed == 0)
+	uint8_t      idx[C64B_SCAN_MAX];
+	unsigned int num = c64b_keychain_get_order(idx, (kb_roll == 0) ? 1 : C64B_SCAN_MAX);
+
+	if(num == 0)
 		return false;
-	return c64b_keyboard_key_psh(&keyboard, old_keys[old_pressed - 1]);
+
+	if(num == 1)
+		return c64b_keyboard_key_psh(&keyboard, &(KEY_IDS[idx[0]]));
+
+	// with rollover enabled all the held keys are cycled through the mux
+	return c64b_keyboard_keys_scan(&keyboard, idx, num, kb_roll_to_us[kb_roll]);
 }
 
 
@@ -124,24 +156,20 @@ bool c64b_parse_keyboard_menu(uni_keyboard_t* kb, uni_keyboard_t* kb_old)
 			case HID_USAGE_KB_RIGHT_ARROW:
 			case HID_USAGE_KB_DOWN_ARROW:
 				kb_nop = false;
-				if(xSemaphoreTake(mcro_sem_h, (TickType_t)0) == pdTRUE)
-					menu_fwd();
+				menu_fwd();
 				break;
 			case HID_USAGE_KB_LEFT_ARROW:
 			case HID_USAGE_KB_UP_ARROW:
 				kb_nop = false;
-				if(xSemaphoreTake(mcro_sem_h, (TickType_t)0) == pdTRUE)
-					menu_bwd();
+				menu_bwd();
 				break;
 			case HID_USAGE_KB_BACKSPACE:
 				kb_nop = false;
-				if(xSemaphoreTake(mcro_sem_h, (TickType_t)0) == pdTRUE)
-					menu_ext();
+				menu_ext();
 				break;
 			case HID_USAGE_KB_ENTER:
 				kb_nop = false;
-				if(xSemaphoreTake(mcro_sem_h, (TickType_t)0) == pdTRUE)
-					menu_act();
+				menu_act();
 				break;
 			default:
 		}
@@ -153,10 +181,147 @@ bool c64b_parse_keyboard_menu(uni_keyboard_t* kb, uni_keyboard_t* kb_old)
 	return kb_nop;
 }
 
+//------------------------------------------------------------------------------
+// HID usages are translated through kb_table[map][shift][usage], which holds
+// KEY_IDS indices, so that no string is looked up while parsing reports
+
+static const t_c64b_kb_layout* kb_layouts[KB_MAP_NUM] =
+{
+	[KB_MAP_SYMBOLIC]   = &kb_layout_symbolic,
+	[KB_MAP_POSITIONAL] = &kb_layout_positional
+};
+
+static uint8_t kb_table[KB_MAP_NUM][2][256];
+static uint8_t kb_idx_lshft = C64B_KB_IDX_NONE;
+static uint8_t kb_idx_rshft = C64B_KB_IDX_NONE;
+
+static uint8_t c64b_parse_keyboard_resolve(const char* s)
+{
+	if(s == NULL)
+		return C64B_KB_IDX_NONE;
+
+	unsigned int idx = c64b_keyboard_key_to_idx(s);
+	if(idx == C64B_KB_IDX_NONE)
+		loge("keyboard: unknown key \"%s\" in map\n", s);
+	return idx;
+}
+
+void c64b_parse_keyboard_init()
+{
+	memset(kb_table, C64B_KB_IDX_NONE, sizeof(kb_table));
+
+	for(unsigned int m = 0; m < KB_MAP_NUM; ++m)
+	{
+		for(unsigned int r = 0; r < kb_layouts[m]->num_rows; ++r)
+		{
+			const t_c64b_kb_row* row = &(kb_layouts[m]->rows[r]);
+			kb_table[m][0][row->usage] = c64b_parse_keyboard_resolve(row->key);
+			kb_table[m][1][row->usage] = c64b_parse_keyboard_resolve(row->key_shft);
+		}
+	}
+
+	kb_idx_lshft = c64b_parse_keyboard_resolve("~lsh~");
+	kb_idx_rshft = c64b_parse_keyboard_resolve("~rsh~");
+}
+
+static bool c64b_parse_keyboard_bound(const uint8_t keys[2], uint8_t key)
+{
+	return (key != 0) && ((key == keys[0]) || (key == keys[1]));
+}
+
 bool c64b_parse_keyboard_keys(uni_keyboard_t* kb, uni_keyboard_t* kb_old)
 {
-	if(kb_map == KB_MAP_SYMBOLIC)
-		return c64b_parse_keyboard_symbolic(kb, kb_old);
-	else
-		return c64b_parse_keyboard_positional(kb, kb_old);
+	bool        ctrl    = false;
+	bool        lshft   = false;
+	bool        rshft   = false;
+	bool        shft    = false;
+	bool        restore = false;
+
+	bool        shft_lock_press = false;
+	static bool shft_lock       = false;
+	static bool shft_lock_old   = false;
+
+	unsigned int            map    = (kb_map < KB_MAP_NUM) ? kb_map : KB_MAP_SYMBOLIC;
+	const t_c64b_kb_layout* layout = kb_layouts[map];
+
+	if(c64b_kb_acquire(KB_OWNER_KBRD))
+	{
+		//------------------------------------------------------------------------------------//
+		// caps lock, ctrl and restore keys
+		shft_lock_press = false;
+		for (int i = 0; i < UNI_KEYBOARD_PRESSED_KEYS_MAX; i++)
+		{
+			const uint8_t key = kb->pressed_keys[i];
+
+			if(key == HID_USAGE_KB_CAPS_LOCK)
+			{
+				if(!shft_lock_old)
+				{
+					shft_lock = !shft_lock;
+					c64b_parser_set_kb_leds(shft_lock ? 0x2 : 0);
+				}
+				shft_lock_press = true;
+			}
+
+			if(c64b_parse_keyboard_bound(layout->ctrl_keys, key))
+				ctrl = true;
+
+			if(c64b_parse_keyboard_bound(layout->rest_keys, key))
+				restore = true;
+		}
+		shft_lock_old = shft_lock_press;
+
+		//------------------------------------------------------------------------------------//
+		// detecting shift
+		lshft = (kb->modifiers & KB_LSHFT_MASK) || shft_lock;
+		rshft = (kb->modifiers & KB_RSHFT_MASK);
+		shft = lshft || rshft;
+
+		//------------------------------------------------------------------------------------//
+		// key modifiers
+		if(ctrl || (kb->modifiers & layout->ctrl_mods))
+			c64b_keyboard_ctrl_psh(&keyboard);
+		else
+			c64b_keyboard_ctrl_rel(&keyboard);
+
+		if(kb->modifiers & layout->cmdr_mods)
+			c64b_keyboard_cmdr_psh(&keyboard);
+		else
+			c64b_keyboard_cmdr_rel(&keyboard);
+
+		if(restore)
+			c64b_keyboard_rest_psh(&keyboard);
+		else
+			c64b_keyboard_rest_rel(&keyboard);
+
+		//------------------------------------------------------------------------------------//
+		// regular keys
+		c64b_keychain_clear();
+		for (int i = 0; i < UNI_KEYBOARD_PRESSED_KEYS_MAX; i++)
+			c64b_keychain_add(kb_table[map][shft][kb->pressed_keys[i]]);
+
+		//------------------------------------------------------------------------------------//
+		// shift-only
+		if(c64b_keychain_get_size() == 0)
+		{
+			if(rshft)
+				c64b_keychain_add(kb_idx_rshft);
+			else if(lshft)
+				c64b_keychain_add(kb_idx_lshft);
+		}
+
+		c64b_keychain_update();
+
+		if(c64b_keychain_get_size() == 0)
+		{
+			c64b_keyboard_keys_rel(&keyboard, true);
+			c64b_kb_release(KB_OWNER_KBRD);
+		}
+		else
+		{
+			c64b_keychain_press_latest();
+		}
+	}
+
+	return (c64b_keychain_get_size() != 0);
 }
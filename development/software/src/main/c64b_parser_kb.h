@@ -28,15 +28,41 @@
 
 #include "c64b_parser.h"
 
-#define MAX_KEYPRESS 8
+#define KEYCHAIN_RING_LEN 16
+
+//----------------------------------------------------------------------------//
+// keyboard maps: each row binds a HID usage to the keys pressed without and
+// with shift, modifiers and restore are bound per map. The rows are expanded
+// into a lookup table by c64b_parse_keyboard_init()
+
+typedef struct
+{
+	uint8_t     usage;
+	const char* key;      // NULL for no key
+	const char* key_shft; // NULL for no key
+} t_c64b_kb_row;
+
+typedef struct
+{
+	const t_c64b_kb_row* rows;
+	unsigned int         num_rows;
+	uint8_t              ctrl_mods;    // modifier masks pressing ctrl and commodore
+	uint8_t              cmdr_mods;
+	uint8_t              ctrl_keys[2]; // HID usages pressing ctrl and restore, 0 for none
+	uint8_t              rest_keys[2];
+} t_c64b_kb_layout;
+
+extern const t_c64b_kb_layout kb_layout_symbolic;
+extern const t_c64b_kb_layout kb_layout_positional;
 
 void    c64b_keychain_clear();
-bool    c64b_keychain_add(const char* s);
+bool    c64b_keychain_add(unsigned int idx);
 uint8_t c64b_keychain_get_size();
 void    c64b_keychain_update();
 bool    c64b_keychain_press_latest();
 
-bool c64b_parse_keyboard_symbolic  (uni_keyboard_t* kb, uni_keyboard_t* kb_old);
-bool c64b_parse_keyboard_positional(uni_keyboard_t* kb, uni_keyboard_t* kb_old);
+unsigned int c64b_keychain_get_order(uint8_t* idx, unsigned int max);
+
+void c64b_parse_keyboard_init();
 
 #endif
@@ -34,6 +34,7 @@
 
 #include "hid_usage.h"
 #include "c64b_parser.h"
+#include "c64b_spp.h"
 
 //----------------------------------------------------------------------------//
 // Globals
@@ -56,6 +57,10 @@ static void c64b_on_init_complete(void) {
 //	uni_bt_del_keys_unsafe();
 //	uni_bt_list_keys_unsafe();
 
+#ifdef CONFIG_C64B_BLE_SPP
+	c64b_spp_init();
+#endif
+
 	logi("c64b: on_init_complete()\n");
 }
 
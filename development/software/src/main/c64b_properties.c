@@ -29,6 +29,8 @@
 
 #include <nvs.h>
 #include <nvs_flash.h>
+#include "esp_system.h"
+#include "esp_rom_crc.h"
 
 #include "c64b_properties.h"
 
@@ -37,22 +39,26 @@
 
 unsigned int kb_map                 = KB_MAP_SYMBOLIC;
 unsigned int af_rate                = 0;
-TickType_t   af_prd                 = (TickType_t)portMAX_DELAY;
 unsigned int scan_time              = 0;
+unsigned int kb_roll                = 0;
+unsigned int kb_pace                = C64B_PACE_PAL;
 unsigned int ct_map[CT_MAP_IDX_NUM] = {0};
 
 const char* ct_map_key[CT_MAP_IDX_NUM] =
 {
-	"c64b.ct_bh",
-	"c64b.ct_bm",
-	"c64b.ct_lt",
-	"c64b.ct_rt",
-	"c64b.ct_ls",
-	"c64b.ct_rs"
+	C64B_PROPERTY_KEY_CT_BH,
+	C64B_PROPERTY_KEY_CT_BM,
+	C64B_PROPERTY_KEY_CT_LT,
+	C64B_PROPERTY_KEY_CT_RT,
+	C64B_PROPERTY_KEY_CT_LS,
+	C64B_PROPERTY_KEY_CT_RS
 };
 
 const uint8_t scan_time_to_minutes[6] = {0, 1, 2, 5, 10, 30};
 
+// rollover slot, 0 means that only the latest key is pressed
+const uint16_t kb_roll_to_us[5] = {0, 1000, 2000, 5000, 20000};
+
 //----------------------------------------------------------------------------//
 // former bluepad32 functions
 
@@ -60,135 +66,334 @@ static const char* STORAGE_NAMESPACE = "bp32";
 
 // Uses NVS for storage. Used in all ESP32 Bluepad32 platforms.
 
-void old_property_set(const char* key, uni_property_type_t type, uni_property_value_t value) {
-    nvs_handle_t nvs_handle;
-    esp_err_t err;
-    uint32_t* float_alias;
-
-    err = nvs_open(STORAGE_NAMESPACE, NVS_READWRITE, &nvs_handle);
-    if (err != ESP_OK) {
-        loge("Could not open readwrite NVS storage, key: %s, err=%#x\n", key, err);
-        return;
+void old_property_init() {
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        logi("Erasing flash\n");
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        err = nvs_flash_init();
     }
+    ESP_ERROR_CHECK(err);
+}
 
-    switch (type) {
-        case UNI_PROPERTY_TYPE_U8:
-            err = nvs_set_u8(nvs_handle, key, value.u8);
-            break;
-        case UNI_PROPERTY_TYPE_U32:
-            err = nvs_set_u32(nvs_handle, key, value.u32);
-            break;
-        case UNI_PROPERTY_TYPE_FLOAT:
-            float_alias = (uint32_t*)&value.f32;
-            err = nvs_set_u32(nvs_handle, key, *float_alias);
-            break;
-        case UNI_PROPERTY_TYPE_STRING:
-            err = nvs_set_str(nvs_handle, key, value.str);
-            break;
-        default:
-    }
+//----------------------------------------------------------------------------//
+// Configuration blob: all the settings are stored in flash as a single record,
+// read once at boot. Values are kept in RAM and the commit task writes the
+// whole record in one NVS transaction once no further change has come for
+// PROP_COMMIT_MS, so a menu action never waits on flash
 
-    if (err != ESP_OK) {
-        loge("Could not store '%s' in NVS, err=%#x\n", key, err);
-        goto out;
-    }
+// position of each setting in the record, new settings are only appended
+static const char* const prop_key[] =
+{
+	C64B_PROPERTY_KEY_KB_MAP,
+	C64B_PROPERTY_KEY_AF_RATE,
+	C64B_PROPERTY_KEY_SCAN_TIME,
+	C64B_PROPERTY_KEY_KB_ROLL,
+	C64B_PROPERTY_KEY_KB_PACE,
+	C64B_PROPERTY_KEY_CT_BH,
+	C64B_PROPERTY_KEY_CT_BM,
+	C64B_PROPERTY_KEY_CT_LT,
+	C64B_PROPERTY_KEY_CT_RT,
+	C64B_PROPERTY_KEY_CT_LS,
+	C64B_PROPERTY_KEY_CT_RS
+};
 
-    err = nvs_commit(nvs_handle);
-    if (err != ESP_OK) {
-        loge("Could not commit '%s' in NVS, err=%#x\n", key, err);
-    }
+#define PROP_NUM (sizeof(prop_key) / sizeof(prop_key[0]))
+
+typedef struct
+{
+	uint32_t crc;                 // over the rest of the stored record
+	uint8_t  version;             // C64B_PROP_VERSION
+	uint8_t  num;                 // values stored, other firmware may store more or less
+	uint16_t rsvd;
+	uint32_t valid;               // bit i: value[i] was set, otherwise its default applies
+	uint8_t  value[PROP_NUM_MAX];
+} t_c64b_prop_blob;
+
+#define PROP_BLOB_HDR (offsetof(t_c64b_prop_blob, value))
+
+static t_c64b_prop_blob  prop_blob;
+static bool              prop_dirty  = false; // prop_blob differs from flash
+static bool              prop_legacy = false; // the per-key values are still in flash
+static SemaphoreHandle_t prop_sem_h  = NULL;  // protects prop_blob
+static SemaphoreHandle_t prop_nvs_h  = NULL;  // serialises the flash accesses
+static TaskHandle_t      prop_task_h = NULL;
+
+_Static_assert(sizeof(prop_key) / sizeof(prop_key[0]) <= PROP_NUM_MAX, "too many properties");
+
+//----------------------------------------------------------------------------//
 
-out:
-    nvs_close(nvs_handle);
+static int prop_find(const char* key)
+{
+	for(unsigned int i = 0; i < PROP_NUM; ++i)
+		if(strcmp(prop_key[i], key) == 0)
+			return i;
+
+	loge("property: unknown key '%s'\n", key);
+	return -1;
 }
 
-uni_property_value_t old_property_get(const char* key, uni_property_type_t type, uni_property_value_t def) {
-    nvs_handle_t nvs_handle;
-    esp_err_t err;
-    uni_property_value_t ret;
-    size_t str_len;
-    static char str_ret[128];
-
-    err = nvs_open(STORAGE_NAMESPACE, NVS_READONLY, &nvs_handle);
-    if (err != ESP_OK) {
-        // Might be valid if no bp32 keys were stored
-        logd("Could not open readonly NVS storage, key:'%s'\n", key);
-        return def;
-    }
+static uint32_t prop_crc(const t_c64b_prop_blob* b, size_t len)
+{
+	return esp_rom_crc32_le(0, (const uint8_t*)b + sizeof(b->crc), len - sizeof(b->crc));
+}
 
-    switch (type) {
-        case UNI_PROPERTY_TYPE_U8:
-            err = nvs_get_u8(nvs_handle, key, &ret.u8);
-            break;
-        case UNI_PROPERTY_TYPE_U32:
-            err = nvs_get_u32(nvs_handle, key, &ret.u32);
-            break;
-        case UNI_PROPERTY_TYPE_FLOAT:
-            err = nvs_get_u32(nvs_handle, key, (uint32_t*)&ret.f32);
-            break;
-        case UNI_PROPERTY_TYPE_STRING:
-            ret.str = str_ret;
-            memset(str_ret, 0, sizeof(str_ret));
-            err = nvs_get_str(nvs_handle, key, str_ret, &str_len);
-            break;
-        default:
-    }
+//----------------------------------------------------------------------------//
+// returns false when the record is missing or not valid, prop_blob is then
+// left empty
 
-    if (err != ESP_OK) {
-        // Might be valid if the key was not previously stored
-        logd("could not read property '%s' from NVS, err=%#x\n", key, err);
-        ret = def;
-        /* falltrhough */
-    }
+static bool prop_load(nvs_handle_t nvs)
+{
+	size_t len = sizeof(prop_blob);
+
+	memset(&prop_blob, 0, sizeof(prop_blob));
+	esp_err_t err = nvs_get_blob(nvs, C64B_PROPERTY_KEY_BLOB, &prop_blob, &len);
+
+	if(err == ESP_ERR_NVS_NOT_FOUND)
+		return false;
+
+	bool ok = (err == ESP_OK) &&
+	          (len >= PROP_BLOB_HDR) &&
+	          (len == PROP_BLOB_HDR + prop_blob.num) &&
+	          (prop_crc(&prop_blob, len) == prop_blob.crc) &&
+	          (prop_blob.version == C64B_PROP_VERSION);
 
-    nvs_close(nvs_handle);
-    return ret;
+	if(!ok)
+	{
+		loge("property: configuration not valid (err=%#x, len=%u, version=%u), using defaults\n",
+			err, (unsigned int)len, prop_blob.version);
+		memset(&prop_blob, 0, sizeof(prop_blob));
+		return false;
+	}
+
+	// values stored by a newer firmware are kept, older records lack the
+	// last ones
+	if(prop_blob.num < PROP_NUM)
+		prop_blob.valid &= (1UL << prop_blob.num) - 1;
+
+	return true;
 }
 
-void old_property_init() {
-    esp_err_t err = nvs_flash_init();
-    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        logi("Erasing flash\n");
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        err = nvs_flash_init();
-    }
-    ESP_ERROR_CHECK(err);
+//----------------------------------------------------------------------------//
+// settings of firmware versions storing one key per value, they are erased
+// with the first commit
+
+static void prop_migrate(nvs_handle_t nvs)
+{
+	for(unsigned int i = 0; i < PROP_NUM; ++i)
+	{
+		if(nvs_get_u8(nvs, prop_key[i], &prop_blob.value[i]) == ESP_OK)
+		{
+			prop_blob.valid |= 1UL << i;
+			prop_legacy = true;
+		}
+	}
+
+	if(prop_legacy)
+	{
+		logi("property: %u legacy values migrated\n", __builtin_popcount(prop_blob.valid));
+		prop_dirty = true;
+		xTaskNotifyGive(prop_task_h);
+	}
+}
+
+//----------------------------------------------------------------------------//
+
+static void task_property_commit(void* arg)
+{
+	while(1)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+		// every further change restarts the wait
+		while(ulTaskNotifyTake(pdTRUE, PROP_COMMIT_MS / portTICK_PERIOD_MS) != 0);
+
+		c64b_property_flush();
+	}
 }
 
 //----------------------------------------------------------------------------//
 // functions
 
+void c64b_property_flush(void)
+{
+	static t_c64b_prop_blob blob;
+	bool                    legacy;
+
+	if(prop_sem_h == NULL)
+		return;
+
+	xSemaphoreTake(prop_nvs_h, portMAX_DELAY);
+
+	// the record is taken as it is now, a change made while it is written
+	// marks it again
+	xSemaphoreTake(prop_sem_h, portMAX_DELAY);
+	bool dirty = prop_dirty;
+	blob       = prop_blob;
+	legacy     = prop_legacy;
+	prop_dirty = false;
+	xSemaphoreGive(prop_sem_h);
+
+	if(dirty)
+	{
+		size_t len = PROP_BLOB_HDR + blob.num;
+		blob.crc   = prop_crc(&blob, len);
+
+		nvs_handle_t nvs;
+		esp_err_t    err = nvs_open(STORAGE_NAMESPACE, NVS_READWRITE, &nvs);
+
+		if(err == ESP_OK)
+		{
+			err = nvs_set_blob(nvs, C64B_PROPERTY_KEY_BLOB, &blob, len);
+
+			for(unsigned int i = 0; (i < PROP_NUM) && legacy && (err == ESP_OK); ++i)
+			{
+				err = nvs_erase_key(nvs, prop_key[i]);
+				if(err == ESP_ERR_NVS_NOT_FOUND)
+					err = ESP_OK;
+			}
+
+			if(err == ESP_OK)
+				err = nvs_commit(nvs);
+
+			nvs_close(nvs);
+		}
+
+		xSemaphoreTake(prop_sem_h, portMAX_DELAY);
+		if(err != ESP_OK)
+		{
+			loge("property: could not commit the configuration, err=%#x\n", err);
+			prop_dirty = true; // retried with the next change
+		}
+		else
+		{
+			logi("property: configuration committed\n");
+			prop_legacy = false;
+		}
+		xSemaphoreGive(prop_sem_h);
+	}
+
+	xSemaphoreGive(prop_nvs_h);
+}
+
+//----------------------------------------------------------------------------//
+// pending changes are dropped with the values in flash
+
 void c64b_property_reset(void)
 {
+	xSemaphoreTake(prop_nvs_h, portMAX_DELAY);
+
+	xSemaphoreTake(prop_sem_h, portMAX_DELAY);
+	memset(&prop_blob, 0, sizeof(prop_blob));
+	prop_dirty  = false;
+	prop_legacy = false;
+	xSemaphoreGive(prop_sem_h);
+
 	ESP_ERROR_CHECK(nvs_flash_erase());
 	old_property_init();
 	ESP_ERROR_CHECK(nvs_flash_init());
+
+	xSemaphoreGive(prop_nvs_h);
 }
 
 
 void c64b_property_set_u8(const char* key, uint8_t value)
 {
-	uni_property_value_t prop;
-	prop.u8 = value;
-	old_property_set(key, UNI_PROPERTY_TYPE_U8, prop);
+	int i = prop_find(key);
+	if(i < 0)
+		return;
+
+	xSemaphoreTake(prop_sem_h, portMAX_DELAY);
+
+	bool changed = (prop_blob.value[i] != value) || !(prop_blob.valid & (1UL << i));
+	if(changed)
+	{
+		prop_blob.value[i] = value;
+		prop_blob.valid   |= 1UL << i;
+		prop_dirty         = true;
+	}
+
+	xSemaphoreGive(prop_sem_h);
+
+	if(changed)
+		xTaskNotifyGive(prop_task_h);
 }
 
 uint8_t c64b_property_get_u8(const char* key, uint8_t def)
 {
-	uni_property_value_t prop;
-	prop.u8 = def;
-	prop = old_property_get(key, UNI_PROPERTY_TYPE_U8, prop);
-	return prop.u8;
+	int     i     = prop_find(key);
+	uint8_t value = def;
+
+	if(i < 0)
+		return def;
+
+	xSemaphoreTake(prop_sem_h, portMAX_DELAY);
+	if(prop_blob.valid & (1UL << i))
+		value = prop_blob.value[i];
+	xSemaphoreGive(prop_sem_h);
+
+	return value;
 }
 
 void c64b_property_init(void)
 {
-	old_property_init();
+	if(prop_sem_h == NULL)
+	{
+		prop_sem_h = xSemaphoreCreateMutex();
+		prop_nvs_h = xSemaphoreCreateMutex();
+
+		old_property_init();
+
+		xTaskCreatePinnedToCore(task_property_commit,
+								"property_commit",
+								1024*3,
+								NULL,
+								PROP_TASK_PRIO,
+								&prop_task_h,
+								PROP_TASK_CORE);
+
+		// a restart does not lose the changes still waiting for the commit
+		esp_register_shutdown_handler(c64b_property_flush);
+	}
+
+	// a single read of the whole configuration, the per-key layout is only
+	// looked up when the record is missing or damaged
+	xSemaphoreTake(prop_nvs_h, portMAX_DELAY);
+	xSemaphoreTake(prop_sem_h, portMAX_DELAY);
+
+	nvs_handle_t nvs;
+	prop_dirty  = false;
+	prop_legacy = false;
+	if(nvs_open(STORAGE_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK)
+	{
+		if(!prop_load(nvs))
+			prop_migrate(nvs);
+		nvs_close(nvs);
+	}
+	else
+	{
+		memset(&prop_blob, 0, sizeof(prop_blob));
+	}
+
+	// the record is written in the layout of this firmware
+	if(prop_blob.num < PROP_NUM)
+		prop_blob.num = PROP_NUM;
+	prop_blob.version = C64B_PROP_VERSION;
+
+	xSemaphoreGive(prop_sem_h);
+	xSemaphoreGive(prop_nvs_h);
+
 	kb_map    = c64b_property_get_u8(C64B_PROPERTY_KEY_KB_MAP, KB_MAP_SYMBOLIC);
 	scan_time = c64b_property_get_u8(C64B_PROPERTY_KEY_SCAN_TIME, 0);
 	af_rate   = c64b_property_get_u8(C64B_PROPERTY_KEY_AF_RATE, 0);
-	if (af_rate != 0)
-		af_prd = (1000 / (TickType_t)af_rate) / portTICK_PERIOD_MS;
+	kb_roll   = c64b_property_get_u8(C64B_PROPERTY_KEY_KB_ROLL, 0);
+	if (kb_roll >= sizeof(kb_roll_to_us) / sizeof(kb_roll_to_us[0]))
+		kb_roll = 0;
+	kb_pace   = c64b_property_get_u8(C64B_PROPERTY_KEY_KB_PACE, C64B_PACE_PAL);
+	if (kb_pace >= C64B_PACE_NUM)
+		kb_pace = C64B_PACE_PAL;
+	if (af_rate >= AF_RATE_NUM)
+		af_rate = 0;
 
 	ct_map[CT_MAP_IDX_BH] = c64b_property_get_u8(ct_map_key[CT_MAP_IDX_BH], C64B_KB_IDX_NONE);
 	ct_map[CT_MAP_IDX_BM] = c64b_property_get_u8(ct_map_key[CT_MAP_IDX_BM], c64b_keyboard_key_to_idx(" "));
@@ -32,15 +32,36 @@
 
 void     c64b_property_reset(void);
 void     c64b_property_init(void);
+void     c64b_property_flush(void);
 void     c64b_property_set_u8(const char* key, uint8_t value);
 uint8_t  c64b_property_get_u8(const char* key, uint8_t def);
 
+#define PROP_NUM_MAX      32   // values a configuration record can hold
+#define C64B_PROP_VERSION 1    // changes only when the meaning of a stored value does
+#define PROP_COMMIT_MS    2000 // quiet time before the changes are committed
+#define PROP_TASK_PRIO    1
+#define PROP_TASK_CORE    1
+
 #define KB_MAP_SYMBOLIC   0
 #define KB_MAP_POSITIONAL 1
+#define KB_MAP_NUM        2
+
+#define AF_RATE_NUM       14
 
 #define C64B_PROPERTY_KEY_KB_MAP    "c64b.kb_map"
 #define C64B_PROPERTY_KEY_AF_RATE   "c64b.af_dly"
 #define C64B_PROPERTY_KEY_SCAN_TIME "c64b.scan_time" // this is expressed in minutes
+#define C64B_PROPERTY_KEY_KB_ROLL   "c64b.kb_roll"   // index in kb_roll_to_us
+#define C64B_PROPERTY_KEY_KB_PACE   "c64b.kb_pace"   // t_c64b_pace
+#define C64B_PROPERTY_KEY_CT_BH     "c64b.ct_bh"
+#define C64B_PROPERTY_KEY_CT_BM     "c64b.ct_bm"
+#define C64B_PROPERTY_KEY_CT_LT     "c64b.ct_lt"
+#define C64B_PROPERTY_KEY_CT_RT     "c64b.ct_rt"
+#define C64B_PROPERTY_KEY_CT_LS     "c64b.ct_ls"
+#define C64B_PROPERTY_KEY_CT_RS     "c64b.ct_rs"
+
+// all the keys above are stored together in this record
+#define C64B_PROPERTY_KEY_BLOB      "c64b.cfg"
 
 typedef enum
 {
@@ -56,10 +77,12 @@ typedef enum
 extern unsigned int  kb_map;
 extern unsigned int  af_rate;
 extern unsigned int  scan_time;
-extern TickType_t    af_prd;
 extern unsigned int  scan_time;
 extern unsigned int  scan_minutes;
 extern const uint8_t scan_time_to_minutes[6];
+extern unsigned int  kb_roll;
+extern unsigned int  kb_pace;
+extern const uint16_t kb_roll_to_us[5];
 extern const char*   ct_map_key[CT_MAP_IDX_NUM];
 extern unsigned int  ct_map[CT_MAP_IDX_NUM];
 
@@ -0,0 +1,284 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+#include <string.h>
+
+#include "c64b_keyboard.h"
+#include "c64b_screen.h"
+
+//----------------------------------------------------------------------------//
+// keystrokes are appended to the output as macro tokens, an output that does
+// not fit leaves the model invalid. Without a buffer they are only counted
+
+typedef struct
+{
+	char*        buf;
+	size_t       len;
+	size_t       max;
+	bool         full;
+	unsigned int keys;
+} t_c64b_scr_out;
+
+static void c64b_screen_put(t_c64b_scr_out* o, const char* tok)
+{
+	o->keys++;
+
+	if(o->buf == NULL)
+		return;
+
+	size_t n = strlen(tok);
+
+	if(o->len + n >= o->max)
+	{
+		o->full = true;
+		return;
+	}
+
+	memcpy(&o->buf[o->len], tok, n + 1);
+	o->len += n;
+}
+
+static void c64b_screen_put_n(t_c64b_scr_out* o, const char* tok, unsigned int n)
+{
+	while(n-- > 0)
+		c64b_screen_put(o, tok);
+}
+
+//----------------------------------------------------------------------------//
+// moves the cursor either directly or from the home position
+
+static unsigned int c64b_screen_dist(unsigned int a, unsigned int b)
+{
+	return (a > b) ? (a - b) : (b - a);
+}
+
+static unsigned int c64b_screen_travel_cost(const t_c64b_screen* s, unsigned int row, unsigned int col)
+{
+	unsigned int direct = c64b_screen_dist(s->row, row) + c64b_screen_dist(s->col, col);
+	unsigned int home   = 1 + row + col;
+
+	return (home < direct) ? home : direct;
+}
+
+static void c64b_screen_travel(t_c64b_screen* s, t_c64b_scr_out* o, unsigned int row, unsigned int col)
+{
+	unsigned int direct = c64b_screen_dist(s->row, row) + c64b_screen_dist(s->col, col);
+
+	if(1 + row + col < direct)
+	{
+		c64b_screen_put(o, "~home~");
+		s->row = 0;
+		s->col = 0;
+	}
+
+	c64b_screen_put_n(o, (row > s->row) ? "~dn~" : "~up~", c64b_screen_dist(s->row, row));
+	c64b_screen_put_n(o, (col > s->col) ? "~rr~" : "~ll~", c64b_screen_dist(s->col, col));
+	s->row = row;
+	s->col = col;
+}
+
+//----------------------------------------------------------------------------//
+
+static unsigned int c64b_screen_quotes(const uint8_t* keys, unsigned int from, unsigned int to, uint8_t quote)
+{
+	unsigned int n = 0;
+
+	for(unsigned int i = from; i < to; ++i)
+		if(keys[i] == quote)
+			n++;
+	return n;
+}
+
+//----------------------------------------------------------------------------//
+// Two edits are compared once the common prefix and suffix are known:
+// overwriting everything from the first to the last difference, blanking the
+// old tail with spaces, or, when the length changes, deleting or inserting
+// the difference in front of the middle part so that the suffix is shifted
+// instead of typed again. Deletes are typed from the right end of the removed
+// cells, inserts open blanks that the following characters fill
+
+static void c64b_screen_edit(t_c64b_screen* s, t_c64b_scr_out* o, unsigned int row, const uint8_t* keys, unsigned int n)
+{
+	const uint8_t  space = c64b_keyboard_key_to_idx(" ");
+	const uint8_t  quote = c64b_keyboard_key_to_idx("\"");
+	uint8_t*       old   = s->cell[row];
+	unsigned int   lo    = s->len[row];
+	unsigned int   p     = 0;
+	unsigned int   sfx   = 0;
+
+	while((p < lo) && (p < n) && (old[p] == keys[p]))
+		p++;
+
+	if((p == lo) && (p == n))
+		return;
+
+	while((sfx < lo - p) && (sfx < n - p) && (old[lo - 1 - sfx] == keys[n - 1 - sfx]))
+		sfx++;
+
+	// overwrite, the span is widened up to a quote when it would leave quote
+	// mode on. The line itself always has paired quotes
+	unsigned int a_from = p;
+	unsigned int a_to   = (lo == n) ? (n - sfx) : ((lo > n) ? lo : n);
+
+	if(c64b_screen_quotes(keys, a_from, (a_to < n) ? a_to : n, quote) & 1)
+	{
+		unsigned int i = a_to;
+		while((i < n) && (keys[i] != quote))
+			i++;
+
+		if(i < n)
+		{
+			a_to = i + 1;
+		}
+		else
+		{
+			while((a_from > 0) && (keys[a_from - 1] != quote))
+				a_from--;
+			if(a_from > 0)
+				a_from--;
+		}
+	}
+
+	unsigned int a_cost = c64b_screen_travel_cost(s, row, a_from) + (a_to - a_from);
+
+	// shift, only when the typed middle part has paired quotes
+	unsigned int k      = (lo > n) ? (lo - n) : (n - lo);
+	unsigned int mid    = n - p - sfx;
+	unsigned int b_col  = (lo > n) ? (p + k) : p;
+	bool         b_ok   = (k > 0) && !(c64b_screen_quotes(keys, p, p + mid, quote) & 1);
+	unsigned int b_cost = c64b_screen_travel_cost(s, row, b_col) + k + mid;
+
+	if(b_ok && (b_cost < a_cost))
+	{
+		c64b_screen_travel(s, o, row, b_col);
+		c64b_screen_put_n(o, (lo > n) ? "~del~" : "~inst~", k);
+		s->col = p;
+
+		for(unsigned int i = p; i < p + mid; ++i)
+			c64b_screen_put(o, KEY_IDS[keys[i]].str);
+		s->col = p + mid;
+	}
+	else
+	{
+		c64b_screen_travel(s, o, row, a_from);
+
+		for(unsigned int i = a_from; i < a_to; ++i)
+			c64b_screen_put(o, KEY_IDS[(i < n) ? keys[i] : space].str);
+		s->col = a_to;
+	}
+
+	if(n > 0)
+		memcpy(old, keys, n);
+	s->len[row] = n;
+
+	// no pairing was possible, the next edit starts from a cleared screen
+	if(c64b_screen_quotes(keys, 0, n, quote) & 1)
+		s->valid = false;
+}
+
+//----------------------------------------------------------------------------//
+
+void c64b_screen_reset(t_c64b_screen* s)
+{
+	if(s == NULL)
+		return;
+
+	s->valid = false;
+}
+
+//----------------------------------------------------------------------------//
+
+static void c64b_screen_apply(t_c64b_screen* s, t_c64b_scr_out* o, unsigned int row, const uint8_t* keys, unsigned int n, bool clr)
+{
+	if(clr)
+	{
+		c64b_screen_put(o, "~clr~");
+		s->row   = 0;
+		s->col   = 0;
+		s->valid = true;
+
+		for(unsigned int r = 0; r < SCR_ROWS; ++r)
+		{
+			uint8_t      upper[SCR_LINE_MAX];
+			unsigned int len = s->len[r];
+
+			memcpy(upper, s->cell[r], len);
+			s->len[r] = 0;
+
+			if(r < row)
+				c64b_screen_edit(s, o, r, upper, len);
+		}
+	}
+
+	c64b_screen_edit(s, o, row, keys, n);
+
+	for(unsigned int r = row + 1; r < SCR_ROWS; ++r)
+		c64b_screen_edit(s, o, r, NULL, 0);
+}
+
+//----------------------------------------------------------------------------//
+// Sets the given row to text, the deeper rows are emptied. The screen is
+// cleared and the upper rows are typed again from the model when the model no
+// longer matches the screen, or when that takes fewer keystrokes than editing.
+// Returns true in that case, the keystrokes then do not depend on the
+// previous content of the screen
+
+bool c64b_screen_line(t_c64b_screen* s, unsigned int row, const char* text, char* out, size_t out_len)
+{
+	if((s == NULL) || (text == NULL) || (out == NULL) || (out_len == 0) || (row >= SCR_ROWS))
+		return false;
+
+	const uint8_t  space = c64b_keyboard_key_to_idx(" ");
+	uint8_t        keys[SCR_LINE_MAX];
+	unsigned int   n     = c64b_keyboard_screen_keys(text, keys, SCR_LINE_MAX);
+	bool           clr   = !s->valid;
+	t_c64b_scr_out o     = {.buf = out, .len = 0, .max = out_len, .full = false, .keys = 0};
+
+	out[0] = 0;
+
+	while((n > 0) && (keys[n - 1] == space))
+		n--;
+
+	if(!clr)
+	{
+		t_c64b_scr_out edit  = {.buf = NULL};
+		t_c64b_scr_out paint = {.buf = NULL};
+		t_c64b_screen  tmp;
+
+		tmp = *s;
+		c64b_screen_apply(&tmp, &edit, row, keys, n, false);
+		tmp = *s;
+		c64b_screen_apply(&tmp, &paint, row, keys, n, true);
+
+		clr = (paint.keys < edit.keys);
+	}
+
+	c64b_screen_apply(s, &o, row, keys, n, clr);
+
+	if(o.full)
+		s->valid = false;
+
+	return clr;
+}
@@ -0,0 +1,58 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+#ifndef C64B_SCREEN_H
+#define C64B_SCREEN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+//----------------------------------------------------------------------------//
+// Model of the text typed by the menus on the C64 screen. A row is turned into
+// its new content with the fewest keystrokes, using cursor moves, overwrites,
+// deletes and inserts. Quote mode of the screen editor is never left on after
+// an edit, otherwise the cursor keys of the next one would be printed
+
+#define SCR_ROWS     3               // one row per menu level
+#define SCR_COLS     40
+#define SCR_LINE_MAX (SCR_COLS - 1)  // typing in the last column links the next row
+#define SCR_OUT_LEN  2048            // keystrokes of a repaint of all rows
+
+typedef struct
+{
+	uint8_t      cell[SCR_ROWS][SCR_LINE_MAX]; // key index of every character
+	uint8_t      len[SCR_ROWS];
+	unsigned int row;                          // cursor position
+	unsigned int col;
+	bool         valid;                        // the screen matches the model
+} t_c64b_screen;
+
+//----------------------------------------------------------------------------//
+
+void c64b_screen_reset(t_c64b_screen* s);
+bool c64b_screen_line (t_c64b_screen* s, unsigned int row, const char* text, char* out, size_t out_len);
+
+#endif
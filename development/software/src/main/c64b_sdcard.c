@@ -0,0 +1,159 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+#include <uni.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "driver/gpio.h"
+#include "soc/io_mux_reg.h"
+#include "soc/gpio_periph.h"
+#include "soc/soc.h"
+
+#include "c64b_sdcard.h"
+
+// SDMMC includes
+#include "esp_vfs_fat.h"
+#include "sdmmc_cmd.h"
+#include "driver/sdmmc_host.h"
+
+//----------------------------------------------------------------------------//
+// slot 1 is routed through the IO_MUX on fixed pins, 1-bit mode only uses
+// CLK, CMD and D0. In 4-bit mode D1-D3 take KRA0, ROW3 and ROW4 as well
+
+#ifdef CONFIG_C64B_SDCARD_4BIT
+#define SDCARD_WIDTH 4
+#define SDCARD_PINS  6
+#else
+#define SDCARD_WIDTH 1
+#define SDCARD_PINS  3
+#endif
+
+static const unsigned int sd_pins[SDCARD_PINS] =
+{
+	14, 15, 2,   // CLK, CMD, D0
+#ifdef CONFIG_C64B_SDCARD_4BIT
+	4, 12, 13    // D1, D2, D3
+#endif
+};
+static uint32_t           sd_mux[SDCARD_PINS];
+
+static sdmmc_card_t*      card = NULL;
+static SemaphoreHandle_t  sd_sem_h = NULL; // held from mount to unmount
+
+//----------------------------------------------------------------------------//
+
+void c64b_sdcard_init(void)
+{
+	if(sd_sem_h == NULL)
+		sd_sem_h = xSemaphoreCreateMutex();
+}
+
+//----------------------------------------------------------------------------//
+// the card is used by one task at a time, a second mount waits for the first
+// one to be undone
+
+bool c64b_sdcard_mount(void)
+{
+	xSemaphoreTake(sd_sem_h, portMAX_DELAY);
+
+	// Options for mounting the filesystem.
+	// If format_if_mount_failed is set to true, SD card will be partitioned and
+	// formatted in case when mounting fails.
+	esp_vfs_fat_sdmmc_mount_config_t mount_config = {
+		.format_if_mount_failed = false,
+		.max_files = 5,
+		.allocation_unit_size = 16 * 1024
+	};
+
+	sdmmc_host_t host = SDMMC_HOST_DEFAULT();
+#ifdef CONFIG_C64B_SDCARD_HIGHSPEED
+	host.max_freq_khz = SDMMC_FREQ_HIGHSPEED;
+#endif
+#ifndef CONFIG_C64B_SDCARD_4BIT
+	host.flags &= ~SDMMC_HOST_FLAG_4BIT;
+#endif
+
+	sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT();
+
+	slot_config.width = SDCARD_WIDTH;
+	slot_config.flags = 0;
+
+	if(esp_vfs_fat_sdmmc_mount(SDCARD_MOUNT_POINT, &host, &slot_config, &mount_config, &card) != ESP_OK)
+	{
+		card = NULL;
+		c64b_sdcard_detach();
+		xSemaphoreGive(sd_sem_h);
+		return false;
+	}
+
+	// the pin functions set up by the host are restored on every attach
+	for(unsigned int i = 0; i < SDCARD_PINS; ++i)
+		sd_mux[i] = REG_READ(GPIO_PIN_MUX_REG[sd_pins[i]]);
+
+	return true;
+}
+
+//----------------------------------------------------------------------------//
+
+void c64b_sdcard_unmount(void)
+{
+	if(card == NULL)
+		return;
+
+	c64b_sdcard_attach();
+	esp_vfs_fat_sdcard_unmount(SDCARD_MOUNT_POINT, card);
+	card = NULL;
+	c64b_sdcard_detach();
+
+	xSemaphoreGive(sd_sem_h);
+}
+
+//----------------------------------------------------------------------------//
+// the C64 sees the card traffic on ROW1, CTRL and CMDR while attached, which
+// is harmless as long as no key is held through the matrix
+
+void c64b_sdcard_attach(void)
+{
+	if(card == NULL)
+		return;
+
+	for(unsigned int i = 0; i < SDCARD_PINS; ++i)
+		REG_WRITE(GPIO_PIN_MUX_REG[sd_pins[i]], sd_mux[i]);
+}
+
+//----------------------------------------------------------------------------//
+// the output registers still hold the levels last written by the keyboard, so
+// the lines come back in the state the feed engine left them
+
+void c64b_sdcard_detach(void)
+{
+	for(unsigned int i = 0; i < SDCARD_PINS; ++i)
+	{
+		PIN_FUNC_SELECT(GPIO_PIN_MUX_REG[sd_pins[i]], PIN_FUNC_GPIO);
+		gpio_set_direction(sd_pins[i], GPIO_MODE_OUTPUT);
+	}
+}
@@ -0,0 +1,47 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+#ifndef C64B_SDCARD_H
+#define C64B_SDCARD_H
+
+#include <stdbool.h>
+
+//----------------------------------------------------------------------------//
+// The sd-card slot shares its lines with the keyboard: CLK with ROW1, D0 with
+// CTRL and CMD with CMDR (4-bit mode adds D1-D3 on KRA0, ROW3 and ROW4). While
+// the card is mounted the pins are handed back and forth: the card gets them
+// only while the feed engine holds no key. A failed mount and an unmount leave
+// them to the keyboard
+
+#define SDCARD_MOUNT_POINT "/s"
+
+void c64b_sdcard_init   (void);
+bool c64b_sdcard_mount  (void);
+void c64b_sdcard_unmount(void);
+
+void c64b_sdcard_attach (void);
+void c64b_sdcard_detach (void);
+
+#endif
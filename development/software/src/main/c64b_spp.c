@@ -0,0 +1,348 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+#include <stdint.h>
+#include <string.h>
+#include <uni.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "btstack_event.h"
+#include "btstack_run_loop.h"
+#include "bluetooth_data_types.h"
+#include "gap.h"
+#include "ble/att_server.h"
+#include "ble/gatt-service/nordic_spp_service_server.h"
+
+#include "c64b_spp.h"
+#include "c64b_parser.h"
+#include "c64b_typein.h"
+
+// ATT database compiled from c64b_spp.gatt at build time
+#include "c64b_spp_gatt.h"
+
+#define SPP_ESC_NONE SPP_STR_LEN
+
+//----------------------------------------------------------------------------//
+// the received text goes from the BTstack thread to the keyboard feed thread
+// through a single-producer single-consumer ring. Everything else is only
+// touched by the BTstack thread, apart from the active flag
+
+typedef struct
+{
+	uint8_t          buf[SPP_RX_LEN];
+	uint32_t         head;    // written by the consumer only
+	uint32_t         tail;    // written by the producer only
+	bool             active;  // a feed job is queued or running
+	// BTstack thread
+	hci_con_handle_t con;
+	uint32_t         owed;    // bytes granted and not received yet
+	uint32_t         drops;
+	bool             sending;
+	btstack_context_callback_registration_t grant_reg;
+	btstack_context_callback_registration_t send_reg;
+} t_c64b_spp;
+
+static t_c64b_spp spp = {.con = HCI_CON_HANDLE_INVALID};
+static char       spp_str[SPP_STR_LEN];
+
+static const uint8_t adv_data[] =
+{
+	0x02, BLUETOOTH_DATA_TYPE_FLAGS, 0x06,
+	0x08, BLUETOOTH_DATA_TYPE_COMPLETE_LOCAL_NAME, 'B', 'l', 'u', 'e', '-', '6', '4',
+	0x11, BLUETOOTH_DATA_TYPE_COMPLETE_LIST_OF_128_BIT_SERVICE_CLASS_UUIDS,
+	0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5, 0xa9, 0xe0, 0x93, 0xf3, 0xa3, 0xb5, 0x01, 0x00, 0x40, 0x6e
+};
+
+//----------------------------------------------------------------------------//
+
+static uint32_t spp_used(void)
+{
+	return __atomic_load_n(&(spp.tail), __ATOMIC_ACQUIRE) - __atomic_load_n(&(spp.head), __ATOMIC_ACQUIRE);
+}
+
+//----------------------------------------------------------------------------//
+
+static bool spp_pop(uint8_t* c)
+{
+	uint32_t head = spp.head;
+	uint32_t tail = __atomic_load_n(&(spp.tail), __ATOMIC_ACQUIRE);
+
+	if(head == tail)
+		return false;
+
+	*c = spp.buf[head & (SPP_RX_LEN - 1)];
+	__atomic_store_n(&(spp.head), head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+//----------------------------------------------------------------------------//
+// the space that is neither used nor promised can be granted, so the ring
+// never overflows whatever the sender does with its credits
+
+static uint32_t spp_grantable(void)
+{
+	return SPP_RX_LEN - spp_used() - spp.owed;
+}
+
+//----------------------------------------------------------------------------//
+
+static void spp_send(void* ctx)
+{
+	spp.sending = false;
+
+	uint32_t grant = spp_grantable();
+	if((spp.con == HCI_CON_HANDLE_INVALID) || (grant == 0))
+		return;
+
+	uint8_t msg[2];
+	little_endian_store_16(msg, 0, (uint16_t)grant);
+
+	if(nordic_spp_service_server_send(spp.con, msg, sizeof(msg)) == ERROR_CODE_SUCCESS)
+		spp.owed += grant;
+}
+
+//----------------------------------------------------------------------------//
+// runs on the BTstack thread, also on behalf of the feed thread once it has
+// made room
+
+static void spp_grant(void* ctx)
+{
+	if((spp.con == HCI_CON_HANDLE_INVALID) || spp.sending)
+		return;
+
+	if(spp_grantable() < SPP_GRANT_MIN)
+		return;
+
+	spp.sending = true;
+	nordic_spp_service_server_request_can_send_now(&spp.send_reg, spp.con);
+}
+
+//----------------------------------------------------------------------------//
+// text beyond the credits is dropped, the ring has only room for the granted
+// bytes
+
+static void spp_rx(const uint8_t* data, uint16_t size)
+{
+	if(size > spp.owed)
+	{
+		spp.drops += size - spp.owed;
+		loge("spp: %u bytes sent without credits, dropped\n", (unsigned int)(size - spp.owed));
+		size = spp.owed;
+	}
+	spp.owed -= size;
+
+	uint32_t tail = spp.tail;
+	for(uint16_t i = 0; i < size; ++i)
+		spp.buf[(tail + i) & (SPP_RX_LEN - 1)] = data[i];
+	__atomic_store_n(&(spp.tail), tail + size, __ATOMIC_RELEASE);
+
+	if((size > 0) && !__atomic_exchange_n(&(spp.active), true, __ATOMIC_ACQ_REL))
+	{
+		// with the macro queue full the text waits for the next packet
+		if(!keyboard_macro_stream(c64b_spp_feed, ""))
+			__atomic_store_n(&(spp.active), false, __ATOMIC_RELEASE);
+	}
+}
+
+//----------------------------------------------------------------------------//
+
+static void spp_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t* packet, uint16_t size)
+{
+	switch(packet_type)
+	{
+		case HCI_EVENT_PACKET:
+			if(hci_event_packet_get_type(packet) != HCI_EVENT_GATTSERVICE_META)
+				break;
+
+			switch(hci_event_gattservice_meta_get_subevent_code(packet))
+			{
+				// the credits of a previous sender are void, the text it has
+				// already sent is still typed
+				case GATTSERVICE_SUBEVENT_SPP_SERVICE_CONNECTED:
+					spp.con  = gattservice_subevent_spp_service_connected_get_con_handle(packet);
+					spp.owed = 0;
+					logi("spp: connected\n");
+					spp_grant(NULL);
+					break;
+
+				case GATTSERVICE_SUBEVENT_SPP_SERVICE_DISCONNECTED:
+					spp.con  = HCI_CON_HANDLE_INVALID;
+					spp.owed = 0;
+					logi("spp: disconnected\n");
+					break;
+
+				default:
+					break;
+			}
+			break;
+
+		case RFCOMM_DATA_PACKET:
+			spp_rx(packet, size);
+			break;
+
+		default:
+			break;
+	}
+}
+
+//----------------------------------------------------------------------------//
+// called from the BTstack thread once the stack is up, the service owns the
+// ATT database
+
+void c64b_spp_init(void)
+{
+	spp.grant_reg.callback = &spp_grant;
+	spp.send_reg.callback  = &spp_send;
+
+	att_server_init(profile_data, NULL, NULL);
+	nordic_spp_service_server_init(&spp_packet_handler);
+
+	bd_addr_t null_addr = {0};
+	gap_advertisements_set_params(0x0030, 0x0030, 0, 0, null_addr, 0x07, 0x00);
+	gap_advertisements_set_data(sizeof(adv_data), (uint8_t*)adv_data);
+	gap_advertisements_enable(1);
+
+	logi("spp: advertising\n");
+}
+
+//----------------------------------------------------------------------------//
+
+static void spp_flush(t_c64b_keyboard* h, size_t* n, bool ret, size_t* bytes)
+{
+	// the room made in the ring is granted while the text is being typed
+	btstack_run_loop_execute_on_main_thread(&spp.grant_reg);
+
+	spp_str[*n] = 0;
+	if(!c64b_keyboard_feed_str(h, spp_str))
+		loge("spp: text not typed\n");
+
+	*bytes += *n;
+	*n      = 0;
+
+	if(ret)
+		vTaskDelay(c64b_typein_pause_us(*bytes) / 1000 / portTICK_PERIOD_MS);
+}
+
+//----------------------------------------------------------------------------//
+// Runs as a macro job on the keyboard feed thread until no text has arrived
+// for SPP_IDLE_MS. The text is turned into macro strings, see
+// c64b_keyboard_text_key(), which are cut after every RETURN so that the
+// KERNAL is given the time to store BASIC lines. An escape is never cut, one
+// left open is dropped
+
+bool c64b_spp_feed(t_c64b_keyboard* h, const char* arg)
+{
+	size_t   n       = 0;
+	size_t   esc     = SPP_ESC_NONE;
+	size_t   bytes   = 0;
+	uint32_t idle    = 0;
+	uint32_t skipped = 0;
+	uint8_t  prev    = 0;
+
+	while(true)
+	{
+		uint8_t c;
+
+		if(spp_pop(&c))
+		{
+			char        ch[2];
+			const char* k;
+			bool        ret;
+
+			idle = 0;
+
+			// CR LF ends a single line
+			if((c == 0x0a) && (prev == 0x0d))
+				continue;
+			prev = c;
+
+			if(esc != SPP_ESC_NONE)
+			{
+				k = c64b_keyboard_text_key(c, ch);
+				if((k != NULL) && (strlen(k) == 1) && (n - esc < SPP_ESC_MAX))
+				{
+					spp_str[n++] = k[0];
+					if(c == '~')
+						esc = SPP_ESC_NONE;
+					continue;
+				}
+
+				// the character is then typed as text
+				loge("spp: malformed escape dropped\n");
+				n   = esc;
+				esc = SPP_ESC_NONE;
+			}
+
+			k = c64b_keyboard_text_key(c, ch);
+			if(k == NULL)
+			{
+				++skipped;
+				continue;
+			}
+
+			if(c == '~')
+				esc = n;
+			ret = (strcmp(k, "~ret~") == 0);
+
+			size_t m = strlen(k);
+			memcpy(&spp_str[n], k, m);
+			n += m;
+
+			if((esc == SPP_ESC_NONE) && (ret || (n >= SPP_STR_FLUSH)))
+				spp_flush(h, &n, ret, &bytes);
+		}
+		else if((n > 0) && (esc == SPP_ESC_NONE))
+		{
+			spp_flush(h, &n, false, &bytes);
+		}
+		else if(idle < SPP_IDLE_MS)
+		{
+			vTaskDelay(SPP_POLL_MS / portTICK_PERIOD_MS);
+			idle += SPP_POLL_MS;
+		}
+		else
+		{
+			if(esc != SPP_ESC_NONE)
+			{
+				loge("spp: unterminated escape dropped\n");
+				n   = esc;
+				esc = SPP_ESC_NONE;
+				continue;
+			}
+
+			// text received after the flag is cleared posts a new job,
+			// text received just before it is fed by this one
+			__atomic_store_n(&(spp.active), false, __ATOMIC_RELEASE);
+			if((spp_used() == 0) || __atomic_exchange_n(&(spp.active), true, __ATOMIC_ACQ_REL))
+				break;
+			idle = 0;
+		}
+	}
+
+	logi("spp: %u bytes typed, %u without a key\n", (unsigned int)bytes, (unsigned int)skipped);
+	return true;
+}
@@ -0,0 +1,55 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+#ifndef C64B_SPP_H
+#define C64B_SPP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "c64b_keyboard.h"
+
+//----------------------------------------------------------------------------//
+// BLE text channel on the Nordic SPP-like service: text or PETSCII written to
+// the RX characteristic is typed through the keyboard feed. Flow control is
+// credit based: the device notifies on the TX characteristic how many more
+// bytes it accepts (16 bit, little endian) and the sender must not write more
+// than granted. Credits are returned as the feed consumes the received text,
+// so a sender streaming a whole program runs at the typing rate
+
+#define SPP_RX_LEN     1024  // received text waiting for the feed, power of two
+#define SPP_GRANT_MIN  256   // smallest credit notification
+#define SPP_STR_LEN    192   // macro string fed at once
+#define SPP_STR_FLUSH  128   // fed once this long, outside of an escape
+#define SPP_ESC_MAX    16    // longest escape, "~ctrl-psh~" and the like
+#define SPP_POLL_MS    10
+#define SPP_IDLE_MS    500   // the feed job ends after this long without text
+
+//----------------------------------------------------------------------------//
+
+void c64b_spp_init(void);
+bool c64b_spp_feed(t_c64b_keyboard* h, const char* arg);
+
+#endif
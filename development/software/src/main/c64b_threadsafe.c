@@ -31,10 +31,138 @@ SemaphoreHandle_t feed_sem_h;
 
 //----------------------------------------------------------------------------//
 
-QueueHandle_t queue_ctl_data[3];
-QueueHandle_t queue_ctl_fbak;
+t_c64b_input_ring input_ring[3];
+QueueHandle_t     queue_ctl_fbak;
 
 //----------------------------------------------------------------------------//
-SemaphoreHandle_t kbrd_sem_h;
-t_c64b_keyboard   keyboard   = {0};
-t_c64b_kb_owner   kb_owner   = KB_OWNER_NONE;
+t_c64b_keyboard    keyboard       = {0};
+t_c64b_kb_owner    kb_owner       = KB_OWNER_NONE;
+EventGroupHandle_t kb_evt_h       = NULL;
+TaskHandle_t       kb_intent_task = NULL;
+uint32_t           kb_defer_cnt[KB_OWNER_COUNT] = {0};
+
+static uint32_t    kb_intent      = 0;
+
+#define KB_EVT_FREE (1 << 0)
+
+//----------------------------------------------------------------------------//
+
+void c64b_kb_init(void)
+{
+	kb_owner = KB_OWNER_NONE;
+	kb_evt_h = xEventGroupCreate();
+	xEventGroupSetBits(kb_evt_h, KB_EVT_FREE);
+}
+
+//----------------------------------------------------------------------------//
+// the token is kept by an owner taking it again, the parser devices leave
+// their intent when they lose. The owner may release between the failed
+// attempt and the intent being set, so the token is tried once more after
+// it: either that succeeds or the release still to come sees the intent
+
+bool c64b_kb_acquire(t_c64b_kb_owner who)
+{
+	t_c64b_kb_owner cur = KB_OWNER_NONE;
+
+	if(__atomic_compare_exchange_n(&kb_owner, &cur, who, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return true;
+
+	if(cur == who)
+		return true;
+
+	if(who <= KB_OWNER_CTL2)
+	{
+		__atomic_fetch_or(&kb_intent, 1 << who, __ATOMIC_ACQ_REL);
+
+		cur = KB_OWNER_NONE;
+		if(__atomic_compare_exchange_n(&kb_owner, &cur, who, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		{
+			__atomic_fetch_and(&kb_intent, ~(1 << who), __ATOMIC_ACQ_REL);
+			return true;
+		}
+	}
+
+	kb_defer_cnt[who]++;
+	return false;
+}
+
+//----------------------------------------------------------------------------//
+// for tasks that can afford to wait, the event bit is cleared before every
+// attempt so that a release in between is never missed
+
+bool c64b_kb_acquire_wait(t_c64b_kb_owner who, TickType_t ticks)
+{
+	TickType_t start  = xTaskGetTickCount();
+	bool       defer  = false;
+
+	while(1)
+	{
+		xEventGroupClearBits(kb_evt_h, KB_EVT_FREE);
+
+		t_c64b_kb_owner cur = KB_OWNER_NONE;
+		if(__atomic_compare_exchange_n(&kb_owner, &cur, who, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) || (cur == who))
+			return true;
+
+		if(!defer)
+		{
+			kb_defer_cnt[who]++;
+			defer = true;
+		}
+
+		TickType_t spent = xTaskGetTickCount() - start;
+		if((ticks != portMAX_DELAY) && (spent >= ticks))
+			return false;
+
+		xEventGroupWaitBits(kb_evt_h, KB_EVT_FREE, pdFALSE, pdFALSE,
+		                    (ticks == portMAX_DELAY) ? portMAX_DELAY : (ticks - spent));
+	}
+}
+
+//----------------------------------------------------------------------------//
+
+void c64b_kb_release(t_c64b_kb_owner who)
+{
+	t_c64b_kb_owner cur = who;
+
+	if(!__atomic_compare_exchange_n(&kb_owner, &cur, KB_OWNER_NONE, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return;
+
+	xEventGroupSetBits(kb_evt_h, KB_EVT_FREE);
+
+	uint32_t intent = __atomic_exchange_n(&kb_intent, 0, __ATOMIC_ACQ_REL);
+	if((intent != 0) && (kb_intent_task != NULL))
+		xTaskNotify(kb_intent_task, intent << KB_INTENT_SHIFT, eSetBits);
+}
+
+//----------------------------------------------------------------------------//
+// takes the token away from a parser device, the feed keeps it until the
+// macro is complete
+
+void c64b_kb_revoke(void)
+{
+	t_c64b_kb_owner cur = __atomic_load_n(&kb_owner, __ATOMIC_ACQUIRE);
+
+	while((cur == KB_OWNER_KBRD) || (cur == KB_OWNER_CTL1) || (cur == KB_OWNER_CTL2))
+	{
+		if(__atomic_compare_exchange_n(&kb_owner, &cur, KB_OWNER_NONE, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		{
+			xEventGroupSetBits(kb_evt_h, KB_EVT_FREE);
+			return;
+		}
+	}
+}
+
+//----------------------------------------------------------------------------//
+
+void c64b_kb_seize(t_c64b_kb_owner who)
+{
+	c64b_kb_revoke();
+	c64b_kb_acquire_wait(who, portMAX_DELAY);
+}
+
+//----------------------------------------------------------------------------//
+
+bool c64b_kb_owned(t_c64b_kb_owner who)
+{
+	return __atomic_load_n(&kb_owner, __ATOMIC_ACQUIRE) == who;
+}
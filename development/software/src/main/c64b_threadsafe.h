@@ -29,8 +29,10 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
+#include "freertos/event_groups.h"
 
 #include "c64b_keyboard.h"
+#include "c64b_input.h"
 #include "c64b_properties.h"
 
 typedef enum
@@ -40,6 +42,7 @@ typedef enum
 	KB_OWNER_CTL1,
 	KB_OWNER_CTL2,
 	KB_OWNER_FEED,
+	KB_OWNER_SYS,   // resets and port swaps
 	KB_OWNER_COUNT
 } t_c64b_kb_owner;
 
@@ -53,16 +56,35 @@ typedef struct
 // unprotected
 
 //----------------------------------------------------------------------------//
-extern SemaphoreHandle_t kbrd_sem_h; // protects access to keyboard keystrokes
+// Keyboard ownership: only the owner drives the keyboard lines. The token is
+// taken with a compare-and-swap, a parser device that fails to take it leaves
+// a pending intent and the parser task is notified with KB_INTENT_BIT(owner)
+// when the token is released, so that the latest state of the device is
+// applied instead of being lost
+
+#define KB_INTENT_SHIFT   8
+#define KB_INTENT_BIT(o)  (1 << (KB_INTENT_SHIFT + (o)))
+
 extern t_c64b_keyboard   keyboard;
 extern t_c64b_kb_owner   kb_owner;
+extern EventGroupHandle_t kb_evt_h;      // signals the release of the token
+extern TaskHandle_t      kb_intent_task; // notified of the pending intents
+extern uint32_t          kb_defer_cnt[KB_OWNER_COUNT];
+
+void c64b_kb_init(void);
+bool c64b_kb_acquire(t_c64b_kb_owner who);
+bool c64b_kb_acquire_wait(t_c64b_kb_owner who, TickType_t ticks);
+void c64b_kb_release(t_c64b_kb_owner who);
+void c64b_kb_revoke(void);
+void c64b_kb_seize(t_c64b_kb_owner who);
+bool c64b_kb_owned(t_c64b_kb_owner who);
 
 //----------------------------------------------------------------------------//
-extern QueueHandle_t queue_ctl_data[3];
-extern QueueHandle_t queue_ctl_fbak;
+extern t_c64b_input_ring input_ring[3]; // single producer, single consumer
+extern QueueHandle_t     queue_ctl_fbak;
 
 //----------------------------------------------------------------------------//
-extern SemaphoreHandle_t mcro_sem_h; // protects access to keyboard macro
-extern SemaphoreHandle_t feed_sem_h; // starts keyboaard feed thread
+extern SemaphoreHandle_t mcro_sem_h; // protects the keyboard macro job queue
+extern SemaphoreHandle_t feed_sem_h; // wakes up the keyboard feed thread
 
 #endif
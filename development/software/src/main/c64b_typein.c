@@ -0,0 +1,290 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <uni.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+#include "c64b_typein.h"
+#include "c64b_sdcard.h"
+
+//----------------------------------------------------------------------------//
+// one block is being typed while the other one is read ahead. The reader is
+// only used by the keyboard feed thread
+
+typedef struct
+{
+	FILE*        f;
+	char         blk[2][TYPEIN_BLK];
+	size_t       len[2];  // valid bytes, 0 once the block has been typed
+	size_t       pos;     // next byte of the current block
+	unsigned int cur;
+	bool         eof;
+} t_c64b_typein_rd;
+
+static t_c64b_typein_rd rd;
+static char             line[TYPEIN_LINE_MAX + sizeof("~ret~")];
+
+static unsigned int     typein_num = 0;
+static char             typein_names [TYPEIN_FILES][TYPEIN_NAME_LEN];
+static char             typein_labels[TYPEIN_FILES][TYPEIN_NAME_LEN];
+
+//----------------------------------------------------------------------------//
+// the listings are looked up once while the card is mounted at power-on, the
+// labels replace the characters that have no key on the C64
+
+void c64b_typein_scan(void)
+{
+	DIR* d = opendir(SDCARD_MOUNT_POINT);
+
+	typein_num = 0;
+	if(d == NULL)
+		return;
+
+	struct dirent* e;
+	while(((e = readdir(d)) != NULL) && (typein_num < TYPEIN_FILES))
+	{
+		size_t n = strlen(e->d_name);
+
+		if((e->d_type != DT_REG) || (n < 5) || (n >= TYPEIN_NAME_LEN))
+			continue;
+
+		if((strcasecmp(&e->d_name[n - 4], ".bas") != 0) && (strcasecmp(&e->d_name[n - 4], ".txt") != 0))
+			continue;
+
+		for(size_t i = 0; i <= n; ++i)
+		{
+			char c[2] = {tolower((unsigned char)e->d_name[i]), 0};
+
+			if((c[0] != 0) && (c64b_keyboard_key_to_idx(c) == C64B_KB_IDX_NONE))
+				c[0] = '-';
+
+			typein_names [typein_num][i] = e->d_name[i];
+			typein_labels[typein_num][i] = c[0];
+		}
+		++typein_num;
+	}
+	closedir(d);
+
+	logi("typein: %u listings found\n", typein_num);
+}
+
+//----------------------------------------------------------------------------//
+
+unsigned int c64b_typein_num(void)
+{
+	return typein_num;
+}
+
+//----------------------------------------------------------------------------//
+
+const char* c64b_typein_name(unsigned int i)
+{
+	return (i < typein_num) ? typein_names[i] : NULL;
+}
+
+//----------------------------------------------------------------------------//
+
+const char* c64b_typein_label(unsigned int i)
+{
+	return (i < typein_num) ? typein_labels[i] : NULL;
+}
+
+//----------------------------------------------------------------------------//
+// time the KERNAL needs to store a line typed after the given amount of text
+
+uint32_t c64b_typein_pause_us(size_t bytes)
+{
+	return TYPEIN_RET_US + (uint32_t)((bytes * TYPEIN_LINK_US) / 1024);
+}
+
+//----------------------------------------------------------------------------//
+// must be called with the card attached
+
+static void typein_fill(unsigned int b)
+{
+	if(rd.eof || (rd.len[b] != 0))
+		return;
+
+	rd.len[b] = fread(rd.blk[b], 1, TYPEIN_BLK, rd.f);
+	if(rd.len[b] < TYPEIN_BLK)
+		rd.eof = true;
+}
+
+//----------------------------------------------------------------------------//
+// the idle block is normally filled during the pause after the previous line,
+// a line spanning a whole block reads it here
+
+static int typein_getc(void)
+{
+	if(rd.pos >= rd.len[rd.cur])
+	{
+		rd.len[rd.cur] = 0;
+		rd.pos         = 0;
+		rd.cur        ^= 1;
+
+		typein_fill(rd.cur);
+		if(rd.len[rd.cur] == 0)
+			return EOF;
+	}
+	return (unsigned char)rd.blk[rd.cur][rd.pos++];
+}
+
+//----------------------------------------------------------------------------//
+// turns the next line of the listing into a macro string, see
+// c64b_keyboard_text_key(). Returns false at the end of the file, ok is
+// cleared when the line does not fit or has characters without a key
+
+static bool typein_line(char* s, size_t len, bool* ok)
+{
+	size_t n = 0;
+	int    c;
+
+	*ok = true;
+	while(((c = typein_getc()) != EOF) && (c != '\n'))
+	{
+		char        ch[2];
+		const char* k;
+
+		if(c == '\r')
+			continue;
+
+		k = c64b_keyboard_text_key(c, ch);
+		if(k == NULL)
+		{
+			*ok = false;
+			continue;
+		}
+
+		size_t m = strlen(k);
+		if(n + m < len)
+		{
+			memcpy(&s[n], k, m);
+			n += m;
+		}
+		else
+		{
+			*ok = false;
+		}
+	}
+	s[n] = 0;
+
+	return (c != EOF) || (n > 0);
+}
+
+//----------------------------------------------------------------------------//
+// Types the listing on a cleared screen, one line at a time. The card only
+// gets the shared lines between two lines, while the KERNAL is storing the
+// last one: that time grows with the size of the program, the KERNAL relinks
+// all of its lines after each one. Runs on the keyboard feed thread with the
+// keyboard owned
+
+bool c64b_typein_feed(t_c64b_keyboard* h, const char* name)
+{
+	static char path[sizeof(SDCARD_MOUNT_POINT) + TYPEIN_NAME_LEN];
+
+	snprintf(path, sizeof(path), "%s/%s", SDCARD_MOUNT_POINT, name);
+
+	if(!c64b_sdcard_mount())
+	{
+		loge("typein: sd-card not found\n");
+		return false;
+	}
+
+	rd.f = fopen(path, "r");
+	if(rd.f == NULL)
+	{
+		c64b_sdcard_unmount();
+		loge("typein: %s not found\n", path);
+		return false;
+	}
+
+	rd.len[0] = 0;
+	rd.len[1] = 0;
+	rd.pos    = 0;
+	rd.cur    = 1;
+	rd.eof    = false;
+	typein_fill(0);
+
+	logi("typein: typing %s\n", path);
+
+	c64b_sdcard_detach();
+	bool done = c64b_keyboard_feed_str(h, "~clr~");
+
+	unsigned int num   = 0;
+	size_t       bytes = 0;
+	int64_t      t_ret = 0;
+	int64_t      pause = 0;
+
+	while(done)
+	{
+		bool ok;
+
+		c64b_sdcard_attach();
+		bool more = typein_line(line, TYPEIN_LINE_MAX, &ok);
+		typein_fill(rd.cur ^ 1);
+		c64b_sdcard_detach();
+
+		if(!more)
+			break;
+
+		++num;
+		if(!ok)
+		{
+			loge("typein: line %u too long or not typeable, skipped\n", num);
+			continue;
+		}
+		if(line[0] == 0)
+			continue;
+
+		// the read ahead took part of the pause already
+		int64_t wait_us = t_ret + pause - esp_timer_get_time();
+		if(wait_us > 0)
+			vTaskDelay((wait_us / 1000 + portTICK_PERIOD_MS) / portTICK_PERIOD_MS);
+
+		bytes += strlen(line);
+		strcat(line, "~ret~");
+
+		if(!c64b_keyboard_feed_str(h, line))
+			loge("typein: line %u not typed\n", num);
+
+		t_ret = esp_timer_get_time();
+		pause = c64b_typein_pause_us(bytes);
+	}
+
+	c64b_sdcard_attach();
+	fclose(rd.f);
+	c64b_sdcard_unmount();
+
+	logi("typein: %u lines, %u bytes\n", num, (unsigned int)bytes);
+	return done;
+}
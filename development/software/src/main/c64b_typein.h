@@ -0,0 +1,58 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+#ifndef C64B_TYPEIN_H
+#define C64B_TYPEIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "c64b_keyboard.h"
+
+//----------------------------------------------------------------------------//
+// BASIC listings (.bas and .txt text files in the root of the sd-card) typed
+// in through the keyboard feed. The file is streamed through two small blocks,
+// the next one being read while the KERNAL stores the line just entered, so
+// memory use does not depend on the size of the listing
+
+#define TYPEIN_FILES    16      // listings offered by the menu
+#define TYPEIN_NAME_LEN 32
+#define TYPEIN_BLK      512     // bytes per read
+#define TYPEIN_LINE_MAX 160     // longest line, as a macro string
+#define TYPEIN_RET_US   60000   // KERNAL line entry after RETURN
+#define TYPEIN_LINK_US  10000   // per KB of listing, the KERNAL relinks every line
+
+//----------------------------------------------------------------------------//
+
+void         c64b_typein_scan (void);
+unsigned int c64b_typein_num  (void);
+const char*  c64b_typein_name (unsigned int i);
+const char*  c64b_typein_label(unsigned int i);
+
+bool         c64b_typein_feed (t_c64b_keyboard* h, const char* name);
+uint32_t     c64b_typein_pause_us(size_t bytes);
+
+#endif
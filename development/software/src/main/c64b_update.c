@@ -22,153 +22,535 @@
 // See the License for the specific language governing permissions and        //
 // limitations under the License.                                             //
 //----------------------------------------------------------------------------//
-
+#include <assert.h>
 #include <string.h>
+#include <fcntl.h>
 #include <sys/unistd.h>
 #include <sys/stat.h>
 #include "driver/gpio.h"
 #include <uni.h>
 
-#include "c64b_update.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 
-// SDMMC includes
-#include "esp_vfs_fat.h"
-#include "sdmmc_cmd.h"
-#include "driver/sdmmc_host.h"
+#include "c64b_update.h"
+#include "c64b_delta.h"
+#include "c64b_sdcard.h"
+#include "c64b_properties.h"
 
 // OTA includes
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "esp_ota_ops.h"
 #include "esp_partition.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+#include "rom/miniz.h"
+#include "mbedtls/sha256.h"
 
+//----------------------------------------------------------------------------//
+// The image is copied through a pipeline: this task reads the card into one
+// buffer while the writer task programs the other one into flash, so the
+// update takes about as long as the flash writes. The buffers are a multiple
+// of the sector size and DMA capable, so the card is read straight into them.
+//
+// The writer also decodes the file: a gzip file is inflated, and a delta (see
+// c64b_delta.h) is applied to the running image. Both run in fixed buffers,
+// the inflate window being the largest one
+
+typedef struct
+{
+	uint8_t* buf;
+	size_t   len; // 0 ends the writer
+} t_c64b_ota_chunk;
 
-#define MOUNT_POINT "/s"
+// the first one found is used, the format is told by the content
+static const char* const fw_path[] =
+{
+	SDCARD_MOUNT_POINT"/application.bin",
+	SDCARD_MOUNT_POINT"/application.gz",
+	SDCARD_MOUNT_POINT"/application.dlt"
+};
 
-#define OTA_BUF_SIZE 1024
-static char ota_buf[OTA_BUF_SIZE + 1] = {0};
+static const char sha_path[] = SDCARD_MOUNT_POINT"/application.sha256";
 
-FILE *f;
-sdmmc_card_t *card;
+#define GZ_TAIL_LEN 8 // crc32 and size of the inflated data
 
-t_c64b_update_err c64b_update_init(bool check_only)
+typedef struct
 {
-	logi("Checking Updates\n");
+	tinfl_decompressor inf;
+	uint8_t            win[TINFL_LZ_DICT_SIZE];
+	size_t             pos;               // next byte of the window
+	bool               done;
+	uint32_t           crc;
+	uint32_t           size;
+	uint8_t            tail[GZ_TAIL_LEN]; // last bytes of the file so far
+	size_t             tail_len;
+} t_c64b_ota_gz;
+
+static int                        fw_fd = -1;
+static esp_ota_handle_t           ota_h;
+static volatile t_c64b_update_err ota_res;
+static QueueHandle_t              ota_free = NULL; // empty buffers, back from the writer
+static QueueHandle_t              ota_full = NULL; // buffers read from the card
+static SemaphoreHandle_t          ota_done = NULL;
+
+// writer task state
+static const esp_partition_t*     ota_src;         // running image, source of the deltas
+static t_c64b_ota_gz*             ota_gz;          // NULL unless the file is gzip
+static t_c64b_delta               ota_delta;
+static uint8_t*                   ota_out;         // image bytes waiting for the flash
+static size_t                     ota_out_len;
+static mbedtls_sha256_context     ota_sha;         // over the image, as written
+static bool                       ota_first;
+
+//----------------------------------------------------------------------------//
+// image bytes are gathered so that the flash is written in large pieces
+
+static bool update_out_flush(void)
+{
+	bool ok = (ota_out_len == 0) || (esp_ota_write(ota_h, ota_out, ota_out_len) == ESP_OK);
+	ota_out_len = 0;
+	return ok;
+}
+
+static bool update_out(void* ctx, const void* buf, size_t len)
+{
+	mbedtls_sha256_update(&ota_sha, buf, len);
+
+	while(len > 0)
+	{
+		size_t n = UPDATE_OUT_LEN - ota_out_len;
+		n = (len < n) ? len : n;
+
+		memcpy(&ota_out[ota_out_len], buf, n);
+		ota_out_len += n;
+		buf          = (const uint8_t*)buf + n;
+		len         -= n;
+
+		if((ota_out_len == UPDATE_OUT_LEN) && !update_out_flush())
+		{
+			ota_res = WRITE_ERROR;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool update_src(void* ctx, uint32_t off, void* buf, size_t len)
+{
+	return (off + len <= ota_src->size) && (esp_partition_read(ota_src, off, buf, len) == ESP_OK);
+}
+
+//----------------------------------------------------------------------------//
+// returns the length of the gzip header at the start of buf, 0 when there is
+// none. The header is expected within the first buffer
+
+static size_t update_gz_hdr(const uint8_t* b, size_t len)
+{
+	size_t i = 10;
+
+	if((len < i) || (b[0] != 0x1f) || (b[1] != 0x8b) || (b[2] != 8))
+		return 0;
+
+	if(b[3] & 0x04) // FEXTRA
+		i = (i + 2 <= len) ? i + 2 + (b[i] | (b[i + 1] << 8)) : len + 1;
+
+	for(unsigned int f = 0x08; f <= 0x10; f <<= 1) // FNAME, FCOMMENT
+	{
+		if(b[3] & f)
+		{
+			while((i < len) && (b[i] != 0))
+				++i;
+			++i;
+		}
+	}
+
+	if(b[3] & 0x02) // FHCRC
+		i += 2;
+
+	return (i <= len) ? i : 0;
+}
+
+//----------------------------------------------------------------------------//
+// The trailer is taken from the end of the file rather than from the input
+// left over by tinfl: the ROM version reads ahead through its bit buffer and
+// does not give back the bytes past the compressed data
+
+static void update_gz_tail(t_c64b_ota_gz* gz, const uint8_t* buf, size_t len)
+{
+	if(len >= GZ_TAIL_LEN)
+	{
+		memcpy(gz->tail, &buf[len - GZ_TAIL_LEN], GZ_TAIL_LEN);
+		gz->tail_len = GZ_TAIL_LEN;
+		return;
+	}
+
+	size_t keep = GZ_TAIL_LEN - len;
+	if(gz->tail_len > keep)
+	{
+		memmove(gz->tail, &gz->tail[gz->tail_len - keep], keep);
+		gz->tail_len = keep;
+	}
+	memcpy(&gz->tail[gz->tail_len], buf, len);
+	gz->tail_len += len;
+}
+
+//----------------------------------------------------------------------------//
+
+static bool update_inflate(const uint8_t* buf, size_t len)
+{
+	t_c64b_ota_gz* gz = ota_gz;
+
+	update_gz_tail(gz, buf, len);
+
+	// goes on after the input is taken for the output still held by tinfl
+	while(!gz->done)
+	{
+		size_t in_n  = len;
+		size_t out_n = TINFL_LZ_DICT_SIZE - gz->pos;
+
+		tinfl_status st = tinfl_decompress(&gz->inf, buf, &in_n, gz->win, &gz->win[gz->pos], &out_n, TINFL_FLAG_HAS_MORE_INPUT);
+
+		buf += in_n;
+		len -= in_n;
+
+		if(out_n > 0)
+		{
+			gz->crc   = esp_rom_crc32_le(gz->crc, &gz->win[gz->pos], out_n);
+			gz->size += out_n;
+
+			if(!c64b_delta_feed(&ota_delta, &gz->win[gz->pos], out_n))
+				return false;
+
+			gz->pos = (gz->pos + out_n) & (TINFL_LZ_DICT_SIZE - 1);
+		}
+
+		if(st < TINFL_STATUS_DONE)
+		{
+			loge("update: inflate failed, status=%d\n", st);
+			return false;
+		}
+
+		gz->done = (st == TINFL_STATUS_DONE);
+
+		if(st == TINFL_STATUS_NEEDS_MORE_INPUT)
+			break;
+	}
+
+	return true;
+}
+
+//----------------------------------------------------------------------------//
+
+static bool update_decode(const uint8_t* buf, size_t len)
+{
+	if(ota_first)
+	{
+		ota_first = false;
+
+		size_t hdr = update_gz_hdr(buf, len);
+		if(hdr > 0)
+		{
+			ota_gz = heap_caps_malloc(sizeof(t_c64b_ota_gz), MALLOC_CAP_8BIT);
+			if(ota_gz == NULL)
+				return false;
+
+			tinfl_init(&ota_gz->inf);
+			ota_gz->pos      = 0;
+			ota_gz->done     = false;
+			ota_gz->crc      = 0;
+			ota_gz->size     = 0;
+			ota_gz->tail_len = 0;
+
+			logi("update: gzip file\n");
+			buf += hdr;
+			len -= hdr;
+		}
+	}
 
-	// CLK => GPIO_14
-	// D0  => GPIO_2
-	// CMD => GPIO_15
+	if(ota_gz != NULL)
+		return update_inflate(buf, len);
 
-	// Options for mounting the filesystem.
-	// If format_if_mount_failed is set to true, SD card will be partitioned and
-	// formatted in case when mounting fails.
-	esp_vfs_fat_sdmmc_mount_config_t mount_config = {
-		.format_if_mount_failed = false,
-		.max_files = 5,
-		.allocation_unit_size = 16 * 1024
-	};
+	return c64b_delta_feed(&ota_delta, buf, len);
+}
 
-	sdmmc_host_t host = SDMMC_HOST_DEFAULT();
-//	host.max_freq_khz = SDMMC_FREQ_HIGHSPEED;
+//----------------------------------------------------------------------------//
 
-	sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT();
+static bool update_decode_end(void)
+{
+	if(ota_gz != NULL)
+	{
+		t_c64b_ota_gz* gz = ota_gz;
 
-	slot_config.width = 1;
-	slot_config.flags = 0;
-	slot_config.flags |= SDMMC_HOST_FLAG_1BIT;
+		if(!gz->done || (gz->tail_len != GZ_TAIL_LEN))
+		{
+			loge("update: gzip file truncated\n");
+			return false;
+		}
+
+		uint32_t crc  = gz->tail[0] | (gz->tail[1] << 8) | (gz->tail[2] << 16) | ((uint32_t)gz->tail[3] << 24);
+		uint32_t size = gz->tail[4] | (gz->tail[5] << 8) | (gz->tail[6] << 16) | ((uint32_t)gz->tail[7] << 24);
+
+		if((crc != gz->crc) || (size != gz->size))
+		{
+			loge("update: gzip file damaged\n");
+			return false;
+		}
+	}
+
+	return c64b_delta_finish(&ota_delta);
+}
+
+//----------------------------------------------------------------------------//
+
+static void task_update_write(void* arg)
+{
+	t_c64b_ota_chunk c;
+
+	do
+	{
+		xQueueReceive(ota_full, &c, portMAX_DELAY);
+
+		// after an error the chunks are only handed back
+		if((c.len > 0) && (ota_res == UPDATE_OK) && !update_decode(c.buf, c.len) && (ota_res == UPDATE_OK))
+			ota_res = VERIFY_ERROR;
+
+		xQueueSend(ota_free, &c, portMAX_DELAY);
+	}
+	while(c.len > 0);
+
+	if((ota_res == UPDATE_OK) && !update_decode_end())
+		ota_res = VERIFY_ERROR;
+
+	if((ota_res == UPDATE_OK) && !update_out_flush())
+		ota_res = WRITE_ERROR;
+
+	xSemaphoreGive(ota_done);
+	vTaskDelete(NULL);
+}
+
+//----------------------------------------------------------------------------//
+// application.sha256 is optional, it holds the digest of the image (not of the
+// compressed file or of the delta) as printed by sha256sum
+
+static bool update_sha_expected(uint8_t* sha)
+{
+	char  hex[2 * UPDATE_SHA_LEN + 1] = {0};
+	FILE* f = fopen(sha_path, "r");
+
+	if(f == NULL)
+		return false;
+
+	size_t n = fread(hex, 1, 2 * UPDATE_SHA_LEN, f);
+	fclose(f);
+
+	if(n != 2 * UPDATE_SHA_LEN)
+		return false;
+
+	for(unsigned int i = 0; i < UPDATE_SHA_LEN; ++i)
+	{
+		unsigned int b;
+		if(sscanf(&hex[2 * i], "%2x", &b) != 1)
+			return false;
+		sha[i] = b;
+	}
+
+	return true;
+}
 
-	if(esp_vfs_fat_sdmmc_mount(MOUNT_POINT, &host, &slot_config, &mount_config, &card) != ESP_OK)
+//----------------------------------------------------------------------------//
+
+t_c64b_update_err c64b_update_init(bool check_only)
+{
+	logi("Checking Updates\n");
+
+	if(!c64b_sdcard_mount())
 		return NO_SDCARD;
 
 	logi("Checking New Firmware\n");
 
 	// Open update file
-	const char fw_path[] = MOUNT_POINT"/application.bin";
+	for(unsigned int i = 0; (i < sizeof(fw_path) / sizeof(fw_path[0])) && (fw_fd < 0); ++i)
+	{
+		fw_fd = open(fw_path[i], O_RDONLY);
+		if(fw_fd >= 0)
+			logi("%s found\n", fw_path[i]);
+	}
 
-	f = fopen(fw_path, "rb");
-	if (f == NULL)
+	if (fw_fd < 0)
 	{
-		esp_vfs_fat_sdcard_unmount(MOUNT_POINT, card);
-		logi("application.bin not found\n");
+		c64b_sdcard_unmount();
+		logi("no firmware found\n");
 		return NO_FIRMWARE;
 	}
 
-	logi("application.bin found\n");
-
 	if(check_only)
 	{
-		fclose(f);
-		esp_vfs_fat_sdcard_unmount(MOUNT_POINT, card);
+		close(fw_fd);
+		fw_fd = -1;
+		c64b_sdcard_unmount();
 	}
 
 	return UPDATE_OK;
 }
 
-t_c64b_update_err c64b_update()
+//----------------------------------------------------------------------------//
+// progress is called with the card detached, so it can drive the keyboard
+
+t_c64b_update_err c64b_update(t_c64b_update_progress progress)
 {
 	logi("Starting Update\n");
 
-	if(c64b_update_init(false) != ESP_OK)
+	// nothing is left waiting for the commit when the new firmware boots
+	c64b_property_flush();
+
+	t_c64b_update_err err = c64b_update_init(false);
+	if(err != UPDATE_OK)
+		return err;
+
+	uint8_t sha_exp[UPDATE_SHA_LEN];
+	uint8_t sha_img[UPDATE_SHA_LEN];
+	bool    sha_chk = update_sha_expected(sha_exp);
+
+	struct stat st;
+	size_t      total = (fstat(fw_fd, &st) == 0) ? st.st_size : 0;
+
+	uint8_t* buf[UPDATE_BUF_NUM];
+	for(unsigned int i = 0; i < UPDATE_BUF_NUM; ++i)
+		buf[i] = heap_caps_malloc(UPDATE_BUF_SIZE, MALLOC_CAP_DMA);
+	ota_out = heap_caps_malloc(UPDATE_OUT_LEN, MALLOC_CAP_8BIT);
+
+	if(ota_free == NULL)
 	{
-		fclose(f);
-		esp_vfs_fat_sdcard_unmount(MOUNT_POINT, card);
-		return READ_ERROR;
+		ota_free = xQueueCreate(UPDATE_BUF_NUM, sizeof(t_c64b_ota_chunk));
+		ota_full = xQueueCreate(UPDATE_BUF_NUM, sizeof(t_c64b_ota_chunk));
+		ota_done = xSemaphoreCreateBinary();
 	}
 
-//	if(nvs_flash_init() != ESP_OK)
-//	{
-//		fclose(f);
-//		esp_vfs_fat_sdcard_unmount(MOUNT_POINT, card);
-//		return WRITE_ERROR;
-//	}
+	const esp_partition_t *update_partition = esp_ota_get_next_update_partition(NULL);
+	assert(update_partition != NULL);
 
-	esp_ota_handle_t update_handle = 0 ;
-	const esp_partition_t *update_partition = NULL;
+	ota_src     = esp_ota_get_running_partition();
+	ota_gz      = NULL;
+	ota_out_len = 0;
+	ota_first   = true;
+	c64b_delta_init(&ota_delta, update_src, update_out, NULL);
+	mbedtls_sha256_init(&ota_sha);
+	mbedtls_sha256_starts(&ota_sha, 0);
 
-	update_partition = esp_ota_get_next_update_partition(NULL);
-	assert(update_partition != NULL);
+	esp_err_t ota_err = (ota_out == NULL) ? ESP_ERR_NO_MEM : ESP_OK;
+	for(unsigned int i = 0; i < UPDATE_BUF_NUM; ++i)
+		if(buf[i] == NULL)
+			ota_err = ESP_ERR_NO_MEM;
 
-	if(esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &update_handle) != ESP_OK)
+	ota_h = 0;
+	if(ota_err == ESP_OK)
+		ota_err = esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &ota_h);
+
+	if(ota_err != ESP_OK)
 	{
-		esp_ota_abort(update_handle);
-		fclose(f);
-		esp_vfs_fat_sdcard_unmount(MOUNT_POINT, card);
+		loge("update: could not start, err=%#x\n", ota_err);
+		esp_ota_abort(ota_h);
+		mbedtls_sha256_free(&ota_sha);
+		for(unsigned int i = 0; i < UPDATE_BUF_NUM; ++i)
+			free(buf[i]);
+		free(ota_out);
+		close(fw_fd);
+		fw_fd = -1;
+		c64b_sdcard_unmount();
 		return WRITE_ERROR;
 	}
 
-	size_t nread = 0;
-	int i = 0;
+	for(unsigned int i = 0; i < UPDATE_BUF_NUM; ++i)
+	{
+		t_c64b_ota_chunk c = {.buf = buf[i], .len = 0};
+		xQueueSend(ota_free, &c, 0);
+	}
+
+	ota_res = UPDATE_OK;
+	xTaskCreatePinnedToCore(task_update_write,
+							"update_write",
+							1024*4,
+							NULL,
+							UPDATE_TASK_PRIO,
+							NULL,
+							UPDATE_TASK_CORE);
+
+	size_t       done = 0;
+	unsigned int step = 0;
+	int64_t      t0   = esp_timer_get_time();
 
 	while(true)
 	{
-		nread = fread(ota_buf, 1, OTA_BUF_SIZE, f);
-		if (ferror(f))
+		t_c64b_ota_chunk c;
+		xQueueReceive(ota_free, &c, portMAX_DELAY);
+
+		ssize_t n = read(fw_fd, c.buf, UPDATE_BUF_SIZE);
+		if(n < 0)
 		{
-			esp_ota_abort(update_handle);
-			fclose(f);
-			esp_vfs_fat_sdcard_unmount(MOUNT_POINT, card);
-			return READ_ERROR;
+			err = READ_ERROR;
+			n   = 0;
 		}
 
-		if(esp_ota_write(update_handle, (const void *)ota_buf, nread) != ESP_OK)
+		c.len = (ota_res == UPDATE_OK) ? n : 0;
+		xQueueSend(ota_full, &c, portMAX_DELAY);
+
+		if(c.len == 0)
+			break;
+
+		done += c.len;
+
+		unsigned int s = (total > 0) ? (done * UPDATE_PROGRESS_STEPS) / total : 0;
+		if((progress != NULL) && (s > step))
 		{
-			esp_ota_abort(update_handle);
-			fclose(f);
-			esp_vfs_fat_sdcard_unmount(MOUNT_POINT, card);
-			return WRITE_ERROR;
+			step = s;
+			c64b_sdcard_detach();
+			progress(step * 100 / UPDATE_PROGRESS_STEPS);
+			c64b_sdcard_attach();
 		}
+	}
 
-		i += nread;
-		if (nread != OTA_BUF_SIZE)
-			break;
+	xSemaphoreTake(ota_done, portMAX_DELAY);
+	xQueueReset(ota_free);
+
+	mbedtls_sha256_finish(&ota_sha, sha_img);
+	mbedtls_sha256_free(&ota_sha);
+
+	logi("update: %u bytes read, %u bytes written in %lld ms\n",
+		(unsigned int)done, (unsigned int)ota_delta.dst_pos, (long long)(esp_timer_get_time() - t0) / 1000);
+
+	for(unsigned int i = 0; i < UPDATE_BUF_NUM; ++i)
+		free(buf[i]);
+	free(ota_out);
+	free(ota_gz);
+	ota_gz = NULL;
+	close(fw_fd);
+	fw_fd = -1;
+	c64b_sdcard_unmount();
+
+	if(err == UPDATE_OK)
+		err = ota_res;
+
+	if((err == UPDATE_OK) && sha_chk && (memcmp(sha_exp, sha_img, UPDATE_SHA_LEN) != 0))
+	{
+		loge("update: the image does not match application.sha256\n");
+		err = VERIFY_ERROR;
 	}
 
-	fclose(f);
-	esp_vfs_fat_sdcard_unmount(MOUNT_POINT, card);
+	if(err != UPDATE_OK)
+	{
+		esp_ota_abort(ota_h);
+		return err;
+	}
 
-	// commit OTA
-	if(esp_ota_end(update_handle) != ESP_OK)
-		return WRITE_ERROR;
+	// commit OTA, esp_ota_end() also checks the image and its appended digest
+	if(esp_ota_end(ota_h) != ESP_OK)
+		return VERIFY_ERROR;
 
 	if(esp_ota_set_boot_partition(update_partition) != ESP_OK)
 		return WRITE_ERROR;
@@ -26,6 +26,16 @@
 #ifndef C64B_UPDATE_H
 #define C64B_UPDATE_H
 
+#include <stdbool.h>
+
+#define UPDATE_BUF_SIZE       (16 * 1024) // multiple of the card sector size
+#define UPDATE_BUF_NUM        2
+#define UPDATE_OUT_LEN        4096        // image bytes written to the flash at a time
+#define UPDATE_SHA_LEN        32
+#define UPDATE_PROGRESS_STEPS 20
+#define UPDATE_TASK_PRIO      3
+#define UPDATE_TASK_CORE      1
+
 typedef enum
 {
 	UPDATE_OK = 0,
@@ -33,10 +43,14 @@ typedef enum
 	NO_FIRMWARE,
 	READ_ERROR,
 	WRITE_ERROR,
+	VERIFY_ERROR,
 
 }t_c64b_update_err;
 
+// called every 100 / UPDATE_PROGRESS_STEPS percent of the image
+typedef void (*t_c64b_update_progress)(unsigned int pct);
+
 t_c64b_update_err c64b_update_init(bool check_only);
-t_c64b_update_err c64b_update();
+t_c64b_update_err c64b_update(t_c64b_update_progress progress);
 
 #endif
@@ -0,0 +1,195 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+// Host benchmark of the callbacks posted to the FreeRTOS run loop of btstack:
+// the lock-free list of btstack_run_loop_freertos.c against the mutex and
+// linked list it replaced, with a pthread mutex in place of the FreeRTOS one
+//
+//   round trip    one post and one run per wakeup, as for a packet
+//   producers     threads posting registrations that are mostly pending
+
+#include "btstack_run_loop_freertos.c"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+//----------------------------------------------------------------------------//
+// fakes of FreeRTOS: the notifications cost nothing, the same for both schemes
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) { return (TaskHandle_t)1; }
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) { return pdPASS; }
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action, BaseType_t* woken) { *woken = pdFALSE; return pdPASS; }
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t* value, TickType_t wait) { return pdTRUE; }
+QueueHandle_t xQueueCreate(UBaseType_t n, UBaseType_t size) { return (QueueHandle_t)1; }
+BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t wait) { return pdFALSE; }
+BaseType_t xQueueSendToBack(QueueHandle_t q, const void* item, TickType_t wait) { return pdFALSE; }
+uint32_t hal_time_ms(void) { return 0; }
+
+//----------------------------------------------------------------------------//
+// the scheme before the lock-free list
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void mutex_post(btstack_context_callback_registration_t* reg)
+{
+	pthread_mutex_lock(&mutex);
+	btstack_run_loop_base_add_callback(reg);
+	pthread_mutex_unlock(&mutex);
+}
+
+static void mutex_execute(void)
+{
+	while(1)
+	{
+		pthread_mutex_lock(&mutex);
+		btstack_context_callback_registration_t* reg = (btstack_context_callback_registration_t*)btstack_linked_list_pop(&btstack_run_loop_base_callbacks);
+		pthread_mutex_unlock(&mutex);
+		if(reg == NULL)
+			break;
+		(*reg->callback)(reg->context);
+	}
+}
+
+//----------------------------------------------------------------------------//
+
+#define BENCH_ROUND_TRIPS 20000000
+#define BENCH_THREADS     3
+#define BENCH_REGS        4
+#define BENCH_POSTS       2000000
+
+typedef struct
+{
+	const char* name;
+	void (*post)(btstack_context_callback_registration_t* reg);
+	void (*execute)(void);
+} t_bench_scheme;
+
+static const t_bench_scheme schemes[] =
+{
+	{"mutex    ", mutex_post, mutex_execute},
+	{"lock-free", btstack_run_loop_freertos_execute_on_main_thread, btstack_run_loop_freertos_execute_callbacks},
+};
+
+static const t_bench_scheme* scheme;
+static btstack_context_callback_registration_t regs[BENCH_THREADS][BENCH_REGS];
+static uint64_t     calls[BENCH_THREADS];
+static unsigned int threads_done;
+
+static void bench_callback(void* context)
+{
+	calls[(uintptr_t)context]++;
+}
+
+static void bench_reset(void)
+{
+	btstack_run_loop_base_init();
+	btstack_run_loop_callbacks = NULL;
+	for(unsigned int t = 0; t < BENCH_THREADS; ++t)
+	{
+		calls[t] = 0;
+		for(unsigned int r = 0; r < BENCH_REGS; ++r)
+		{
+			regs[t][r].item     = NULL;
+			regs[t][r].callback = bench_callback;
+			regs[t][r].context  = (void*)(uintptr_t)t;
+		}
+	}
+}
+
+static double bench_now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void* bench_thread(void* arg)
+{
+	uintptr_t t = (uintptr_t)arg;
+
+	for(unsigned int i = 0; i < BENCH_POSTS; ++i)
+		scheme->post(&regs[t][i % BENCH_REGS]);
+	__atomic_add_fetch(&threads_done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void bench_round_trip(void)
+{
+	bench_reset();
+	double t0 = bench_now();
+	for(unsigned int i = 0; i < BENCH_ROUND_TRIPS; ++i)
+	{
+		scheme->post(&regs[0][i % BENCH_REGS]);
+		scheme->execute();
+	}
+	double dt = bench_now() - t0;
+
+	printf("round trip %s: %6.1f ns per callback\n", scheme->name, dt / BENCH_ROUND_TRIPS * 1e9);
+}
+
+static void bench_producers(void)
+{
+	bench_reset();
+	threads_done = 0;
+
+	pthread_t threads[BENCH_THREADS];
+	double t0 = bench_now();
+	for(uintptr_t t = 0; t < BENCH_THREADS; ++t)
+		pthread_create(&threads[t], NULL, bench_thread, (void*)t);
+	while(__atomic_load_n(&threads_done, __ATOMIC_ACQUIRE) < BENCH_THREADS)
+		scheme->execute();
+	scheme->execute();
+	double dt = bench_now() - t0;
+
+	for(unsigned int t = 0; t < BENCH_THREADS; ++t)
+		pthread_join(threads[t], NULL);
+
+	uint64_t total = 0;
+	for(unsigned int t = 0; t < BENCH_THREADS; ++t)
+		total += calls[t];
+
+	printf("producers  %s: %6.1f M posts/s, %llu callbacks\n", scheme->name,
+		BENCH_THREADS * (double)BENCH_POSTS / dt / 1e6, (unsigned long long)total);
+}
+
+//----------------------------------------------------------------------------//
+
+int main(void)
+{
+	btstack_run_loop_freertos_init();
+
+	for(unsigned int s = 0; s < sizeof(schemes) / sizeof(schemes[0]); ++s)
+	{
+		scheme = &schemes[s];
+		bench_round_trip();
+	}
+	for(unsigned int s = 0; s < sizeof(schemes) / sizeof(schemes[0]); ++s)
+	{
+		scheme = &schemes[s];
+		bench_producers();
+	}
+	return 0;
+}
@@ -0,0 +1,146 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+// Host benchmark of the timers of the btstack run loop: the sorted list of
+// the run loop base against the timer wheel. Each 1 ms tick re-arms some
+// timers, processes the expired ones, which are armed again, and asks for the
+// time until the next timeout, as the run loop does before it sleeps
+
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_timer_wheel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//----------------------------------------------------------------------------//
+
+#define BENCH_TIMERS 5000
+#define BENCH_TICKS  20000
+
+typedef struct
+{
+	const char* name;
+	void    (*init)(uint32_t now);
+	void    (*add)(btstack_timer_source_t* timer);
+	bool    (*remove)(btstack_timer_source_t* timer);
+	void    (*process)(uint32_t now);
+	int32_t (*time_until)(uint32_t now);
+} t_bench_timers;
+
+static void bench_list_init(uint32_t now)
+{
+	btstack_run_loop_base_init();
+}
+
+static const t_bench_timers backends[] =
+{
+	{"list ", bench_list_init, btstack_run_loop_base_add_timer, btstack_run_loop_base_remove_timer,
+		btstack_run_loop_base_process_timers, btstack_run_loop_base_get_time_until_timeout},
+	{"wheel", btstack_run_loop_timer_wheel_init, btstack_run_loop_timer_wheel_add_timer, btstack_run_loop_timer_wheel_remove_timer,
+		btstack_run_loop_timer_wheel_process_timers, btstack_run_loop_timer_wheel_get_time_until_timeout},
+};
+
+static const t_bench_timers*  backend;
+static btstack_timer_source_t timers[BENCH_TIMERS];
+static uint32_t               now;
+static uint32_t               max_delay;
+static unsigned long          fired;
+
+static void bench_arm(btstack_timer_source_t* timer)
+{
+	timer->timeout = now + 1 + rand() % max_delay;
+	backend->add(timer);
+}
+
+static void bench_fired(btstack_timer_source_t* timer)
+{
+	fired++;
+	bench_arm(timer);
+}
+
+static double bench_now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void bench_run(int n, uint32_t delay, int rearms)
+{
+	srand(1);
+	memset(timers, 0, sizeof(timers));
+	now       = 1000;
+	max_delay = delay;
+	fired     = 0;
+
+	backend->init(now);
+	for(int i = 0; i < n; ++i)
+	{
+		timers[i].process = bench_fired;
+		bench_arm(&timers[i]);
+	}
+
+	double t0 = bench_now();
+	for(int k = 0; k < BENCH_TICKS; ++k)
+	{
+		for(int j = 0; j < rearms; ++j)
+		{
+			btstack_timer_source_t* timer = &timers[rand() % n];
+			backend->remove(timer);
+			bench_arm(timer);
+		}
+		now++;
+		backend->process(now);
+		backend->time_until(now);
+	}
+	double dt = bench_now() - t0;
+
+	printf("%s %5d timers up to %5u ms, %2d re-arms per tick: %8.3f us per tick, %lu fired\n",
+		backend->name, n, (unsigned int)delay, rearms, dt / BENCH_TICKS * 1e6, fired);
+}
+
+//----------------------------------------------------------------------------//
+
+int main(void)
+{
+	static const int counts[] = {100, 1000, 5000};
+
+	for(unsigned int c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c)
+	{
+		for(unsigned int b = 0; b < sizeof(backends) / sizeof(backends[0]); ++b)
+		{
+			backend = &backends[b];
+			bench_run(counts[c], 30000, 10);
+		}
+	}
+	for(unsigned int b = 0; b < sizeof(backends) / sizeof(backends[0]); ++b)
+	{
+		backend = &backends[b];
+		bench_run(5000, 1000, 50);
+	}
+	return 0;
+}
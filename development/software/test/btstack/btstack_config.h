@@ -0,0 +1,10 @@
+// host build of btstack, see ../src/components/btstack/include
+#ifndef BTSTACK_CONFIG_H
+#define BTSTACK_CONFIG_H
+
+#define HAVE_ASSERT
+#define HAVE_EMBEDDED_TIME_MS
+#define HAVE_FREERTOS_INCLUDE_PREFIX
+#define HAVE_FREERTOS_TASK_NOTIFICATIONS
+
+#endif
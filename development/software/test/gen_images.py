@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+#----------------------------------------------------------------------------#
+#             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             #
+#                                                                            #
+# Licensed under the Apache License, Version 2.0 (the "License");            #
+# you may not use this file except in compliance with the License.           #
+# You may obtain a copy of the License at                                    #
+#                                                                            #
+#     http://www.apache.org/licenses/LICENSE-2.0                             #
+#                                                                            #
+# Unless required by applicable law or agreed to in writing, software        #
+# distributed under the License is distributed on an "AS IS" BASIS,          #
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   #
+# See the License for the specific language governing permissions and        #
+# limitations under the License.                                             #
+#----------------------------------------------------------------------------#
+#
+# Writes old.bin and new.bin to the given directory: two firmware-like images,
+# the new one being the old one with code inserted, removed and patched
+#
+#   gen_images.py dir [seed] [size]
+
+import random
+import sys
+
+OPS = [b"\x36\x41\x00", b"\x1d\xf0", b"\x0c\x02", b"\x81\x00\x00\xe0\x08\x00"]
+
+
+def main(argv):
+	out  = argv[1]
+	rnd  = random.Random(int(argv[2]) if len(argv) > 2 else 1)
+	size = int(argv[3]) if len(argv) > 3 else 300000
+
+	old = bytearray()
+	while len(old) < size:
+		if rnd.random() < 0.2:
+			old += bytes(rnd.randrange(256) for _ in range(rnd.randrange(2, 6)))
+		else:
+			old += rnd.choice(OPS) + rnd.randrange(1 << 24).to_bytes(3, "little")
+	old = old[:size]
+
+	new = bytearray(old)
+	for _ in range(40):
+		p = rnd.randrange(len(new))
+		r = rnd.random()
+		if r < 0.3:
+			new[p:p] = bytes(rnd.randrange(256) for _ in range(rnd.randrange(1, 300)))
+		elif r < 0.5:
+			del new[p:p + rnd.randrange(1, 300)]
+		elif r < 0.8:
+			for k in range(p, min(p + 2000, len(new)), 37):
+				new[k] = (new[k] + 3) & 0xff
+		else:
+			q = rnd.randrange(len(old))
+			new[p:p] = old[q:q + rnd.randrange(100, 3000)]
+
+	open(out + "/old.bin", "wb").write(old)
+	open(out + "/new.bin", "wb").write(new)
+
+
+if __name__ == "__main__":
+	main(sys.argv)
@@ -0,0 +1,5 @@
+// host build: the ATT database is compiled from c64b_spp.gatt by the firmware build
+#pragma once
+#include <stdint.h>
+
+static const uint8_t profile_data[] = {0};
@@ -0,0 +1,36 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+typedef enum { LEDC_LOW_SPEED_MODE } ledc_mode_t;
+typedef enum { LEDC_TIMER_0, LEDC_TIMER_1, LEDC_TIMER_2, LEDC_TIMER_3 } ledc_timer_t;
+typedef enum { LEDC_CHANNEL_0, LEDC_CHANNEL_1, LEDC_CHANNEL_2, LEDC_CHANNEL_3 } ledc_channel_t;
+typedef enum { LEDC_INTR_DISABLE } ledc_intr_type_t;
+typedef enum { LEDC_AUTO_CLK, LEDC_USE_APB_CLK } ledc_clk_cfg_t;
+typedef enum { LEDC_REF_TICK, LEDC_APB_CLK } ledc_clk_src_t;
+
+typedef struct
+{
+	ledc_mode_t    speed_mode;
+	uint32_t       duty_resolution;
+	ledc_timer_t   timer_num;
+	uint32_t       freq_hz;
+	ledc_clk_cfg_t clk_cfg;
+} ledc_timer_config_t;
+
+typedef struct
+{
+	int              gpio_num;
+	ledc_mode_t      speed_mode;
+	ledc_channel_t   channel;
+	ledc_intr_type_t intr_type;
+	ledc_timer_t     timer_sel;
+	uint32_t         duty;
+	int              hpoint;
+} ledc_channel_config_t;
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t* cfg);
+esp_err_t ledc_channel_config(const ledc_channel_config_t* cfg);
+esp_err_t ledc_timer_set(ledc_mode_t mode, ledc_timer_t timer, uint32_t div, uint32_t bits, ledc_clk_src_t clk);
+esp_err_t ledc_timer_rst(ledc_mode_t mode, ledc_timer_t timer);
+esp_err_t ledc_set_duty(ledc_mode_t mode, ledc_channel_t channel, uint32_t duty);
+esp_err_t ledc_update_duty(ledc_mode_t mode, ledc_channel_t channel);
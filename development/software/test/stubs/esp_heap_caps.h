@@ -0,0 +1,5 @@
+#pragma once
+#include <stdlib.h>
+#define MALLOC_CAP_DMA  8
+#define MALLOC_CAP_8BIT 4
+#define heap_caps_malloc(len, caps) malloc(len)
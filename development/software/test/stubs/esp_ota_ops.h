@@ -0,0 +1,14 @@
+#pragma once
+#include "esp_partition.h"
+
+typedef uint32_t esp_ota_handle_t;
+
+#define OTA_WITH_SEQUENTIAL_WRITES 0xfffffffe
+
+const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start);
+const esp_partition_t* esp_ota_get_running_partition(void);
+esp_err_t              esp_ota_begin(const esp_partition_t* part, size_t size, esp_ota_handle_t* h);
+esp_err_t              esp_ota_write(esp_ota_handle_t h, const void* buf, size_t len);
+esp_err_t              esp_ota_end(esp_ota_handle_t h);
+esp_err_t              esp_ota_abort(esp_ota_handle_t h);
+esp_err_t              esp_ota_set_boot_partition(const esp_partition_t* part);
@@ -0,0 +1,9 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+typedef struct
+{
+	uint32_t size;
+} esp_partition_t;
+
+esp_err_t esp_partition_read(const esp_partition_t* part, size_t off, void* buf, size_t len);
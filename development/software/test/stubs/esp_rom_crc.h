@@ -0,0 +1,4 @@
+#pragma once
+#include <stdint.h>
+#include <zlib.h>
+#define esp_rom_crc32_le(crc, buf, len) ((uint32_t)crc32((crc), (buf), (len)))
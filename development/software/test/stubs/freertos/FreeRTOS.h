@@ -0,0 +1,32 @@
+// host build: FreeRTOS types, the calls are implemented by each test
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint32_t TickType_t;
+typedef int      BaseType_t;
+typedef unsigned UBaseType_t;
+typedef int      esp_err_t;
+
+#define portMAX_DELAY      0xffffffffu
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(x)   (x)
+#define pdTRUE             1
+#define pdFALSE            0
+#define pdPASS             1
+#define ESP_OK             0
+#define ESP_FAIL           -1
+#define ESP_ERR_NO_MEM     0x101
+#define IRAM_ATTR
+
+#define configSUPPORT_STATIC_ALLOCATION  0
+#define configSUPPORT_DYNAMIC_ALLOCATION 1
+#define portYIELD_FROM_ISR(x)            (void)(x)
+
+typedef struct { int x; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(m)     (void)(m)
+#define portEXIT_CRITICAL(m)      (void)(m)
+#define portENTER_CRITICAL_ISR(m) (void)(m)
+#define portEXIT_CRITICAL_ISR(m)  (void)(m)
@@ -0,0 +1,11 @@
+#pragma once
+#include "FreeRTOS.h"
+
+typedef void* QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t item_size);
+BaseType_t    xQueueSend(QueueHandle_t q, const void* item, TickType_t wait);
+BaseType_t    xQueueReceive(QueueHandle_t q, void* item, TickType_t wait);
+BaseType_t    xQueueReset(QueueHandle_t q);
+BaseType_t    xQueueSendToBack(QueueHandle_t q, const void* item, TickType_t wait);
+UBaseType_t   uxQueueMessagesWaiting(QueueHandle_t q);
@@ -0,0 +1,12 @@
+// host build: the digest is not checked by the tests
+#pragma once
+#include <stddef.h>
+#include <string.h>
+
+typedef struct { int x; } mbedtls_sha256_context;
+
+static inline void mbedtls_sha256_init(mbedtls_sha256_context* c) {}
+static inline void mbedtls_sha256_free(mbedtls_sha256_context* c) {}
+static inline int  mbedtls_sha256_starts(mbedtls_sha256_context* c, int is224) { return 0; }
+static inline int  mbedtls_sha256_update(mbedtls_sha256_context* c, const unsigned char* b, size_t n) { return 0; }
+static inline int  mbedtls_sha256_finish(mbedtls_sha256_context* c, unsigned char* out) { memset(out, 0, 32); return 0; }
@@ -0,0 +1,28 @@
+// host build: tinfl on top of zlib. Like the ROM inflater, it consumes all of
+// the input it is given once the stream has ended, trailer included
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <zlib.h>
+
+#define TINFL_LZ_DICT_SIZE        32768
+#define TINFL_FLAG_HAS_MORE_INPUT 2
+
+typedef enum
+{
+	TINFL_STATUS_FAILED           = -1,
+	TINFL_STATUS_DONE             = 0,
+	TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+	TINFL_STATUS_HAS_MORE_OUTPUT  = 2
+} tinfl_status;
+
+typedef struct
+{
+	z_stream z;
+	int      init;
+} tinfl_decompressor;
+
+#define tinfl_init(r) do { (r)->init = 0; } while(0)
+
+tinfl_status tinfl_decompress(tinfl_decompressor* r, const uint8_t* in, size_t* in_len,
+                              uint8_t* out_start, uint8_t* out, size_t* out_len, uint32_t flags);
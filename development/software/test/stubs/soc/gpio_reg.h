@@ -0,0 +1,7 @@
+#pragma once
+
+#define GPIO_OUT_W1TS_REG           0x3ff44008
+#define GPIO_OUT_W1TC_REG           0x3ff4400c
+#define GPIO_OUT1_W1TS_REG          0x3ff44014
+#define GPIO_OUT1_W1TC_REG          0x3ff44018
+#define GPIO_FUNC0_OUT_SEL_CFG_REG  0x3ff44530
@@ -0,0 +1,4 @@
+#pragma once
+
+#define LEDC_LS_SIG_OUT0_IDX 79
+#define SIG_GPIO_OUT_IDX     256
@@ -0,0 +1,9 @@
+// host build: register writes go to the test
+#pragma once
+#include <stdint.h>
+
+#define APB_CLK_FREQ 80000000
+
+void test_reg_write(uint32_t reg, uint32_t value);
+
+#define REG_WRITE(reg, value) test_reg_write((uint32_t)(reg), (uint32_t)(value))
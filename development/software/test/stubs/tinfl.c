@@ -0,0 +1,43 @@
+// host build: tinfl_decompress() of the ESP32 ROM, see rom/miniz.h
+
+#include <string.h>
+#include "rom/miniz.h"
+
+tinfl_status tinfl_decompress(tinfl_decompressor* r, const uint8_t* in, size_t* in_len,
+                              uint8_t* out_start, uint8_t* out, size_t* out_len, uint32_t flags)
+{
+	(void)out_start;
+	(void)flags;
+
+	if(!r->init)
+	{
+		memset(&r->z, 0, sizeof(r->z));
+		if(inflateInit2(&r->z, -15) != Z_OK)
+			return TINFL_STATUS_FAILED;
+		r->init = 1;
+	}
+
+	r->z.next_in   = (Bytef*)in;
+	r->z.avail_in  = *in_len;
+	r->z.next_out  = out;
+	r->z.avail_out = *out_len;
+
+	int st = inflate(&r->z, Z_NO_FLUSH);
+
+	*out_len -= r->z.avail_out;
+
+	if(st == Z_STREAM_END)
+	{
+		// the whole input is taken, as the ROM bit buffer may read past the end
+		inflateEnd(&r->z);
+		r->init = 0;
+		return TINFL_STATUS_DONE;
+	}
+
+	*in_len -= r->z.avail_in;
+
+	if((st != Z_OK) && (st != Z_BUF_ERROR))
+		return TINFL_STATUS_FAILED;
+
+	return (r->z.avail_out == 0) ? TINFL_STATUS_HAS_MORE_OUTPUT : TINFL_STATUS_NEEDS_MORE_INPUT;
+}
@@ -0,0 +1,23 @@
+// host build: the parts of bluepad32 used by the tested sources
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ARG_UNUSED(x) (void)(x)
+
+// the tests print their own results
+static inline void logi(const char* fmt, ...) {}
+static inline void loge(const char* fmt, ...) {}
+static inline void logd(const char* fmt, ...) {}
+
+// types of the bluepad32 API, only passed around by the tested sources
+typedef int uni_error_t;
+typedef struct uni_hid_device_s uni_hid_device_t;
+typedef struct
+{
+	uint8_t modifiers;
+	uint8_t pressed_keys[10];
+} uni_keyboard_t;
@@ -0,0 +1,109 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+// Host test of the controller report rings: a gamepad button pressed and
+// released while the ring is full must still reach the consumer
+
+#include "c64b_input.c"
+
+#include <stdio.h>
+
+//----------------------------------------------------------------------------//
+
+static unsigned int fails = 0;
+
+static void test_expect(const char* what, bool ok)
+{
+	printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+	fails += ok ? 0 : 1;
+}
+
+static t_c64b_input_ring ring;
+
+static bool test_push(uint32_t t_us, uint16_t buttons, uint8_t analog)
+{
+	t_c64b_input in = {.t_us = t_us};
+	in.gp.buttons = buttons;
+	in.gp.analog  = analog;
+	return c64b_input_push_gp(&ring, &in);
+}
+
+//----------------------------------------------------------------------------//
+
+static void test_full(void)
+{
+	t_c64b_input in;
+	bool         ok = true;
+
+	// fill the ring with alternating states, none of them merged away
+	for(unsigned int i = 0; i < INPUT_RING_LEN; ++i)
+		ok &= test_push(i, (i & 1) ? 0x0 : 0x8, 0);
+	test_expect("ring filled", ok);
+
+	// a short press of button 0 and a stick move, all while full
+	test_expect("press not queued", !test_push(1000, 0x1, 0));
+	test_expect("release not queued", !test_push(1001, 0x0, 2));
+	test_expect("drops counted", ring.drops == 2);
+
+	// room for one entry: only the merged state fits
+	test_expect("pop", c64b_input_pop(&ring, &in));
+	test_expect("merged state queued, latest state not", !test_push(1002, 0x0, 2));
+
+	for(unsigned int i = 1; i < INPUT_RING_LEN; ++i)
+		c64b_input_pop(&ring, &in);
+
+	test_expect("merged state holds the press", c64b_input_pop(&ring, &in) &&
+		(in.gp.buttons == 0x1) && (in.gp.analog == 2) && (in.t_us == 1000));
+	test_expect("nothing else queued", !c64b_input_peek(&ring, &in));
+
+	// the latest state follows once there is room, timed from its first drop
+	test_expect("latest state queued", test_push(1003, 0x0, 2));
+	test_expect("release seen", c64b_input_pop(&ring, &in) && (in.gp.buttons == 0x0) && (in.t_us == 1002));
+	test_expect("ring empty", !c64b_input_peek(&ring, &in));
+}
+
+//----------------------------------------------------------------------------//
+
+static void test_unchanged(void)
+{
+	t_c64b_input in;
+
+	memset(&ring, 0, sizeof(ring));
+	test_push(0, 0x2, 1);
+	test_push(1, 0x2, 1);
+	test_expect("unchanged report not queued", c64b_input_pop(&ring, &in) && !c64b_input_peek(&ring, &in));
+}
+
+//----------------------------------------------------------------------------//
+
+int main(void)
+{
+	test_full();
+	test_unchanged();
+
+	printf("%u failures\n", fails);
+
+	return (fails == 0) ? 0 : 1;
+}
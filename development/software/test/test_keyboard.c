@@ -0,0 +1,609 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+// Host test of the keyboard feed engine in virtual time: the W1TS / W1TC
+// register writes and the modifier pins drive a model of the keyboard lines,
+// esp_timer runs the engine callback at the times it asks for. Macros are fed
+// as the firmware does and the trace of the lines gives the hold and release
+// time of every key
+
+#include "c64b_keyboard.c"
+#include "c64b_pinout_0v2.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+//----------------------------------------------------------------------------//
+// virtual time: the armed esp_timer due first runs next. A producer blocked on
+// the queue or on the sync event lets the time run until it is released
+
+struct esp_timer
+{
+	esp_timer_cb_t cb;
+	void*          arg;
+	uint64_t       due;
+	bool           armed;
+};
+
+#define TEST_TIMERS 4
+
+static struct esp_timer timers[TEST_TIMERS];
+static unsigned int     num_timers;
+static uint64_t         now_us;
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* h)
+{
+	if(num_timers == TEST_TIMERS)
+		return ESP_FAIL;
+	timers[num_timers].cb  = args->callback;
+	timers[num_timers].arg = args->arg;
+	*h = &timers[num_timers++];
+	return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t h, uint64_t us)
+{
+	h->due   = now_us + us;
+	h->armed = true;
+	return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t h)
+{
+	h->armed = false;
+	return ESP_OK;
+}
+
+int64_t esp_timer_get_time(void)
+{
+	return (int64_t)now_us;
+}
+
+static void test_step(const char* waiting)
+{
+	struct esp_timer* next = NULL;
+	for(unsigned int i = 0; i < num_timers; ++i)
+		if(timers[i].armed && ((next == NULL) || (timers[i].due < next->due)))
+			next = &timers[i];
+
+	if(next == NULL)
+	{
+		printf("FAIL %s, the engine is not running\n", waiting);
+		exit(1);
+	}
+
+	now_us      = next->due;
+	next->armed = false;
+	next->cb(next->arg);
+}
+
+//----------------------------------------------------------------------------//
+// FreeRTOS queue and binary semaphore
+
+typedef struct
+{
+	uint8_t*    buf;
+	UBaseType_t len;
+	UBaseType_t size;
+	UBaseType_t head;
+	UBaseType_t num;
+} t_test_queue;
+
+static unsigned int posted; // events queued to the engine
+
+QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t size)
+{
+	t_test_queue* q = calloc(1, sizeof(t_test_queue));
+	q->buf  = malloc(len * size);
+	q->len  = len;
+	q->size = size;
+	return q;
+}
+
+BaseType_t xQueueSend(QueueHandle_t h, const void* item, TickType_t wait)
+{
+	t_test_queue* q = h;
+	while(q->num == q->len)
+		test_step("queue full");
+	memcpy(&q->buf[((q->head + q->num) % q->len) * q->size], item, q->size);
+	q->num++;
+	posted++;
+	return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t h, void* item, TickType_t wait)
+{
+	t_test_queue* q = h;
+	if(q->num == 0)
+		return pdFALSE;
+	memcpy(item, &q->buf[q->head * q->size], q->size);
+	q->head = (q->head + 1) % q->len;
+	q->num--;
+	return pdTRUE;
+}
+
+BaseType_t xQueueReset(QueueHandle_t h)
+{
+	t_test_queue* q = h;
+	q->head = 0;
+	q->num  = 0;
+	return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t h)
+{
+	return ((t_test_queue*)h)->num;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+	return calloc(1, sizeof(bool));
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t wait)
+{
+	while(!*(bool*)s)
+		test_step("sync event not given");
+	*(bool*)s = false;
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s)
+{
+	*(bool*)s = true;
+	return pdTRUE;
+}
+
+//----------------------------------------------------------------------------//
+// peripherals the tested paths do not reach: the rollover timer is not
+// available, autofire is never started
+
+esp_err_t gptimer_new_timer(const gptimer_config_t* cfg, gptimer_handle_t* timer) { return ESP_FAIL; }
+esp_err_t gptimer_register_event_callbacks(gptimer_handle_t timer, const gptimer_event_callbacks_t* cbs, void* arg) { return ESP_FAIL; }
+esp_err_t gptimer_enable(gptimer_handle_t timer) { return ESP_FAIL; }
+esp_err_t gptimer_set_alarm_action(gptimer_handle_t timer, const gptimer_alarm_config_t* alarm) { return ESP_FAIL; }
+esp_err_t gptimer_set_raw_count(gptimer_handle_t timer, uint64_t value) { return ESP_FAIL; }
+esp_err_t gptimer_start(gptimer_handle_t timer) { return ESP_FAIL; }
+esp_err_t gptimer_stop(gptimer_handle_t timer) { return ESP_FAIL; }
+esp_err_t ledc_timer_config(const ledc_timer_config_t* cfg) { return ESP_OK; }
+esp_err_t ledc_channel_config(const ledc_channel_config_t* cfg) { return ESP_OK; }
+esp_err_t ledc_timer_set(ledc_mode_t mode, ledc_timer_t timer, uint32_t div, uint32_t bits, ledc_clk_src_t clk) { return ESP_OK; }
+esp_err_t ledc_timer_rst(ledc_mode_t mode, ledc_timer_t timer) { return ESP_OK; }
+esp_err_t ledc_set_duty(ledc_mode_t mode, ledc_channel_t channel, uint32_t duty) { return ESP_OK; }
+esp_err_t ledc_update_duty(ledc_mode_t mode, ledc_channel_t channel) { return ESP_OK; }
+esp_err_t gpio_reset_pin(gpio_num_t pin) { return ESP_OK; }
+esp_err_t gpio_set_direction(gpio_num_t pin, gpio_mode_t mode) { return ESP_OK; }
+
+//----------------------------------------------------------------------------//
+// latency probe: the report being parsed, if any, and the samples taken by
+// the engine when the key of a mark is driven
+
+#define TEST_LAT 8
+
+typedef struct
+{
+	unsigned int dev;
+	uint32_t     t_us;
+	uint64_t     edge_us;
+} t_test_lat;
+
+static bool         lat_open;
+static unsigned int lat_dev;
+static uint32_t     lat_t_us;
+static t_test_lat   lat[TEST_LAT];
+static unsigned int num_lat;
+
+bool c64b_latency_current(unsigned int* dev, uint32_t* t_us)
+{
+	*dev  = lat_dev;
+	*t_us = lat_t_us;
+	return lat_open;
+}
+
+void c64b_latency_add(unsigned int dev, t_c64b_lat_path path, uint32_t t_us)
+{
+	if((path == LAT_PATH_KEYS) && (num_lat < TEST_LAT))
+		lat[num_lat++] = (t_test_lat){dev, t_us, now_us};
+}
+
+//----------------------------------------------------------------------------//
+// the keyboard lines: the crosspoint closed by the mux, if enabled, and the
+// modifier lines. Every change is traced with its time
+
+#define TEST_XP_NONE 0xff
+#define TEST_TRACE   256
+
+typedef struct
+{
+	uint64_t t_us;
+	uint8_t  xp;    // col * 8 + row of the matrix, TEST_XP_NONE when open
+	bool     shft;
+	bool     ctrl;
+	bool     cmdr;
+} t_test_lines;
+
+static t_c64b_keyboard kb;
+static uint64_t        out;     // GPIO output register, both banks
+static t_test_lines    trace[TEST_TRACE];
+static unsigned int    num_trace;
+static unsigned int    writes;  // register writes and pin changes
+
+static const uint8_t col_perm[] = COL_PERM;
+static const uint8_t row_perm[] = ROW_PERM;
+
+static bool test_pin(unsigned int pin)
+{
+	return (pin < 64) && ((out >> pin) & 1);
+}
+
+static void test_lines_changed(void)
+{
+	t_test_lines l = {.t_us = now_us, .xp = TEST_XP_NONE};
+
+	// KBEN is active low
+	if(!test_pin(kb.pin_kben))
+	{
+		unsigned int col = 0;
+		unsigned int row = 0;
+		for(unsigned int b = 0; b < C64B_KKA_BITS; ++b)
+		{
+			col |= test_pin(kb.pin_kca[b]) << b;
+			row |= test_pin(kb.pin_kra[b]) << b;
+		}
+		for(unsigned int c = 0; c < 8; ++c)
+			for(unsigned int r = 0; r < 8; ++r)
+				if((col_perm[c] == col) && (row_perm[r] == row))
+					l.xp = c * 8 + r;
+	}
+	l.shft = test_pin(kb.pin_shft);
+	l.ctrl = test_pin(kb.pin_ctrl);
+	l.cmdr = test_pin(kb.pin_cmdr);
+
+	writes++;
+	if(num_trace > 0)
+	{
+		t_test_lines* last = &trace[num_trace - 1];
+		if((last->xp == l.xp) && (last->shft == l.shft) && (last->ctrl == l.ctrl) && (last->cmdr == l.cmdr))
+			return;
+	}
+	if(num_trace < TEST_TRACE)
+		trace[num_trace++] = l;
+}
+
+void test_reg_write(uint32_t reg, uint32_t value)
+{
+	switch(reg)
+	{
+		case GPIO_OUT_W1TS_REG:  out |= value;                   break;
+		case GPIO_OUT_W1TC_REG:  out &= ~(uint64_t)value;         break;
+		case GPIO_OUT1_W1TS_REG: out |= (uint64_t)value << 32;    break;
+		case GPIO_OUT1_W1TC_REG: out &= ~((uint64_t)value << 32); break;
+		default:                 return;
+	}
+	test_lines_changed();
+}
+
+esp_err_t gpio_set_level(gpio_num_t pin, uint32_t level)
+{
+	if(pin >= 64)
+		return ESP_FAIL;
+	out = level ? (out | (1ULL << pin)) : (out & ~(1ULL << pin));
+	test_lines_changed();
+	return ESP_OK;
+}
+
+//----------------------------------------------------------------------------//
+
+static unsigned int fails = 0;
+
+static void test_expect(const char* what, bool ok)
+{
+	printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+	fails += ok ? 0 : 1;
+
+	if(!ok)
+	{
+		for(unsigned int i = 0; i < num_trace; ++i)
+			printf("     %8llu us: xp %3u shft %u ctrl %u cmdr %u\n", (unsigned long long)trace[i].t_us,
+				trace[i].xp, trace[i].shft, trace[i].ctrl, trace[i].cmdr);
+	}
+}
+
+static void test_start(t_c64b_pace pace)
+{
+	c64b_keyboard_pace_set(&kb, pace);
+	num_trace = 0;
+	posted    = 0;
+	writes    = 0;
+	test_lines_changed();
+}
+
+static uint8_t test_xp(const char* key)
+{
+	const t_c64b_key_id* k = &KEY_IDS[c64b_keyboard_key_to_idx(key)];
+	return k->col * 8 + k->row;
+}
+
+// the i-th time the crosspoint of key is closed: when and for how long, and
+// the time the mux stays open afterwards, 0 if another key follows directly
+typedef struct
+{
+	bool     found;
+	uint64_t t_us;
+	uint64_t hold_us;
+	uint64_t gap_us;
+	bool     shft;
+} t_test_press;
+
+static t_test_press test_press(const char* key, unsigned int nth)
+{
+	t_test_press p  = {0};
+	uint8_t      xp = test_xp(key);
+
+	for(unsigned int i = 0; i + 1 < num_trace; ++i)
+	{
+		bool start = (trace[i].xp == xp) && ((i == 0) || (trace[i - 1].xp != xp));
+		if(!start || (nth-- > 0))
+			continue;
+
+		unsigned int e = i + 1;
+		while((e < num_trace) && (trace[e].xp == xp))
+			++e;
+		if(e == num_trace)
+			return p;
+
+		unsigned int g = e;
+		while((g < num_trace) && (trace[g].xp == TEST_XP_NONE))
+			++g;
+
+		p.found   = true;
+		p.t_us    = trace[i].t_us;
+		p.hold_us = trace[e].t_us - trace[i].t_us;
+		p.gap_us  = (trace[e].xp == TEST_XP_NONE) ? (((g < num_trace) ? trace[g].t_us : now_us) - trace[e].t_us) : 0;
+		p.shft    = trace[i].shft;
+		return p;
+	}
+	return p;
+}
+
+// the mux only ever closes the crosspoints of the keys fed, in order
+static bool test_sequence(const char* const* keys, unsigned int num)
+{
+	unsigned int k = 0;
+	for(unsigned int i = 0; i < num_trace; ++i)
+	{
+		if((trace[i].xp == TEST_XP_NONE) || ((i > 0) && (trace[i].xp == trace[i - 1].xp)))
+			continue;
+		if((k == num) || (trace[i].xp != test_xp(keys[k++])))
+			return false;
+	}
+	return k == num;
+}
+
+//----------------------------------------------------------------------------//
+
+static void test_timing(void)
+{
+	static const char* const ab[] = {"a", "b"};
+	static const char* const aa[] = {"a", "a"};
+	t_test_press a;
+	t_test_press b;
+
+	test_start(C64B_PACE_PAL);
+	c64b_keyboard_feed_str(&kb, "ab");
+	a = test_press("a", 0);
+	b = test_press("b", 0);
+	test_expect("PAL: keys held 24 ms",
+		a.found && b.found && (a.hold_us == 24000) && (b.hold_us == 24000));
+	test_expect("PAL: different keys overlap, no release gap",
+		(a.gap_us == 0) && (b.t_us == a.t_us + 24000) && test_sequence(ab, 2));
+	test_expect("PAL: released 24 ms before the feed returns", b.gap_us == 24000);
+
+	test_start(C64B_PACE_SAFE);
+	c64b_keyboard_feed_str(&kb, "ab");
+	a = test_press("a", 0);
+	b = test_press("b", 0);
+	test_expect("safe: keys held 30 ms, released 30 ms",
+		a.found && b.found && (a.hold_us == 30000) && (a.gap_us == 30000) &&
+		(b.hold_us == 30000) && (b.t_us == a.t_us + 60000) && test_sequence(ab, 2));
+
+	// the hold and release times are separate
+	test_start(C64B_PACE_SAFE);
+	kb.feed_psh_us = 31000;
+	kb.feed_rel_us = 17000;
+	c64b_keyboard_feed_str(&kb, "ab");
+	a = test_press("a", 0);
+	b = test_press("b", 0);
+	test_expect("held 31 ms, released 17 ms",
+		a.found && b.found && (a.hold_us == 31000) && (a.gap_us == 17000) &&
+		(b.hold_us == 31000) && (b.gap_us == 17000));
+
+	test_start(C64B_PACE_NTSC);
+	c64b_keyboard_feed_str(&kb, "aa");
+	a = test_press("a", 0);
+	b = test_press("a", 1);
+	test_expect("NTSC: a repeated key is released in between",
+		a.found && b.found && (a.hold_us == 20000) && (a.gap_us == 20000) &&
+		(b.t_us == a.t_us + 40000) && test_sequence(aa, 2));
+
+	test_start(C64B_PACE_PAL);
+	c64b_keyboard_feed_str(&kb, "aA");
+	// both are on the same crosspoint
+	a = test_press("a", 0);
+	b = test_press("a", 1);
+	test_expect("shift changes with the mux open",
+		a.found && b.found && !a.shft && b.shft && (a.gap_us == 24000) && (b.hold_us == 24000));
+	test_expect("shift released with the last key", !trace[num_trace - 1].shft);
+
+	// the queue only holds FEED_QUEUE_LEN events, the producer waits
+	char   line[3 * FEED_QUEUE_LEN];
+	size_t n = 0;
+	for(unsigned int i = 0; i < sizeof(line) / 2; ++i)
+		line[n++] = (i & 1) ? 'b' : 'a';
+	line[n] = 0;
+	test_start(C64B_PACE_PAL);
+	uint64_t t0 = now_us;
+	c64b_keyboard_feed_str(&kb, line);
+	test_expect("long macro played in full at the key rate",
+		(now_us - t0 == (uint64_t)n * 24000 + 24000) && test_press("b", (unsigned int)n / 2 - 1).found);
+}
+
+//----------------------------------------------------------------------------//
+
+static void test_noops(void)
+{
+	const t_c64b_key_id* a = &KEY_IDS[c64b_keyboard_key_to_idx("a")];
+
+	test_start(C64B_PACE_PAL);
+	c64b_keyboard_shft_psh(&kb);
+	c64b_keyboard_shft_psh(&kb);
+	c64b_keyboard_ctrl_rel(&kb);
+	c64b_keyboard_cmdr_rel(&kb);
+	c64b_keyboard_key_psh(&kb, a);
+	c64b_keyboard_key_psh(&kb, a);
+	c64b_keyboard_key_rel(&kb, a);
+	c64b_keyboard_keys_rel(&kb, false);
+	c64b_keyboard_shft_rel(&kb);
+	c64b_keyboard_shft_rel(&kb);
+	c64b_keyboard_feed_sync(&kb);
+	test_expect("events that change no line are not queued", posted == 5);
+	test_expect("each line changes once",
+		(num_trace == 5) && trace[1].shft && (trace[2].xp == test_xp("a")) &&
+		(trace[3].xp == TEST_XP_NONE) && !trace[4].shft);
+	test_expect("a held key is not pressed again", test_press("a", 0).hold_us == 24000);
+
+	// the lines are idle, only the sync event is queued
+	test_start(C64B_PACE_PAL);
+	c64b_keyboard_keys_rel(&kb, true);
+	c64b_keyboard_mods_rel(&kb);
+	c64b_keyboard_feed_sync(&kb);
+	test_expect("releasing idle lines queues nothing", (posted == 1) && (writes == 1));
+}
+
+//----------------------------------------------------------------------------//
+// a reset while a key is held and more are queued: the engine drops them at
+// the end of the hold time, nothing is driven once the reset has returned
+
+static void test_reset(void)
+{
+	test_start(C64B_PACE_PAL);
+	c64b_keyboard_key_psh(&kb, &KEY_IDS[c64b_keyboard_key_to_idx("a")]);
+	test_step("press not started");
+	c64b_keyboard_key_psh(&kb, &KEY_IDS[c64b_keyboard_key_to_idx("b")]);
+	c64b_keyboard_shft_psh(&kb);
+
+	uint64_t t0 = now_us;
+	c64b_keyboard_reset(&kb);
+	uint64_t t1 = now_us;
+	unsigned int n = num_trace;
+
+	test_expect("reset waits for the held key and its release", (t1 - t0 == 48000) && (test_press("a", 0).hold_us == 24000));
+	test_expect("queued events dropped", !test_press("b", 0).found && !trace[num_trace - 1].shft &&
+		(trace[num_trace - 1].xp == TEST_XP_NONE));
+
+	// the engine settles without driving a line
+	for(unsigned int i = 0; i < num_timers; ++i)
+		while(timers[i].armed)
+			test_step("settle");
+	test_expect("no line driven after the reset", num_trace == n);
+
+	test_start(C64B_PACE_PAL);
+	c64b_keyboard_feed_str(&kb, "b");
+	test_expect("next stream played in full", test_press("b", 0).hold_us == 24000);
+}
+
+//----------------------------------------------------------------------------//
+// reports queued before their keys are played keep their own time, also when
+// the same device or another one posts in between
+
+static void test_latency(void)
+{
+	const t_c64b_key_id* a = &KEY_IDS[c64b_keyboard_key_to_idx("a")];
+	const t_c64b_key_id* b = &KEY_IDS[c64b_keyboard_key_to_idx("b")];
+	const t_c64b_key_id* c = &KEY_IDS[c64b_keyboard_key_to_idx("c")];
+
+	test_start(C64B_PACE_PAL);
+	num_lat  = 0;
+	lat_open = true;
+
+	lat_dev = 1; lat_t_us = 100;
+	c64b_keyboard_key_psh(&kb, a);
+	lat_dev = 1; lat_t_us = 200;
+	c64b_keyboard_key_psh(&kb, b);
+	lat_dev = 2; lat_t_us = 300;
+	c64b_keyboard_key_psh(&kb, c);
+
+	lat_open = false;
+	c64b_keyboard_keys_rel(&kb, true);
+	c64b_keyboard_feed_sync(&kb);
+
+	test_expect("one sample per key", num_lat == 3);
+	test_expect("samples keep the report times",
+		(lat[0].dev == 1) && (lat[0].t_us == 100) && (lat[1].dev == 1) && (lat[1].t_us == 200) &&
+		(lat[2].dev == 2) && (lat[2].t_us == 300));
+	test_expect("samples taken when the keys are driven",
+		(lat[0].edge_us == test_press("a", 0).t_us) && (lat[2].edge_us == test_press("c", 0).t_us));
+}
+
+//----------------------------------------------------------------------------//
+
+int main(void)
+{
+	kb.pin_kca[0] = PIN_KCA0;
+	kb.pin_kca[1] = PIN_KCA1;
+	kb.pin_kca[2] = PIN_KCA2;
+	kb.pin_kra[0] = PIN_KRA0;
+	kb.pin_kra[1] = PIN_KRA1;
+	kb.pin_kra[2] = PIN_KRA2;
+	kb.pin_col[0] = PIN_COL0;
+	kb.pin_col[1] = PIN_COL1;
+	kb.pin_col[2] = PIN_COL2;
+	kb.pin_col[3] = PIN_COL3;
+	kb.pin_col[4] = PIN_COL4;
+	kb.pin_row[0] = PIN_ROW0;
+	kb.pin_row[1] = PIN_ROW1;
+	kb.pin_row[2] = PIN_ROW2;
+	kb.pin_row[3] = PIN_ROW3;
+	kb.pin_row[4] = PIN_ROW4;
+	kb.pin_nrst   = PIN_nRST;
+	kb.pin_ctrl   = PIN_CTRL;
+	kb.pin_shft   = PIN_SHFT;
+	kb.pin_cmdr   = PIN_CMDR;
+	kb.pin_kben   = PIN_KBEN;
+	kb.col_perm   = col_perm;
+	kb.row_perm   = row_perm;
+
+	c64b_keyboard_init(&kb);
+	now_us = 1000000;
+
+	test_timing();
+	test_noops();
+	test_reset();
+	test_latency();
+
+	printf("%u failures\n", fails);
+
+	return (fails == 0) ? 0 : 1;
+}
@@ -0,0 +1,205 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+// Host test of the callbacks posted to the FreeRTOS run loop of btstack with
+// btstack_run_loop_execute_on_main_thread(): order, posts of a pending
+// registration, posts from a callback and from other threads, and
+// registrations that still carry the next pointer of another list
+
+#include "btstack_run_loop_freertos.c"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//----------------------------------------------------------------------------//
+// fakes of FreeRTOS: the run loop task is the main thread, the notifications
+// are only counted
+
+static unsigned int notified = 0;
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) { return (TaskHandle_t)1; }
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) { __atomic_add_fetch(&notified, 1, __ATOMIC_RELAXED); return pdPASS; }
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action, BaseType_t* woken) { *woken = pdFALSE; return pdPASS; }
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t* value, TickType_t wait) { return pdTRUE; }
+QueueHandle_t xQueueCreate(UBaseType_t n, UBaseType_t size) { return (QueueHandle_t)1; }
+BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t wait) { return pdFALSE; }
+BaseType_t xQueueSendToBack(QueueHandle_t q, const void* item, TickType_t wait) { return pdFALSE; }
+uint32_t hal_time_ms(void) { return 0; }
+
+//----------------------------------------------------------------------------//
+
+typedef struct
+{
+	btstack_context_callback_registration_t reg;
+	unsigned int                            runs;
+	unsigned int                            order;
+	unsigned int                            reposts;
+	unsigned int                            posted;   // last value posted by a thread
+	unsigned int                            seen;     // value seen by the last run
+} t_test_cb;
+
+static unsigned int fails = 0;
+static unsigned int order = 0;
+
+static void test_callback(void* context)
+{
+	t_test_cb* cb = context;
+
+	cb->runs++;
+	cb->order = ++order;
+	cb->seen  = __atomic_load_n(&cb->posted, __ATOMIC_ACQUIRE);
+
+	if(cb->reposts > 0)
+	{
+		cb->reposts--;
+		btstack_run_loop_freertos_execute_on_main_thread(&cb->reg);
+	}
+}
+
+static void test_reset(t_test_cb* cbs, unsigned int n)
+{
+	memset(cbs, 0, n * sizeof(cbs[0]));
+	for(unsigned int i = 0; i < n; ++i)
+	{
+		cbs[i].reg.callback = test_callback;
+		cbs[i].reg.context  = &cbs[i];
+	}
+	order    = 0;
+	notified = 0;
+}
+
+static void test_expect(const char* what, bool ok)
+{
+	printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+	fails += ok ? 0 : 1;
+}
+
+static bool test_idle(const t_test_cb* cbs, unsigned int n)
+{
+	bool ok = (btstack_run_loop_callbacks == NULL);
+	for(unsigned int i = 0; i < n; ++i)
+		ok = ok && (cbs[i].reg.item == NULL);
+	return ok;
+}
+
+//----------------------------------------------------------------------------//
+// threads posting their registrations as often as they can, the value posted
+// last by each must have been seen by a run of its callback
+
+#define TEST_THREADS 3
+#define TEST_REGS    4
+#define TEST_POSTS   200000
+
+static t_test_cb    thread_cbs[TEST_THREADS][TEST_REGS];
+static unsigned int threads_done;
+
+static void* test_thread(void* arg)
+{
+	t_test_cb* cbs = arg;
+
+	for(unsigned int i = 1; i <= TEST_POSTS; ++i)
+	{
+		t_test_cb* cb = &cbs[i % TEST_REGS];
+		__atomic_store_n(&cb->posted, i, __ATOMIC_RELEASE);
+		btstack_run_loop_freertos_execute_on_main_thread(&cb->reg);
+	}
+	__atomic_add_fetch(&threads_done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static bool test_threads(void)
+{
+	test_reset(&thread_cbs[0][0], TEST_THREADS * TEST_REGS);
+
+	pthread_t threads[TEST_THREADS];
+	threads_done = 0;
+	for(unsigned int t = 0; t < TEST_THREADS; ++t)
+		pthread_create(&threads[t], NULL, test_thread, thread_cbs[t]);
+
+	// the last batch is taken after all the posts
+	while(__atomic_load_n(&threads_done, __ATOMIC_ACQUIRE) < TEST_THREADS)
+		btstack_run_loop_freertos_execute_callbacks();
+	btstack_run_loop_freertos_execute_callbacks();
+
+	for(unsigned int t = 0; t < TEST_THREADS; ++t)
+		pthread_join(threads[t], NULL);
+
+	bool ok = test_idle(&thread_cbs[0][0], TEST_THREADS * TEST_REGS);
+	for(unsigned int t = 0; t < TEST_THREADS; ++t)
+		for(unsigned int r = 0; r < TEST_REGS; ++r)
+			ok = ok && (thread_cbs[t][r].runs > 0) && (thread_cbs[t][r].seen == thread_cbs[t][r].posted);
+
+	return ok;
+}
+
+//----------------------------------------------------------------------------//
+
+int main(void)
+{
+	btstack_run_loop_freertos_init();
+
+	t_test_cb cbs[3];
+
+	// run in the order they were posted, once per batch
+	test_reset(cbs, 3);
+	btstack_run_loop_freertos_execute_on_main_thread(&cbs[1].reg);
+	btstack_run_loop_freertos_execute_on_main_thread(&cbs[0].reg);
+	btstack_run_loop_freertos_execute_on_main_thread(&cbs[2].reg);
+	btstack_run_loop_freertos_execute_on_main_thread(&cbs[1].reg);
+	btstack_run_loop_freertos_execute_callbacks();
+	test_expect("callbacks run in posting order",
+		(cbs[1].order == 1) && (cbs[0].order == 2) && (cbs[2].order == 3));
+	test_expect("pending registration posted again runs once",
+		(cbs[0].runs == 1) && (cbs[1].runs == 1) && (cbs[2].runs == 1) && (notified == 4));
+	test_expect("nothing pending after the batch", test_idle(cbs, 3));
+
+	// a callback posting itself runs again in the next batch
+	test_reset(cbs, 3);
+	cbs[0].reposts = 1;
+	btstack_run_loop_freertos_execute_on_main_thread(&cbs[0].reg);
+	btstack_run_loop_freertos_execute_callbacks();
+	bool once = (cbs[0].runs == 1);
+	btstack_run_loop_freertos_execute_callbacks();
+	test_expect("callback posting itself runs in the next batch",
+		once && (cbs[0].runs == 2) && test_idle(cbs, 3));
+
+	// btstack_linked_list_pop() leaves the next pointer as it was
+	test_reset(cbs, 3);
+	btstack_linked_list_t other = NULL;
+	btstack_linked_list_add_tail(&other, (btstack_linked_item_t*)&cbs[0].reg);
+	btstack_linked_list_add_tail(&other, (btstack_linked_item_t*)&cbs[1].reg);
+	btstack_linked_list_pop(&other);
+	btstack_run_loop_freertos_execute_on_main_thread(&cbs[0].reg);
+	btstack_run_loop_freertos_execute_callbacks();
+	test_expect("registration popped from another list runs", (cbs[0].runs == 1) && test_idle(cbs, 1));
+
+	test_expect("posts from other threads", test_threads());
+
+	printf("%u failures\n", fails);
+
+	return (fails == 0) ? 0 : 1;
+}
@@ -0,0 +1,248 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+// Host test of the BLE text channel: the GATT service events and the received
+// data are fed to the packet handler, the credits it notifies are checked and
+// the received text is typed by the feed job into a buffer
+
+#include "c64b_spp.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+//----------------------------------------------------------------------------//
+// fakes of the service, the run loop and the keyboard feed: requests are
+// recorded and run by the test when the stack would run them
+
+static btstack_context_callback_registration_t* can_send;      // requested, not run yet
+static btstack_context_callback_registration_t* on_main;       // posted, not run yet
+static uint32_t                                 granted;       // credits notified
+static unsigned int                             notifications;
+static unsigned int                             jobs;          // feed jobs queued
+static bool                                     queue_full;
+static char                                     typed[4096];   // strings typed, '|' after each
+static uint32_t                                 slept_ms;
+
+void nordic_spp_service_server_init(btstack_packet_handler_t handler) {}
+void nordic_spp_service_server_request_can_send_now(btstack_context_callback_registration_t* reg, hci_con_handle_t con) { can_send = reg; }
+void btstack_run_loop_execute_on_main_thread(btstack_context_callback_registration_t* reg) { on_main = reg; }
+void att_server_init(const uint8_t* db, att_read_callback_t rd, att_write_callback_t wr) {}
+void gap_advertisements_set_params(uint16_t min, uint16_t max, uint8_t type, uint8_t direct_type, bd_addr_t direct, uint8_t map, uint8_t filter) {}
+void gap_advertisements_set_data(uint8_t len, uint8_t* data) {}
+void gap_advertisements_enable(int enabled) {}
+uint32_t c64b_typein_pause_us(size_t bytes) { return 0; }
+void vTaskDelay(TickType_t ticks) { slept_ms += ticks * portTICK_PERIOD_MS; }
+
+int nordic_spp_service_server_send(hci_con_handle_t con, const uint8_t* data, uint16_t size)
+{
+	granted += little_endian_read_16(data, 0);
+	notifications++;
+	return ERROR_CODE_SUCCESS;
+}
+
+bool keyboard_macro_stream(t_c64b_mcro_stream stream, const char* arg)
+{
+	if(queue_full)
+		return false;
+	jobs++;
+	return true;
+}
+
+bool c64b_keyboard_feed_str(t_c64b_keyboard* h, const char* s)
+{
+	strcat(typed, s);
+	strcat(typed, "|");
+	return true;
+}
+
+// the keys of c64b_keyboard_text_key() that the test sends
+const char* c64b_keyboard_text_key(uint8_t c, char* buf)
+{
+	if((c == 0x0a) || (c == 0x0d))
+		return "~ret~";
+	if((c < 0x20) || (c > 0x7e))
+		return NULL;
+
+	buf[0] = ((c >= 'A') && (c <= 'Z')) ? (c + 'a' - 'A') : c;
+	buf[1] = 0;
+	return buf;
+}
+
+//----------------------------------------------------------------------------//
+
+static unsigned int fails = 0;
+
+static void test_expect(const char* what, bool ok)
+{
+	printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+	fails += ok ? 0 : 1;
+}
+
+static void test_event(uint8_t subevent, hci_con_handle_t con)
+{
+	uint8_t packet[5] = {HCI_EVENT_GATTSERVICE_META, 3, subevent};
+	little_endian_store_16(packet, 3, con);
+	spp_packet_handler(HCI_EVENT_PACKET, 0, packet, sizeof(packet));
+}
+
+static void test_rx(const char* s, size_t len)
+{
+	static uint8_t packet[2048];
+	for(size_t i = 0; i < len; ++i)
+		packet[i] = (s != NULL) ? (uint8_t)s[i] : (uint8_t)('a' + i % 26);
+	spp_packet_handler(RFCOMM_DATA_PACKET, 0, packet, (uint16_t)len);
+}
+
+static void test_rx_str(const char* s)
+{
+	test_rx(s, strlen(s));
+}
+
+// what the BTstack thread does next: posted callbacks, then the notification
+static void test_stack(void)
+{
+	btstack_context_callback_registration_t* reg;
+
+	while((reg = on_main) != NULL)
+	{
+		on_main = NULL;
+		reg->callback(reg->context);
+	}
+	while((reg = can_send) != NULL)
+	{
+		can_send = NULL;
+		reg->callback(reg->context);
+	}
+}
+
+// the feed job runs until the channel has been idle, then it has typed
+static const char* test_feed(void)
+{
+	typed[0] = 0;
+	c64b_spp_feed(NULL, "");
+	return typed;
+}
+
+//----------------------------------------------------------------------------//
+
+static void test_credits(void)
+{
+	test_event(GATTSERVICE_SUBEVENT_SPP_SERVICE_CONNECTED, 0x40);
+	test_stack();
+	test_expect("connect grants the whole ring", (granted == SPP_RX_LEN) && (spp.owed == SPP_RX_LEN));
+
+	test_rx_str("10 print\r");
+	test_rx_str("20 goto 10\r");
+	test_expect("received text takes the credits", spp.owed == SPP_RX_LEN - 20);
+	test_expect("one feed job for the text", (jobs == 1) && spp.active);
+
+	test_rx(NULL, SPP_RX_LEN);
+	test_expect("bytes beyond the credits are dropped",
+		(spp.owed == 0) && (spp.drops == 20) && (spp_used() == SPP_RX_LEN));
+
+	test_rx_str("more");
+	test_expect("no credits left, nothing taken", (spp.owed == 0) && (spp.drops == 24) && (spp_used() == SPP_RX_LEN));
+
+	spp_grant(NULL);
+	test_stack();
+	test_expect("no grant without room", notifications == 1);
+
+	// the feed returns the room while typing
+	const char* s = test_feed();
+	test_expect("the text is typed", strncmp(s, "10 print~ret~|20 goto 10~ret~|abcdef", 36) == 0);
+	test_expect("feed job ends idle", !spp.active && (spp_used() == 0) && (slept_ms >= SPP_IDLE_MS));
+	test_stack();
+	test_expect("the room is granted again", (spp.owed == SPP_RX_LEN) && (granted == 2 * SPP_RX_LEN));
+
+	test_event(GATTSERVICE_SUBEVENT_SPP_SERVICE_DISCONNECTED, 0x40);
+	test_expect("disconnect voids the credits", (spp.con == HCI_CON_HANDLE_INVALID) && (spp.owed == 0));
+
+	uint32_t drops = spp.drops;
+	test_rx_str("late");
+	spp_grant(NULL);
+	test_stack();
+	test_expect("nothing taken or granted while disconnected",
+		(spp.drops == drops + 4) && (spp_used() == 0) && (notifications == 2));
+
+	// with the macro queue full the next packet queues the job
+	test_event(GATTSERVICE_SUBEVENT_SPP_SERVICE_CONNECTED, 0x41);
+	test_stack();
+	queue_full = true;
+	test_rx_str("a");
+	queue_full = false;
+	bool waiting = !spp.active && (jobs == 1);
+	test_rx_str("b");
+	test_expect("text waits for the next packet when the queue is full", waiting && spp.active && (jobs == 2));
+	test_expect("both packets typed", strcmp(test_feed(), "ab|") == 0);
+	test_stack();
+}
+
+//----------------------------------------------------------------------------//
+
+static void test_escape(const char* what, const char* in, const char* out)
+{
+	spp.active = true;
+	test_rx_str(in);
+	const char* s = test_feed();
+	test_stack();
+
+	bool ok = (strcmp(s, out) == 0);
+	test_expect(what, ok);
+	if(!ok)
+		printf("     typed \"%s\", expected \"%s\"\n", s, out);
+}
+
+static void test_escapes(void)
+{
+	test_escape("escape",                       "a~clr~b",                 "a~clr~b|");
+	test_escape("CR LF is one return",          "1\r\n2\n",                "1~ret~|2~ret~|");
+	test_escape("escape too long is dropped",   "~abcdefghijklmnopqrs~x",  "pqrs|");
+	test_escape("escape with a bad key",        "a~cl\x01r~b",             "ar|");
+	test_escape("unterminated escape dropped",  "ab~cl",                   "ab|");
+
+	// a long line is cut at SPP_STR_FLUSH, but not inside an escape: the one
+	// opened at the limit is typed with the next character
+	char in[SPP_STR_FLUSH + 16];
+	char out[SPP_STR_FLUSH + 16];
+	memset(in, 'x', SPP_STR_FLUSH - 1);
+	strcpy(&in[SPP_STR_FLUSH - 1], "~clr~y");
+	memset(out, 'x', SPP_STR_FLUSH - 1);
+	strcpy(&out[SPP_STR_FLUSH - 1], "~clr~y|");
+	test_escape("escape is not cut by a flush", in, out);
+}
+
+//----------------------------------------------------------------------------//
+
+int main(void)
+{
+	c64b_spp_init();
+
+	test_credits();
+	test_escapes();
+
+	printf("%u failures\n", fails);
+
+	return (fails == 0) ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+// Host test of the keyboard ownership token: a release, or another owner
+// taking the token, is run in the window between a failed attempt of
+// c64b_kb_acquire() and its intent being set. A parser device that does not
+// get the token must always be notified when it is released
+
+static void (*test_window)(void);
+
+#define __atomic_fetch_or(p, v, o) (test_window ? test_window() : (void)0, __atomic_fetch_or(p, v, o))
+
+#include "c64b_threadsafe.c"
+
+#include <stdio.h>
+
+//----------------------------------------------------------------------------//
+// FreeRTOS fakes: the notifications sent to the parser task are accumulated,
+// the event group is a plain word
+
+static uint32_t    notified;
+static EventBits_t evt_bits;
+static int         evt_group;
+static int         parse_task;
+
+EventGroupHandle_t xEventGroupCreate(void) { return &evt_group; }
+EventBits_t xEventGroupSetBits(EventGroupHandle_t g, EventBits_t bits) { return evt_bits |= bits; }
+EventBits_t xEventGroupClearBits(EventGroupHandle_t g, EventBits_t bits) { EventBits_t b = evt_bits; evt_bits &= ~bits; return b; }
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t g, EventBits_t bits, BaseType_t clear, BaseType_t all, TickType_t wait) { return evt_bits; }
+TickType_t xTaskGetTickCount(void) { return 0; }
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+	if(task == &parse_task)
+		notified |= value;
+	return pdPASS;
+}
+
+//----------------------------------------------------------------------------//
+
+static unsigned int fails = 0;
+
+static void test_expect(const char* what, bool ok)
+{
+	printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+	fails += ok ? 0 : 1;
+}
+
+static void test_reset(t_c64b_kb_owner owner)
+{
+	c64b_kb_init();
+	kb_owner       = owner;
+	evt_bits       = (owner == KB_OWNER_NONE) ? KB_EVT_FREE : 0;
+	kb_intent      = 0;
+	kb_intent_task = &parse_task;
+	notified       = 0;
+	test_window    = NULL;
+	memset(kb_defer_cnt, 0, sizeof(kb_defer_cnt));
+}
+
+//----------------------------------------------------------------------------//
+// what the interleavings run in the window
+
+static void test_release_feed(void)
+{
+	test_window = NULL;
+	c64b_kb_release(KB_OWNER_FEED);
+}
+
+static void test_release_feed_take_ctl1(void)
+{
+	test_window = NULL;
+	c64b_kb_release(KB_OWNER_FEED);
+	c64b_kb_acquire(KB_OWNER_CTL1);
+}
+
+//----------------------------------------------------------------------------//
+
+static void test_plain(void)
+{
+	test_reset(KB_OWNER_NONE);
+	test_expect("free token is taken", c64b_kb_acquire(KB_OWNER_KBRD) && c64b_kb_owned(KB_OWNER_KBRD));
+	test_expect("owner takes it again", c64b_kb_acquire(KB_OWNER_KBRD) && (kb_intent == 0));
+
+	test_reset(KB_OWNER_FEED);
+	test_expect("held token is not taken", !c64b_kb_acquire(KB_OWNER_KBRD) && c64b_kb_owned(KB_OWNER_FEED));
+	test_expect("deferral counted", kb_defer_cnt[KB_OWNER_KBRD] == 1);
+	test_expect("not notified while held", notified == 0);
+	c64b_kb_release(KB_OWNER_FEED);
+	test_expect("notified on release", notified == KB_INTENT_BIT(KB_OWNER_KBRD));
+	test_expect("intent consumed", kb_intent == 0);
+
+	test_reset(KB_OWNER_FEED);
+	c64b_kb_release(KB_OWNER_CTL1);
+	test_expect("release by another owner ignored", c64b_kb_owned(KB_OWNER_FEED) && ((evt_bits & KB_EVT_FREE) == 0));
+	c64b_kb_release(KB_OWNER_FEED);
+	test_expect("release sets the free event", (evt_bits & KB_EVT_FREE) != 0);
+}
+
+//----------------------------------------------------------------------------//
+
+static void test_interleaved(void)
+{
+	// the owner releases after the failed attempt, before the intent is set:
+	// nobody would release again, the token has to be taken right away
+	test_reset(KB_OWNER_FEED);
+	test_window = test_release_feed;
+	bool got = c64b_kb_acquire(KB_OWNER_KBRD);
+	test_expect("release in the window: not lost", got || (notified & KB_INTENT_BIT(KB_OWNER_KBRD)));
+	test_expect("release in the window: token taken", got && c64b_kb_owned(KB_OWNER_KBRD));
+	test_expect("release in the window: no intent left", kb_intent == 0);
+	test_expect("release in the window: not counted", kb_defer_cnt[KB_OWNER_KBRD] == 0);
+	notified = 0;
+	c64b_kb_release(KB_OWNER_KBRD);
+	test_expect("release in the window: no stale notification", notified == 0);
+
+	// another owner takes the token in the window: its release notifies
+	test_reset(KB_OWNER_FEED);
+	test_window = test_release_feed_take_ctl1;
+	test_expect("taken in the window: not taken", !c64b_kb_acquire(KB_OWNER_KBRD) && c64b_kb_owned(KB_OWNER_CTL1));
+	test_expect("taken in the window: not notified yet", notified == 0);
+	c64b_kb_release(KB_OWNER_CTL1);
+	test_expect("taken in the window: notified on release", notified == KB_INTENT_BIT(KB_OWNER_KBRD));
+
+	// two devices deferred, a single release notifies both
+	test_reset(KB_OWNER_FEED);
+	c64b_kb_acquire(KB_OWNER_CTL1);
+	c64b_kb_acquire(KB_OWNER_CTL2);
+	c64b_kb_release(KB_OWNER_FEED);
+	test_expect("both devices notified", notified == (KB_INTENT_BIT(KB_OWNER_CTL1) | KB_INTENT_BIT(KB_OWNER_CTL2)));
+}
+
+//----------------------------------------------------------------------------//
+
+int main(void)
+{
+	test_plain();
+	test_interleaved();
+
+	printf("%u failures\n", fails);
+
+	return (fails == 0) ? 0 : 1;
+}
@@ -0,0 +1,188 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+// Host test of the timer wheel of the btstack run loop against a reference
+// model: timers are added, removed and re-armed at random while the time
+// jumps ahead, across the wrap of the 32 bit millisecond counter. No timer may
+// fire early, fire twice or be missed, the reported time until the next
+// timeout may not be later than the first due timer
+
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_timer_wheel.h"
+#include "btstack_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+//----------------------------------------------------------------------------//
+// the reference model: which timers are armed and when they are due
+
+#define TEST_TIMERS 300
+
+static btstack_timer_source_t timers[TEST_TIMERS];
+static bool                   armed[TEST_TIMERS];
+static uint32_t               due[TEST_TIMERS];
+static uint32_t               now;
+static uint32_t               max_delay;
+static unsigned long          fired;
+static unsigned long          errors;
+
+static void test_error(const char* what, int i)
+{
+	if(errors++ < 10)
+		printf("     %s, timer %d, now %08x\n", what, i, (unsigned int)now);
+}
+
+static void test_arm(int i, uint32_t delay)
+{
+	timers[i].timeout = now + delay;
+	due[i]            = timers[i].timeout;
+	armed[i]          = true;
+	btstack_run_loop_timer_wheel_add_timer(&timers[i]);
+}
+
+static void test_fired(btstack_timer_source_t* timer)
+{
+	int i = (int)(timer - timers);
+
+	fired++;
+	if(!armed[i])
+		test_error("fired while not armed", i);
+	if(btstack_time_delta(due[i], now) > 0)
+		test_error("fired early", i);
+	armed[i] = false;
+
+	// expired timers are re-armed from their handler, some for right now
+	if(rand() % 8 == 0)
+		test_arm(i, 0);
+	else
+		test_arm(i, 1 + rand() % max_delay);
+}
+
+static int32_t test_ref_time_until(void)
+{
+	int32_t until = -1;
+	for(int i = 0; i < TEST_TIMERS; ++i)
+	{
+		if(!armed[i])
+			continue;
+		int32_t d = btstack_time_delta(due[i], now);
+		d = (d < 0) ? 0 : d;
+		until = ((until < 0) || (d < until)) ? d : until;
+	}
+	return until;
+}
+
+//----------------------------------------------------------------------------//
+// runs the model for the given number of steps, each step removes or arms a
+// timer, then advances the time to the next timeout or by a random jump
+
+static void test_run(uint32_t start, int n, uint32_t delay, long steps, unsigned int seed)
+{
+	srand(seed);
+	memset(timers, 0, sizeof(timers));
+	memset(armed, 0, sizeof(armed));
+	now       = start;
+	max_delay = delay;
+	fired     = 0;
+	errors    = 0;
+
+	btstack_run_loop_timer_wheel_init(now);
+	for(int i = 0; i < n; ++i)
+	{
+		timers[i].process = test_fired;
+		test_arm(i, 1 + rand() % max_delay);
+	}
+
+	long early = 0;
+	for(long s = 0; s < steps; ++s)
+	{
+		int op = rand() % 100;
+		int i  = rand() % n;
+		if(op < 10)
+		{
+			if(btstack_run_loop_timer_wheel_remove_timer(&timers[i]) != armed[i])
+				test_error("remove does not match", i);
+			armed[i] = false;
+		}
+		else if((op < 20) && !armed[i])
+		{
+			test_arm(i, rand() % max_delay);
+		}
+
+		// the wheel may wake up early at the boundary of a coarser level
+		int32_t until = btstack_run_loop_timer_wheel_get_time_until_timeout(now);
+		int32_t ref   = test_ref_time_until();
+		if(((until < 0) != (ref < 0)) || (until > ref))
+			test_error("time until the next timeout too late", -1);
+		early += (until < ref) ? 1 : 0;
+
+		now += (rand() % 4 == 0) ? (uint32_t)(rand() % 70000) : ((until >= 0) ? (uint32_t)until : 100u);
+		btstack_run_loop_timer_wheel_process_timers(now);
+
+		for(int k = 0; k < n; ++k)
+		{
+			if(armed[k] && (btstack_time_delta(due[k], now) <= 0))
+			{
+				test_error("missed", k);
+				armed[k] = false;
+				btstack_run_loop_timer_wheel_remove_timer(&timers[k]);
+			}
+		}
+	}
+
+	printf("%s start %08x, %3d timers up to %7u ms: %ld fired, %ld early wakeups\n",
+		(errors == 0) ? "ok  " : "FAIL", (unsigned int)start, n, (unsigned int)delay, fired, early);
+}
+
+//----------------------------------------------------------------------------//
+
+int main(void)
+{
+	static const uint32_t starts[] = {0, 1000, 0x7ffff000u, 0xffff0000u, 0xffffffc0u};
+
+	unsigned int fails = 0;
+
+	// a wheel that never catches up with the time would hang the test
+	alarm(60);
+
+	for(unsigned int s = 0; s < sizeof(starts) / sizeof(starts[0]); ++s)
+	{
+		test_run(starts[s], TEST_TIMERS, 30000, 20000, 7 + s);
+		fails += (errors != 0) ? 1 : 0;
+	}
+
+	// delays on the outer levels, and timers that all stay in the first level
+	test_run(0xfff00000u, 200, 2000000, 20000, 99);
+	fails += (errors != 0) ? 1 : 0;
+	test_run(0xffffff00u, 100, 60, 20000, 5);
+	fails += (errors != 0) ? 1 : 0;
+
+	printf("%u failures\n", fails);
+
+	return (fails == 0) ? 0 : 1;
+}
@@ -0,0 +1,243 @@
+//----------------------------------------------------------------------------//
+//         .XXXXXXXXXXXXXXXX.  .XXXXXXXXXXXXXXXX.  .XX.                       //
+//         XXXXXXXXXXXXXXXXX'  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         XXXX                XXXX          XXXX  XXXX                       //
+//         XXXXXXXXXXXXXXXXX.  XXXXXXXXXXXXXXXXXX  XXXX                       //
+//         'XXXXXXXXXXXXXXXXX  XXXXXXXXXXXXXXXXX'  XXXX                       //
+//                       XXXX  XXXX                XXXX                       //
+//         .XXXXXXXXXXXXXXXXX  XXXX                XXXXXXXXXXXXXXXXX.         //
+//         'XXXXXXXXXXXXXXXX'  'XX'                'XXXXXXXXXXXXXXXX'         //
+//----------------------------------------------------------------------------//
+//             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// You may obtain a copy of the License at                                    //
+//                                                                            //
+//     http://www.apache.org/licenses/LICENSE-2.0                             //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS,          //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//----------------------------------------------------------------------------//
+
+// Host test of the decoding side of the sd-card updater: images, gzip files
+// and deltas made by update_pack.py are fed to the writer in pieces of random
+// size and the image written to the "flash" is compared with the original
+//
+//   test_update dir    (old.bin, new.bin and the packed files, see Makefile)
+
+#include "c64b_update.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+//----------------------------------------------------------------------------//
+// fakes of the platform: the running partition holds old.bin, the flash
+// writes go to a buffer
+
+typedef struct
+{
+	uint8_t* buf;
+	size_t   len;
+} t_test_file;
+
+static t_test_file     src_img;
+static esp_partition_t src_part;
+static uint8_t*        flash;
+static size_t          flash_len;
+static size_t          flash_cap;
+
+esp_err_t esp_partition_read(const esp_partition_t* part, size_t off, void* buf, size_t len)
+{
+	if(off + len > src_img.len)
+		return ESP_FAIL;
+	memcpy(buf, &src_img.buf[off], len);
+	return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t h, const void* buf, size_t len)
+{
+	if(flash_len + len > flash_cap)
+		return ESP_FAIL;
+	memcpy(&flash[flash_len], buf, len);
+	flash_len += len;
+	return ESP_OK;
+}
+
+// not reached by the test
+const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* s) { return NULL; }
+const esp_partition_t* esp_ota_get_running_partition(void) { return &src_part; }
+esp_err_t esp_ota_begin(const esp_partition_t* p, size_t n, esp_ota_handle_t* h) { return ESP_FAIL; }
+esp_err_t esp_ota_end(esp_ota_handle_t h) { return ESP_FAIL; }
+esp_err_t esp_ota_abort(esp_ota_handle_t h) { return ESP_OK; }
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t* p) { return ESP_FAIL; }
+QueueHandle_t xQueueCreate(UBaseType_t n, UBaseType_t size) { return NULL; }
+BaseType_t xQueueSend(QueueHandle_t q, const void* item, TickType_t wait) { return pdFALSE; }
+BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t wait) { abort(); }
+BaseType_t xQueueReset(QueueHandle_t q) { return pdTRUE; }
+SemaphoreHandle_t xSemaphoreCreateBinary(void) { return NULL; }
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t wait) { return pdTRUE; }
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s) { return pdTRUE; }
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack, void* arg, UBaseType_t prio, TaskHandle_t* task, BaseType_t core) { return pdFALSE; }
+void vTaskDelete(TaskHandle_t task) {}
+int64_t esp_timer_get_time(void) { return 0; }
+bool c64b_sdcard_mount(void) { return false; }
+void c64b_sdcard_unmount(void) {}
+void c64b_sdcard_attach(void) {}
+void c64b_sdcard_detach(void) {}
+void c64b_property_flush(void) {}
+
+//----------------------------------------------------------------------------//
+
+static t_test_file test_load(const char* dir, const char* name)
+{
+	char        path[512];
+	t_test_file f = {NULL, 0};
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	FILE* fp = fopen(path, "rb");
+	if(fp == NULL)
+	{
+		fprintf(stderr, "cannot open %s\n", path);
+		exit(2);
+	}
+
+	fseek(fp, 0, SEEK_END);
+	f.len = ftell(fp);
+	f.buf = malloc(f.len + 1);
+	rewind(fp);
+	if(fread(f.buf, 1, f.len, fp) != f.len)
+		exit(2);
+	fclose(fp);
+
+	return f;
+}
+
+//----------------------------------------------------------------------------//
+// runs the writer over the file as task_update_write() does, the pieces being
+// up to max_piece bytes long
+
+static bool test_decode(const t_test_file* f, size_t max_piece, unsigned int seed)
+{
+	srand(seed);
+
+	ota_src     = &src_part;
+	ota_gz      = NULL;
+	ota_out_len = 0;
+	ota_first   = true;
+	ota_res     = UPDATE_OK;
+	flash_len   = 0;
+	c64b_delta_init(&ota_delta, update_src, update_out, NULL);
+
+	// the format is told from the first buffer, which the reader always fills
+	bool   ok  = true;
+	size_t pos = 0;
+	while(ok && (pos < f->len))
+	{
+		size_t n = (pos == 0) ? UPDATE_BUF_SIZE : (1 + rand() % max_piece);
+		n = (n < f->len - pos) ? n : (f->len - pos);
+
+		ok   = update_decode(&f->buf[pos], n);
+		pos += n;
+	}
+
+	ok = ok && update_decode_end() && update_out_flush();
+
+	free(ota_gz);
+	ota_gz = NULL;
+
+	return ok && (ota_res == UPDATE_OK);
+}
+
+//----------------------------------------------------------------------------//
+
+static unsigned int fails = 0;
+
+static void test_expect(const char* what, const t_test_file* f, const t_test_file* img, bool good)
+{
+	static const size_t pieces[] = {1, 7, 100, 4096, UPDATE_BUF_SIZE};
+
+	for(unsigned int p = 0; p < sizeof(pieces) / sizeof(pieces[0]); ++p)
+	{
+		for(unsigned int seed = 1; seed <= 3; ++seed)
+		{
+			bool ok = test_decode(f, pieces[p], seed);
+
+			if(good && ok)
+				ok = (flash_len == img->len) && (memcmp(flash, img->buf, img->len) == 0);
+			else
+				ok = (ok == good);
+
+			if(!ok)
+			{
+				printf("FAIL %s, pieces up to %u bytes, seed %u\n", what, (unsigned int)pieces[p], seed);
+				++fails;
+				return;
+			}
+		}
+	}
+	printf("ok   %s\n", what);
+}
+
+//----------------------------------------------------------------------------//
+
+int main(int argc, char** argv)
+{
+	if(argc != 2)
+	{
+		fprintf(stderr, "usage: test_update dir\n");
+		return 2;
+	}
+
+	const char* dir = argv[1];
+
+	src_img       = test_load(dir, "old.bin");
+	src_part.size = src_img.len;
+
+	t_test_file img  = test_load(dir, "new.bin");
+	t_test_file gz   = test_load(dir, "new.gz");
+	t_test_file gzn  = test_load(dir, "new_named.gz");
+	t_test_file dlt  = test_load(dir, "new.dlt");
+	t_test_file wdlt = test_load(dir, "wrong.dlt");
+
+	flash_cap = 2 * img.len + UPDATE_OUT_LEN;
+	flash     = malloc(flash_cap);
+	ota_out   = malloc(UPDATE_OUT_LEN);
+
+	test_expect("plain image",                  &img,  &img, true);
+	test_expect("gzip image",                   &gz,   &img, true);
+	test_expect("gzip image with a file name",  &gzn,  &img, true);
+	test_expect("gzip delta",                   &dlt,  &img, true);
+	test_expect("delta for another source",     &wdlt, &img, false);
+
+	// damaged copies of the gzip file
+	t_test_file bad = {malloc(gz.len), gz.len};
+
+	for(size_t cut = 1; cut <= GZ_TAIL_LEN + 1; cut += 4)
+	{
+		char what[64];
+		snprintf(what, sizeof(what), "gzip image without the last %u bytes", (unsigned int)cut);
+		memcpy(bad.buf, gz.buf, gz.len);
+		bad.len = gz.len - cut;
+		test_expect(what, &bad, &img, false);
+	}
+
+	bad.len = gz.len;
+	memcpy(bad.buf, gz.buf, gz.len);
+	bad.buf[gz.len - GZ_TAIL_LEN] ^= 0x01;
+	test_expect("gzip image with a wrong crc", &bad, &img, false);
+
+	memcpy(bad.buf, gz.buf, gz.len);
+	bad.buf[gz.len - 1] ^= 0x01;
+	test_expect("gzip image with a wrong size", &bad, &img, false);
+
+	memcpy(bad.buf, gz.buf, gz.len);
+	bad.buf[gz.len / 2] ^= 0x55;
+	test_expect("gzip image with damaged data", &bad, &img, false);
+
+	printf("%u failures\n", fails);
+	return (fails == 0) ? 0 : 1;
+}
@@ -0,0 +1,192 @@
+#!/usr/bin/env python3
+#----------------------------------------------------------------------------#
+#             Copyright 2023 Vittorio Pascucci (SideProjectsLab)             #
+#                                                                            #
+# Licensed under the Apache License, Version 2.0 (the "License");            #
+# you may not use this file except in compliance with the License.           #
+# You may obtain a copy of the License at                                    #
+#                                                                            #
+#     http://www.apache.org/licenses/LICENSE-2.0                             #
+#                                                                            #
+# Unless required by applicable law or agreed to in writing, software        #
+# distributed under the License is distributed on an "AS IS" BASIS,          #
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   #
+# See the License for the specific language governing permissions and        #
+# limitations under the License.                                             #
+#----------------------------------------------------------------------------#
+#
+# Packs a firmware image for the sd-card updater:
+#
+#   update_pack.py gz    new.bin [application.gz]
+#   update_pack.py delta old.bin new.bin [application.dlt]
+#   update_pack.py apply old.bin application.dlt new.bin
+#
+# "gz" compresses the image. "delta" describes the new image in terms of the
+# one running on the device (old.bin must be exactly that image), the delta is
+# compressed as well. "apply" rebuilds the image from a delta, as the device
+# does. The format is described in src/main/c64b_delta.h
+
+import gzip
+import hashlib
+import struct
+import sys
+
+MAGIC   = b"C64BDLT1"
+KEY_LEN = 8   # bytes hashed to find a match
+KEY_GAP = 4   # the source is indexed every KEY_GAP bytes
+MIN_LEN = 24  # shorter matches are written as data
+WIN_LEN = 16  # a diff goes on while half of the window matches
+
+
+def index(old):
+	idx = {}
+	for i in range((len(old) - KEY_LEN) // KEY_GAP * KEY_GAP, -1, -KEY_GAP):
+		idx[old[i:i + KEY_LEN]] = i
+	return idx
+
+
+def match_len(old, o, new, n):
+	m = 0
+	while (o + m < len(old)) and (n + m < len(new)) and (old[o + m] == new[n + m]):
+		m += 1
+	return m
+
+
+# a diff extends a match over the bytes that differ in a few places, such as
+# code moved by a few bytes with its addresses changed
+def diff_len(old, o, new, n):
+	m = 0
+	while True:
+		w = min(WIN_LEN, len(old) - o - m, len(new) - n - m)
+		if w < WIN_LEN:
+			return m
+		eq = sum(1 for k in range(w) if old[o + m + k] == new[n + m + k])
+		if eq * 2 < w:
+			return m
+		m += w
+
+
+def delta(old, new):
+	idx  = index(old)
+	ops  = bytearray()
+	data = bytearray()
+	last = 0 # source minus target offset of the last match
+	n    = 0
+
+	def flush_data():
+		if data:
+			ops.extend(b"D" + struct.pack("<I", len(data)) + data)
+			data.clear()
+
+	while n < len(new):
+		best_o, best_m = -1, 0
+
+		# the match following the previous one is tried first
+		for o in (n + last, idx.get(bytes(new[n:n + KEY_LEN]), -1)):
+			if 0 <= o < len(old):
+				m = match_len(old, o, new, n)
+				if m > best_m:
+					best_o, best_m = o, m
+
+		if best_m < MIN_LEN:
+			data.append(new[n])
+			n += 1
+			continue
+
+		# the data just before may match as well, the index is sparse
+		while data and (best_o > 0) and (old[best_o - 1] == data[-1]):
+			data.pop()
+			best_o -= 1
+			best_m += 1
+			n      -= 1
+
+		flush_data()
+		ops.extend(b"C" + struct.pack("<II", best_o, best_m))
+		last = best_o - n
+		n   += best_m
+
+		d = diff_len(old, n + last, new, n)
+		if d > 0:
+			o = n + last
+			ops.extend(b"X" + struct.pack("<II", o, d))
+			ops.extend(bytes((new[n + k] - old[o + k]) & 0xff for k in range(d)))
+			n += d
+
+	flush_data()
+	ops.extend(b"E")
+	return MAGIC + struct.pack("<II", len(old), len(new)) + bytes(ops)
+
+
+def apply(old, dlt):
+	if dlt[:2] == b"\x1f\x8b":
+		dlt = gzip.decompress(dlt)
+	if dlt[:len(MAGIC)] != MAGIC:
+		return bytes(dlt)
+
+	src_len, dst_len = struct.unpack_from("<II", dlt, len(MAGIC))
+	if src_len != len(old):
+		raise ValueError("delta made for another source")
+
+	out = bytearray()
+	p   = len(MAGIC) + 8
+	while True:
+		op = dlt[p:p + 1]
+		p += 1
+		if op == b"C":
+			o, m = struct.unpack_from("<II", dlt, p)
+			p += 8
+			out.extend(old[o:o + m])
+		elif op == b"D":
+			(m,) = struct.unpack_from("<I", dlt, p)
+			p += 4
+			out.extend(dlt[p:p + m])
+			p += m
+		elif op == b"X":
+			o, m = struct.unpack_from("<II", dlt, p)
+			p += 8
+			out.extend((old[o + k] + dlt[p + k]) & 0xff for k in range(m))
+			p += m
+		elif op == b"E":
+			break
+		else:
+			raise ValueError("unknown operation")
+
+	if len(out) != dst_len:
+		raise ValueError("target length mismatch")
+	return bytes(out)
+
+
+USAGE = """usage:
+  update_pack.py gz    new.bin [application.gz]
+  update_pack.py delta old.bin new.bin [application.dlt]
+  update_pack.py apply old.bin application.dlt new.bin"""
+
+
+def main(argv):
+	if (len(argv) >= 3) and (argv[1] == "gz"):
+		img = open(argv[2], "rb").read()
+		out = argv[3] if len(argv) > 3 else "application.gz"
+		dat = gzip.compress(img, 9)
+	elif (len(argv) >= 4) and (argv[1] == "delta"):
+		old = open(argv[2], "rb").read()
+		img = open(argv[3], "rb").read()
+		out = argv[4] if len(argv) > 4 else "application.dlt"
+		dat = gzip.compress(delta(old, img), 9)
+		if apply(old, dat) != img:
+			raise SystemExit("delta check failed")
+	elif (len(argv) == 5) and (argv[1] == "apply"):
+		old = open(argv[2], "rb").read()
+		img = apply(old, open(argv[3], "rb").read())
+		out = argv[4]
+		dat = img
+	else:
+		raise SystemExit(USAGE)
+
+	open(out, "wb").write(dat)
+
+	# the digest to write in application.sha256
+	print("%s: %d bytes, image sha256 %s" % (out, len(dat), hashlib.sha256(img).hexdigest()))
+
+
+if __name__ == "__main__":
+	main(sys.argv)